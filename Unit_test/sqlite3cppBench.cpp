@@ -0,0 +1,267 @@
+// Per-call micro-benchmarks of the wrapper against the plain sqlite3 C API.
+// Build: g++ -O2 -std=c++11 sqlite3cppBench.cpp -lsqlite3 -o sqlite3cppBench
+//
+// Besides the Catch benchmark report, every call is timed for the baseline
+// check in batches, alternating between the wrapper and the C API so a change
+// of machine load or clock speed during the run hits both sides alike. The
+// fastest batch of each side gives its time per call; the "<call>/wrapper"
+// time divided by the "<call>/capi" time is compared with the ratio stored in
+// sqlite3cppBench.baseline next to this file (or the file named by
+// SQLITE3CPP_BENCH_BASELINE). Comparing ratios rather than raw times keeps the
+// check meaningful across machines. A ratio more than
+// SQLITE3CPP_BENCH_TOLERANCE percent (default 50) above its baseline fails the
+// last test case. Run with SQLITE3CPP_BENCH_UPDATE=1 to rewrite the baseline
+// from the current results.
+#include "../sqlite3cpp.h"
+#define CATCH_CONFIG_MAIN
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include "catch.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <map>
+
+namespace {
+
+// Calls per timed batch, and alternating batches per side for the baseline
+const int batch = 200;
+const int rounds = 2000;
+
+volatile long sink = 0;
+
+std::map<std::string, double>& results()
+{
+    static std::map<std::string, double> r;
+    return r;
+}
+
+std::string baselinePath()
+{
+    const char* env = std::getenv("SQLITE3CPP_BENCH_BASELINE");
+    if(env) return env;
+    std::string here(__FILE__);
+    size_t slash = here.find_last_of('/');
+    return (slash == std::string::npos ? std::string(".") : here.substr(0, slash)) + "/sqlite3cppBench.baseline";
+}
+
+std::map<std::string, double> readBaseline(std::string const& path)
+{
+    std::map<std::string, double> baseline;
+    std::ifstream in(path.c_str());
+    std::string name;
+    double ns;
+    while(in >> name >> ns) baseline[name] = ns;
+    return baseline;
+}
+
+void writeBaseline(std::string const& path, std::map<std::string, double> const& r)
+{
+    std::ofstream out(path.c_str());
+    out << std::fixed;
+    out.precision(2);
+    for(std::map<std::string, double>::const_iterator it = r.begin(); it != r.end(); ++it) {
+        out << it->first << " " << it->second << "\n";
+    }
+}
+
+// Nanoseconds for one batch of calls
+template<typename F>
+double timeBatch(F& f)
+{
+    long sum = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(int i = 0; i < batch; ++i) sum += f();
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+    sink = sink + sum;
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+// Reports both sides of call as Catch benchmarks and records their time per
+// call for the baseline check. The fastest batch is the one least disturbed.
+template<typename W, typename C>
+void compare(std::string const& call, W wrapper, C capi)
+{
+    BENCHMARK(call + "/wrapper") {
+        return wrapper();
+    };
+    BENCHMARK(call + "/capi") {
+        return capi();
+    };
+
+    double best_wrapper = std::numeric_limits<double>::max();
+    double best_capi = std::numeric_limits<double>::max();
+    for(int round = 0; round < rounds; ++round) {
+        best_wrapper = std::min(best_wrapper, timeBatch(wrapper));
+        best_capi = std::min(best_capi, timeBatch(capi));
+    }
+    results()[call + "/wrapper"] = best_wrapper / batch;
+    results()[call + "/capi"] = best_capi / batch;
+}
+
+sqlite3_stmt* capiPrepare(sqlite3* db, const char* sql)
+{
+    sqlite3_stmt* stmt = NULL;
+    sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+    return stmt;
+}
+
+} // namespace
+
+TEST_CASE("Sqlite3cpp: step() and reset() overhead", "[Benchmark]")
+{
+    Sqlite db(":memory:", false);
+    sqlite3* raw = NULL;
+    sqlite3_open(":memory:", &raw);
+    sqlite3_stmt* stmt = capiPrepare(raw, "SELECT 1");
+    db.setQuery("SELECT 1");
+    db.prepare();
+
+    compare("step",
+        [&]() -> long {
+            bool row = db.step();
+            db.reset();
+            return row;
+        },
+        [&]() -> long {
+            int rc = sqlite3_step(stmt);
+            sqlite3_reset(stmt);
+            return rc;
+        });
+    compare("reset",
+        [&]() -> long {
+            db.reset();
+            return 0;
+        },
+        [&]() -> long {
+            return sqlite3_reset(stmt);
+        });
+
+    sqlite3_finalize(stmt);
+    sqlite3_close(raw);
+}
+
+TEST_CASE("Sqlite3cpp: bind() overhead", "[Benchmark]")
+{
+    Sqlite db(":memory:", false);
+    sqlite3* raw = NULL;
+    sqlite3_open(":memory:", &raw);
+    sqlite3_stmt* stmt = capiPrepare(raw, "SELECT ?");
+    db.setQuery("SELECT ?");
+    db.prepare();
+    const std::string text(64, 't');
+
+    compare("bind_int",
+        [&]() -> long {
+            db.bind(1, 42);
+            return 0;
+        },
+        [&]() -> long {
+            return sqlite3_bind_int(stmt, 1, 42);
+        });
+    compare("bind_double",
+        [&]() -> long {
+            db.bind(1, 4.2);
+            return 0;
+        },
+        [&]() -> long {
+            return sqlite3_bind_double(stmt, 1, 4.2);
+        });
+    compare("bind_text",
+        [&]() -> long {
+            db.bind(1, text);
+            return 0;
+        },
+        [&]() -> long {
+            return sqlite3_bind_text(stmt, 1, text.c_str(), text.length(), SQLITE_TRANSIENT);
+        });
+    compare("bind_null",
+        [&]() -> long {
+            db.bind_null(1);
+            return 0;
+        },
+        [&]() -> long {
+            return sqlite3_bind_null(stmt, 1);
+        });
+
+    sqlite3_finalize(stmt);
+    sqlite3_close(raw);
+}
+
+TEST_CASE("Sqlite3cpp: get*() overhead", "[Benchmark]")
+{
+    const char* sql = "SELECT 42, 4.2, 'accessor benchmark text value', zeroblob(64)";
+    Sqlite db(":memory:", false);
+    sqlite3* raw = NULL;
+    sqlite3_open(":memory:", &raw);
+    sqlite3_stmt* stmt = capiPrepare(raw, sql);
+    sqlite3_step(stmt);
+    db.setQuery(sql);
+    db.prepare();
+    db.step();
+
+    compare("getInt",
+        [&]() -> long {
+            return db.getInt(0);
+        },
+        [&]() -> long {
+            return sqlite3_column_int(stmt, 0);
+        });
+    compare("getDouble",
+        [&]() -> long {
+            return static_cast<long>(db.getDouble(1));
+        },
+        [&]() -> long {
+            return static_cast<long>(sqlite3_column_double(stmt, 1));
+        });
+    compare("getText",
+        [&]() -> long {
+            return db.getText(2).size();
+        },
+        [&]() -> long {
+            return sqlite3_column_text(stmt, 2) != NULL;
+        });
+    compare("getBlob",
+        [&]() -> long {
+            return db.getBlob(3).size();
+        },
+        [&]() -> long {
+            return sqlite3_column_blob(stmt, 3) != NULL;
+        });
+
+    sqlite3_finalize(stmt);
+    sqlite3_close(raw);
+}
+
+TEST_CASE("Sqlite3cpp: Compare with baseline", "[Benchmark]")
+{
+    std::string path = baselinePath();
+    if(std::getenv("SQLITE3CPP_BENCH_UPDATE")) {
+        writeBaseline(path, results());
+        WARN("Baseline written to " << path);
+        return;
+    }
+
+    double tolerance = 50.0;
+    if(const char* env = std::getenv("SQLITE3CPP_BENCH_TOLERANCE")) tolerance = std::atof(env);
+
+    std::map<std::string, double> baseline = readBaseline(path);
+    if(baseline.empty()) {
+        WARN("No baseline found at " << path);
+        return;
+    }
+    std::map<std::string, double> const& current = results();
+    for(std::map<std::string, double>::const_iterator it = current.begin(); it != current.end(); ++it) {
+        size_t slash = it->first.rfind("/wrapper");
+        if(slash == std::string::npos) continue;
+        std::string capi = it->first.substr(0, slash) + "/capi";
+        if(!current.count(capi) || !baseline.count(it->first) || !baseline.count(capi)) continue;
+
+        double ratio = it->second / current.find(capi)->second;
+        double base_ratio = baseline[it->first] / baseline[capi];
+        INFO(it->first << ": " << ratio << "x the C API, baseline " << base_ratio << "x");
+        CHECK(ratio <= base_ratio * (1.0 + tolerance / 100.0));
+    }
+}
@@ -1,6 +1,21 @@
+#include "../sqlite3cpp_session.h"
 #include "../sqlite3cpp.h"
+#include "../sqlite3cpp_memory.h"
+#include "../sqlite3cpp_backup.h"
+#include "../sqlite3cpp_cache.h"
+#include "../sqlite3cpp_csv.h"
+#include "../sqlite3cpp_export.h"
+#include "../sqlite3cpp_lookup.h"
+#include "../sqlite3cpp_vfs.h"
+#include "../sqlite3cpp_vector.h"
+#include "../sqlite3cpp_vtab.h"
 #define CATCH_CONFIG_MAIN
 #include "catch.hpp"
+#ifdef SQLITE3CPP_IO_URING
+#include <csignal>
+#include <dirent.h>
+#include <sys/resource.h>
+#endif
 
 TEST_CASE("Sqlite3cpp: Function test", "[Function]")
 {
@@ -230,3 +245,2103 @@ TEST_CASE("Sqlite3cpp: Read and Write REAL to sqlite3", "[REAL]")
         REQUIRE(db.getDouble(1) == 3.4);
     }
 }
+
+// The progress handler holds the address of the connection
+static_assert(!std::is_copy_constructible<Sqlite>::value, "connections are not copied");
+static_assert(!std::is_move_constructible<Sqlite>::value, "connections are not moved");
+static_assert(noexcept(std::declval<Sqlite&>().tryBind_array(1, static_cast<const int*>(NULL), 0)),
+    "try*() functions report allocation failures instead of throwing");
+
+TEST_CASE("Sqlite3cpp: Deadlines and cancellation", "[Interrupt]")
+{
+    Sqlite db(":memory:", false);
+    std::string endless = "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x+1 FROM c) SELECT count(*) FROM c";
+
+    SECTION("Statement exceeding its timeout -> fail")
+    {
+        db.setTimeout(std::chrono::milliseconds(20));
+        db.setQuery(endless);
+        db.prepare();
+        REQUIRE_THROWS_AS(db.step(), SqliteInterruptException);
+        REQUIRE(db.getTimedOutCount() == 1);
+        REQUIRE(db.getCancelledCount() == 0);
+        REQUIRE_NOTHROW(db.reset());
+    }
+    SECTION("Statement with expired deadline -> fail")
+    {
+        db.setQuery(endless);
+        db.prepare();
+        db.setDeadline(std::chrono::steady_clock::now());
+        try {
+            db.step();
+            FAIL("step() did not throw");
+        } catch(SqliteInterruptException& e) {
+            REQUIRE(e.timedOut());
+            REQUIRE(e.getNumber() == SQLITE_INTERRUPT);
+        }
+    }
+    SECTION("Cancelled token -> fail")
+    {
+        CancellationToken token;
+        db.setCancellationToken(token);
+        token.cancel();
+        db.setQuery(endless);
+        db.prepare();
+        REQUIRE_THROWS_AS(db.step(), SqliteInterruptException);
+        REQUIRE(db.getCancelledCount() == 1);
+        REQUIRE(db.getTimedOutCount() == 0);
+    }
+    SECTION("Deadline is cleared by reset() -> normal")
+    {
+        db.setQuery("WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x+1 FROM c WHERE x < 10000) SELECT count(*) FROM c");
+        db.prepare();
+        db.setDeadline(std::chrono::steady_clock::now());
+        db.reset();
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) == 10000);
+    }
+}
+
+TEST_CASE("Sqlite3cpp: Non-throwing functions", "[Status]")
+{
+    Sqlite db(":memory:", false);
+    REQUIRE(db.tryExec("CREATE TABLE test(id INTEGER PRIMARY KEY, text TEXT)"));
+
+    SECTION("tryExec(), normal execute")
+    {
+        SqliteStatus r = db.tryExec("INSERT INTO test(id, text) VALUES(1, 'test')");
+        REQUIRE(r);
+        REQUIRE(r.code() == SQLITE_OK);
+        REQUIRE(r.message() == "");
+    }
+    SECTION("tryExec(), constraint violation -> code")
+    {
+        REQUIRE(db.tryExec("INSERT INTO test(id, text) VALUES(1, 'test')"));
+        SqliteStatus r = db.tryExec("INSERT INTO test(id, text) VALUES(1, 'test')");
+        REQUIRE_FALSE(r);
+        REQUIRE(r.code() == SQLITE_CONSTRAINT);
+        REQUIRE(r.message() == "Sqlite had an error: constraint failed");
+        REQUIRE(db.errorMessage() == "UNIQUE constraint failed: test.id");
+        // The connection takes the next query without a reset
+        REQUIRE(db.tryExec("INSERT INTO test(id, text) VALUES(2, 'test')"));
+    }
+    SECTION("trySetQuery(), with empty query -> code")
+    {
+        SqliteStatus r = db.trySetQuery("");
+        REQUIRE(r.code() == -1);
+        REQUIRE(r.message() == "Can not set sql on prepared query or the query is empty");
+    }
+    SECTION("tryPrepare(), with faulty query -> code")
+    {
+        REQUIRE(db.trySetQuery("CREATE TABLES test(id INTEGER, text TEXT)"));
+        SqliteStatus r = db.tryPrepare();
+        REQUIRE(r.code() == SQLITE_ERROR);
+        REQUIRE(db.errorMessage() == "near \"TABLES\": syntax error");
+    }
+    SECTION("tryStep(), rows as values")
+    {
+        REQUIRE(db.tryExec("INSERT INTO test(text) VALUES('test1')"));
+        REQUIRE(db.trySetQuery("SELECT text FROM test"));
+        REQUIRE(db.tryPrepare());
+        SqliteResult<bool> r = db.tryStep();
+        REQUIRE(r);
+        REQUIRE(r.value());
+        REQUIRE(db.getText(0) == "test1");
+        r = db.tryStep();
+        REQUIRE(r);
+        REQUIRE_FALSE(r.value());
+        REQUIRE(db.tryReset());
+    }
+    SECTION("step(), constraint violation -> exception and reusable connection")
+    {
+        REQUIRE_NOTHROW(db.exec("INSERT INTO test(id, text) VALUES(1, 'test')"));
+        REQUIRE_THROWS_WITH(db.exec("INSERT INTO test(id, text) VALUES(1, 'test')"),
+            "Sqlite had an error: UNIQUE constraint failed: test.id");
+        REQUIRE_NOTHROW(db.exec("INSERT INTO test(id, text) VALUES(2, 'test')"));
+    }
+}
+
+TEST_CASE("Sqlite3cpp: Memory configuration", "[Memory]")
+{
+    // Allocator changes need SQLite uninitialized, no connection is open here
+    sqlite3_shutdown();
+
+    SECTION("Pool allocator serves repeated allocations from its pools")
+    {
+        REQUIRE_NOTHROW(SqliteMemory::usePoolAllocator());
+        {
+            Sqlite db(":memory:", false);
+            db.exec("CREATE TABLE test(id INTEGER PRIMARY KEY, text TEXT)");
+            for(int i = 0; i < 200; ++i) {
+                db.exec("INSERT INTO test(text) VALUES('pooled')");
+            }
+            db.setQuery("SELECT count(*) FROM test");
+            db.prepare();
+            REQUIRE(db.step());
+            REQUIRE(db.getInt(0) == 200);
+            db.reset();
+        }
+        SqliteAllocatorStats stats = SqliteMemory::stats();
+        REQUIRE(stats.allocations > 0);
+        REQUIRE(stats.pool_hits > 0);
+        REQUIRE(stats.hitRate() > 0.5);
+        sqlite3_shutdown();
+        REQUIRE_NOTHROW(SqliteMemory::useDefaultAllocator());
+    }
+    SECTION("Configuring after initialization -> fail")
+    {
+        sqlite3_initialize();
+        REQUIRE_THROWS_AS(SqliteMemory::usePoolAllocator(), SqliteException);
+    }
+    SECTION("Page cache buffer")
+    {
+        REQUIRE_NOTHROW(SqliteMemory::usePageCache(4096, 16));
+        sqlite3_int64 used = 0;
+        {
+            Sqlite db(":memory:", false);
+            db.exec("CREATE TABLE test(id INTEGER PRIMARY KEY, text TEXT)");
+            used = SqliteMemory::stats().pagecache_used;
+        }
+        // The buffer is process wide, later tests run on the heap again
+        sqlite3_shutdown();
+        REQUIRE_NOTHROW(SqliteMemory::useDefaultPageCache());
+        REQUIRE(used > 0);
+        Sqlite db(":memory:", false);
+        db.exec("CREATE TABLE test(id INTEGER PRIMARY KEY, text TEXT)");
+        REQUIRE(SqliteMemory::stats().pagecache_used == 0);
+    }
+    SECTION("Lookaside statistics")
+    {
+        Sqlite db(":memory:", false);
+        // This is a no-op when SQLite is built with SQLITE_OMIT_LOOKASIDE
+        REQUIRE_NOTHROW(db.configureLookaside(128, 64));
+        db.exec("CREATE TABLE test(id INTEGER PRIMARY KEY, text TEXT)");
+        SqliteLookasideStats stats = db.lookasideStats();
+        REQUIRE(stats.used <= stats.peak);
+        if(!sqlite3_compileoption_used("OMIT_LOOKASIDE")) {
+            REQUIRE(stats.peak > 0);
+            REQUIRE(stats.hits > 0);
+        }
+    }
+}
+
+TEST_CASE("Sqlite3cpp: Memory governor", "[Memory]")
+{
+    sqlite3_int64 soft = sqlite3_soft_heap_limit64(-1);
+
+    SECTION("Limits are set and restored")
+    {
+        {
+            SqliteMemoryGovernor governor(8 * 1024 * 1024, 64 * 1024 * 1024);
+            REQUIRE(sqlite3_soft_heap_limit64(-1) == 8 * 1024 * 1024);
+            REQUIRE(sqlite3_hard_heap_limit64(-1) == 64 * 1024 * 1024);
+        }
+        REQUIRE(sqlite3_soft_heap_limit64(-1) == soft);
+    }
+    SECTION("Idle connections release memory under pressure")
+    {
+        Sqlite db(":memory:", false);
+        db.exec("CREATE TABLE test(id INTEGER PRIMARY KEY, text TEXT)");
+        db.exec("WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x+1 FROM c WHERE x < 2000) "
+            "INSERT INTO test(text) SELECT hex(randomblob(64)) FROM c");
+        REQUIRE(db.isIdle());
+
+        // A soft limit of one byte keeps the governor under pressure
+        SqliteMemoryGovernor governor(1, 0);
+        governor.track(&db);
+        REQUIRE(governor.underPressure());
+        sqlite3_int64 freed = governor.relieve();
+        REQUIRE(freed >= 0);
+        REQUIRE(governor.reclaimedBytes() == freed);
+        REQUIRE(governor.reliefCount() == 1);
+        governor.untrack(&db);
+    }
+    SECTION("Busy connections are skipped")
+    {
+        Sqlite db(":memory:", false);
+        db.setQuery("SELECT 1 UNION ALL SELECT 2");
+        db.prepare();
+        db.step();
+        REQUIRE_FALSE(db.isIdle());
+        db.reset();
+        REQUIRE(db.isIdle());
+    }
+    SECTION("No pressure below the limits")
+    {
+        SqliteMemoryGovernor governor(sqlite3_int64(1) << 40, 0);
+        REQUIRE_FALSE(governor.underPressure());
+        REQUIRE(governor.relieve() == 0);
+        REQUIRE(governor.reliefCount() == 0);
+    }
+    SECTION("Cgroup usage and PSI signals")
+    {
+        // The interface files of a cgroup, here in the working directory
+        std::string dir = ".";
+        std::ofstream(dir + "/memory.current") << "900\n";
+        std::ofstream(dir + "/memory.max") << "1000\n";
+        std::ofstream(dir + "/memory.pressure") << "some avg10=12.50 avg60=3.00 avg300=1.00 total=100\n"
+            << "full avg10=1.00 avg60=0.00 avg300=0.00 total=10\n";
+
+        SqliteMemoryGovernor governor(sqlite3_int64(1) << 40, 0);
+        governor.useCgroup(dir, 0.95, -1);
+        REQUIRE_FALSE(governor.underPressure());
+        governor.useCgroup(dir, 0.85, -1);
+        REQUIRE(governor.underPressure());
+        governor.useCgroup(dir, -1, 10.0);
+        REQUIRE(governor.underPressure());
+        governor.useCgroup(dir, -1, 20.0);
+        REQUIRE_FALSE(governor.underPressure());
+
+        std::ofstream(dir + "/memory.max") << "max\n";
+        governor.useCgroup(dir, 0.5, -1);
+        REQUIRE_FALSE(governor.underPressure());
+        std::remove("memory.current");
+        std::remove("memory.max");
+        std::remove("memory.pressure");
+    }
+}
+
+TEST_CASE("Sqlite3cpp: Read and Write BLOB to sqlite3", "[BLOB]")
+{
+    Sqlite db(":memory:", false);
+    db.exec("CREATE TABLE test(id INTEGER PRIMARY KEY, data BLOB)");
+    std::string payload;
+    for(int i = 0; i < 1000; ++i) payload += static_cast<char>(i % 251);
+
+    SECTION("INSERT blob by using bind_blob()")
+    {
+        REQUIRE_NOTHROW(db.setQuery("INSERT INTO test(data) VALUES(?)"));
+        REQUIRE_NOTHROW(db.prepare());
+        REQUIRE_NOTHROW(db.bind_blob(1, payload.data(), payload.size()));
+        REQUIRE_NOTHROW(db.step());
+        REQUIRE_NOTHROW(db.reset());
+        db.setQuery("SELECT data FROM test");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getBlob(0) == payload);
+    }
+    SECTION("Write and read blob in chunks by using openBlob()")
+    {
+        db.setQuery("INSERT INTO test(data) VALUES(?)");
+        db.prepare();
+        REQUIRE_NOTHROW(db.bind_zeroblob(1, payload.size()));
+        db.step();
+        db.reset();
+        int64_t id = db.lastInsertId();
+
+        std::unique_ptr<BlobStream> out = db.openBlob("test", "data", id, true, 64);
+        REQUIRE(out->size() == 1000);
+        REQUIRE(out->write(payload.data(), payload.size()));
+        out->close();
+
+        std::unique_ptr<BlobStream> in = db.openBlob("test", "data", id, false, 64);
+        std::string read(payload.size(), '\0');
+        REQUIRE(in->read(&read[0], read.size()));
+        REQUIRE(read == payload);
+        REQUIRE(in->get() == std::char_traits<char>::eof());
+    }
+    SECTION("Seek inside a blob")
+    {
+        db.exec("INSERT INTO test(data) VALUES(x'00010203040506070809')");
+        std::unique_ptr<BlobStream> blob = db.openBlob("test", "data", 1, true, 4);
+        blob->seekg(6);
+        REQUIRE(blob->get() == 6);
+        blob->seekp(2);
+        blob->put('\x7f');
+        blob->flush();
+        blob->seekg(2);
+        REQUIRE(blob->get() == 0x7f);
+        REQUIRE(blob->get() == 3);
+    }
+    SECTION("Writing past the end of the blob -> fail")
+    {
+        db.exec("INSERT INTO test(data) VALUES(zeroblob(4))");
+        std::unique_ptr<BlobStream> blob = db.openBlob("test", "data", 1, true, 16);
+        blob->write("12345", 5);
+        blob->flush();
+        REQUIRE_FALSE(blob->good());
+    }
+    SECTION("Reopen the blob handle on the next row")
+    {
+        db.exec("INSERT INTO test(data) VALUES(x'0102')");
+        db.exec("INSERT INTO test(data) VALUES(x'030405')");
+        std::unique_ptr<BlobStream> blob = db.openBlob("test", "data", 1);
+        REQUIRE(blob->get() == 1);
+        REQUIRE_NOTHROW(blob->reopen(2));
+        REQUIRE(blob->size() == 3);
+        REQUIRE(blob->get() == 3);
+        REQUIRE_THROWS_AS(blob->reopen(3), SqliteException);
+    }
+    SECTION("Open blob of missing row -> fail")
+    {
+        REQUIRE_THROWS_AS(db.openBlob("test", "data", 42), SqliteException);
+    }
+}
+
+TEST_CASE("Sqlite3cpp: Online backup", "[Backup]")
+{
+    Sqlite source(":memory:", false);
+    source.exec("CREATE TABLE test(id INTEGER PRIMARY KEY, text TEXT)");
+    source.exec("WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x+1 FROM c WHERE x < 2000) "
+        "INSERT INTO test(text) SELECT hex(randomblob(100)) FROM c");
+    Sqlite destination(":memory:", false);
+
+    SECTION("Backup on the calling thread in paced steps")
+    {
+        SqliteBackup backup(source, destination, 10, std::chrono::milliseconds(0));
+        int steps = 0;
+        backup.setProgressCallback([&steps](BackupProgress const&) { steps++; });
+        backup.run();
+        REQUIRE_NOTHROW(backup.wait());
+        REQUIRE(backup.isDone());
+        REQUIRE(backup.isFinished());
+        REQUIRE_FALSE(backup.hasFailed());
+        REQUIRE(steps > 1);
+        BackupProgress p = backup.progress();
+        REQUIRE(p.done);
+        REQUIRE(p.remaining == 0);
+        REQUIRE(p.pagecount > 10);
+        REQUIRE(p.restarts == 0);
+
+        destination.setQuery("SELECT count(*) FROM test");
+        destination.prepare();
+        REQUIRE(destination.step());
+        REQUIRE(destination.getInt(0) == 2000);
+    }
+    SECTION("Backup on a background thread")
+    {
+        SqliteBackup backup(source, destination, 5, std::chrono::milliseconds(1));
+        backup.start();
+        REQUIRE_THROWS_AS(backup.start(), SqliteException);
+        REQUIRE_NOTHROW(backup.wait());
+        REQUIRE(backup.isDone());
+        REQUIRE(backup.progress().done);
+        destination.setQuery("SELECT count(*) FROM test");
+        destination.prepare();
+        REQUIRE(destination.step());
+        REQUIRE(destination.getInt(0) == 2000);
+    }
+    SECTION("Cancelled backup -> fail")
+    {
+        SqliteBackup backup(source, destination, 1, std::chrono::milliseconds(0));
+        backup.setProgressCallback([&backup](BackupProgress const&) { backup.cancel(); });
+        backup.run();
+        REQUIRE_THROWS_WITH(backup.wait(), "Backup failed: Backup cancelled");
+        REQUIRE_FALSE(backup.progress().done);
+        REQUIRE_FALSE(backup.isDone());
+        REQUIRE(backup.isFinished());
+        REQUIRE(backup.hasFailed());
+
+        // The cancel does not stick to the next run
+        backup.setProgressCallback(nullptr);
+        backup.run();
+        REQUIRE_NOTHROW(backup.wait());
+        REQUIRE(backup.isDone());
+    }
+}
+TEST_CASE("Sqlite3cpp: Online backup gives up on a locked source", "[Backup]")
+{
+    const char* file = "sqlite3cpp_backup_busy_test.db";
+    std::remove(file);
+    {
+        Sqlite source(file, false);
+        source.exec("CREATE TABLE test(id INTEGER PRIMARY KEY, text TEXT)");
+        source.exec("INSERT INTO test(text) VALUES('row')");
+        Sqlite locker(file, false);
+        locker.exec("BEGIN EXCLUSIVE");
+        Sqlite destination(":memory:", false);
+
+        SqliteBackup backup(source, destination, 10, std::chrono::milliseconds(0));
+        backup.setBusyTimeout(std::chrono::milliseconds(50));
+        int steps = 0;
+        backup.setProgressCallback([&steps](BackupProgress const&) { steps++; });
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        backup.run();
+        REQUIRE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(50));
+        REQUIRE(backup.hasFailed());
+        // Backed off between the attempts instead of spinning
+        REQUIRE(steps < 100);
+        int code = SQLITE_OK;
+        try {
+            backup.wait();
+        } catch(SqliteException& e) {
+            code = e.getNumber();
+        }
+        REQUIRE(code == SQLITE_BUSY);
+        locker.exec("COMMIT");
+    }
+    std::remove(file);
+}
+
+TEST_CASE("Sqlite3cpp: Online backup restarts on source change", "[Backup]")
+{
+    const char* file = "sqlite3cpp_backup_test.db";
+    std::remove(file);
+    {
+        Sqlite source(file, false);
+        source.exec("CREATE TABLE test(id INTEGER PRIMARY KEY, text TEXT)");
+        source.exec("WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x+1 FROM c WHERE x < 2000) "
+            "INSERT INTO test(text) SELECT hex(randomblob(100)) FROM c");
+        Sqlite writer(file, false);
+        Sqlite destination(":memory:", false);
+
+        SqliteBackup backup(source, destination, 10, std::chrono::milliseconds(0));
+        bool written = false;
+        backup.setProgressCallback([&](BackupProgress const&) {
+            if(written) return;
+            writer.exec("INSERT INTO test(text) VALUES('late')");
+            written = true;
+        });
+        backup.run();
+        REQUIRE_NOTHROW(backup.wait());
+        REQUIRE(backup.progress().restarts >= 1);
+
+        destination.setQuery("SELECT count(*) FROM test");
+        destination.prepare();
+        REQUIRE(destination.step());
+        REQUIRE(destination.getInt(0) == 2001);
+    }
+    std::remove(file);
+}
+
+TEST_CASE("Sqlite3cpp: Serialize and deserialize database images", "[Serialize]")
+{
+    Sqlite db(":memory:", false);
+    db.exec("CREATE TABLE test(id INTEGER PRIMARY KEY, text TEXT)");
+    db.exec("INSERT INTO test(text) VALUES('test1')");
+    db.exec("INSERT INTO test(text) VALUES('test2')");
+    const char* file = "sqlite3cpp_image_test.db";
+
+    SECTION("serialize() and deserialize() in memory")
+    {
+        std::string image = db.serialize();
+        REQUIRE(image.compare(0, 16, std::string("SQLite format 3\0", 16)) == 0);
+
+        Sqlite copy(":memory:", false);
+        REQUIRE_NOTHROW(copy.deserialize(image.data(), image.size()));
+        copy.setQuery("SELECT text FROM test WHERE id = 2");
+        copy.prepare();
+        REQUIRE(copy.step());
+        REQUIRE(copy.getText(0) == "test2");
+        copy.reset();
+        REQUIRE_NOTHROW(copy.exec("INSERT INTO test(text) VALUES('test3')"));
+    }
+    SECTION("Read-only image -> fail on write")
+    {
+        std::string image = db.serialize();
+        Sqlite copy(":memory:", false);
+        copy.deserialize(image.data(), image.size(), true);
+        REQUIRE_THROWS_AS(copy.exec("INSERT INTO test(text) VALUES('test3')"), SqliteException);
+    }
+    SECTION("serializeToFile() and deserializeFile()")
+    {
+        REQUIRE_NOTHROW(db.serializeToFile(file));
+        Sqlite copy(":memory:", false);
+        REQUIRE_NOTHROW(copy.deserializeFile(file));
+        copy.setQuery("SELECT count(*) FROM test");
+        copy.prepare();
+        REQUIRE(copy.step());
+        REQUIRE(copy.getInt(0) == 2);
+        copy.reset();
+        REQUIRE_NOTHROW(copy.exec("INSERT INTO test(text) VALUES('test3')"));
+        std::remove(file);
+    }
+    SECTION("deserializeFile() with mmap is read-only")
+    {
+        REQUIRE_NOTHROW(db.serializeToFile(file));
+        Sqlite copy(":memory:", false);
+        REQUIRE_NOTHROW(copy.deserializeFile(file, true));
+        copy.setQuery("SELECT text FROM test WHERE id = 1");
+        copy.prepare();
+        REQUIRE(copy.step());
+        REQUIRE(copy.getText(0) == "test1");
+        copy.reset();
+        REQUIRE_THROWS_AS(copy.exec("INSERT INTO test(text) VALUES('test3')"), SqliteException);
+        std::remove(file);
+    }
+    SECTION("deserializeFile() with missing file -> fail")
+    {
+        REQUIRE_THROWS_AS(db.deserializeFile("sqlite3cpp_missing.db"), SqliteException);
+        REQUIRE_THROWS_AS(db.deserializeFile("sqlite3cpp_missing.db", true), SqliteException);
+    }
+}
+
+TEST_CASE("Sqlite3cpp: Parallel CSV import", "[CSV]")
+{
+    Sqlite db(":memory:", false);
+    const char* file = "sqlite3cpp_import_test.csv";
+    CsvImportOptions options;
+    options.threads = 4;
+    options.chunk_size = 64;  // Many small chunks to exercise the pipeline
+    options.batch_rows = 7;
+
+    SECTION("Import creates the table from the header and keeps row order")
+    {
+        {
+            std::ofstream out(file);
+            out << "id,name,score\n";
+            for(int i = 1; i <= 500; ++i) out << i << ",name" << i << "," << i * 0.5 << "\n";
+        }
+        CsvImporter importer(db, "people", options);
+        REQUIRE(importer.importFile(file) == 500);
+        db.setQuery("SELECT count(*), sum(id), min(rowid) FROM people");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) == 500);
+        REQUIRE(db.getInt(1) == 125250);
+        db.reset();
+        db.setQuery("SELECT id, name, score, typeof(id), typeof(score) FROM people WHERE rowid = 251");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) == 251);
+        REQUIRE(db.getText(1) == "name251");
+        REQUIRE(db.getDouble(2) == 125.5);
+        REQUIRE(db.getText(3) == "integer");
+        REQUIRE(db.getText(4) == "real");
+        std::remove(file);
+    }
+    SECTION("Quoted fields, empty fields and CRLF line ends")
+    {
+        std::string csv = "a,b,c\r\n\"x, \"\"quoted\"\"\",,12\r\n\"\",text,-3.5\r\n";
+        CsvImporter importer(db, "quotes", options);
+        REQUIRE(importer.importBuffer(csv.data(), csv.size()) == 2);
+        db.setQuery("SELECT a, typeof(b), c FROM quotes ORDER BY rowid");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getText(0) == "x, \"quoted\"");
+        REQUIRE(db.getText(1) == "null");
+        REQUIRE(db.getInt(2) == 12);
+        REQUIRE(db.step());
+        REQUIRE(db.getText(0) == "");
+        REQUIRE(db.getDouble(2) == -3.5);
+    }
+    SECTION("Import without header into a table with a deferred index")
+    {
+        db.exec("CREATE TABLE test(id INTEGER PRIMARY KEY, text TEXT)");
+        db.exec("CREATE INDEX test_text ON test(text)");
+        std::string csv;
+        for(int i = 1; i <= 100; ++i) csv += std::to_string(i) + ",row" + std::to_string(i) + "\n";
+        options.header = false;
+        CsvImporter importer(db, "test", options);
+        REQUIRE(importer.importBuffer(csv.data(), csv.size()) == 100);
+        db.setQuery("SELECT count(*) FROM sqlite_master WHERE type = 'index' AND name = 'test_text'");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) == 1);
+        db.reset();
+        db.setQuery("PRAGMA synchronous");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) == 2);
+    }
+    SECTION("Wrong field count -> fail and roll back")
+    {
+        db.exec("CREATE TABLE test(a, b)");
+        std::string csv = "a,b\n1,2\n3,4\n5\n";
+        CsvImporter importer(db, "test", options);
+        REQUIRE_THROWS_WITH(importer.importBuffer(csv.data(), csv.size()),
+            "CSV import failed: CSV line has 1 fields, expected 2");
+        db.setQuery("SELECT count(*) FROM test");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) == 0);
+    }
+    SECTION("One character lines and a last line without newline")
+    {
+        std::string csv = "v\n1\n\n2";
+        CsvImporter importer(db, "single", options);
+        REQUIRE(importer.importBuffer(csv.data(), csv.size()) == 2);
+    }
+    SECTION("Leading zeros stay text, 64-bit integers stay exact")
+    {
+        std::string csv = "v\n01234\n0\n-0.5\n-007\n9223372036854775807\n-9223372036854775808\n"
+            "9223372036854775808\n";
+        CsvImporter importer(db, "numbers", options);
+        REQUIRE(importer.importBuffer(csv.data(), csv.size()) == 7);
+        db.setQuery("SELECT v, typeof(v) FROM numbers ORDER BY rowid");
+        db.prepare();
+        const char* expected[][2] = { { "01234", "text" }, { "0", "integer" }, { "-0.5", "real" },
+            { "-007", "text" }, { "9223372036854775807", "integer" }, { "-9223372036854775808", "integer" },
+            { "9.22337203685478e+18", "real" } };
+        for(int i = 0; i < 7; ++i) {
+            REQUIRE(db.step());
+            REQUIRE(db.getText(0) == expected[i][0]);
+            REQUIRE(db.getText(1) == expected[i][1]);
+        }
+        db.reset();
+    }
+    SECTION("Only plain decimal numbers become real")
+    {
+        std::string csv = "v\n0x1A\n+inf\n-inf\nnan\n1e999\n.5\n1.\n1.5e3\n-2.5E-2\n";
+        CsvImporter importer(db, "reals", options);
+        REQUIRE(importer.importBuffer(csv.data(), csv.size()) == 9);
+        db.setQuery("SELECT v, typeof(v) FROM reals ORDER BY rowid");
+        db.prepare();
+        const char* expected[][2] = { { "0x1A", "text" }, { "+inf", "text" }, { "-inf", "text" },
+            { "nan", "text" }, { "1e999", "text" }, { ".5", "text" }, { "1.", "text" },
+            { "1500.0", "real" }, { "-0.025", "real" } };
+        for(int i = 0; i < 9; ++i) {
+            REQUIRE(db.step());
+            REQUIRE(db.getText(0) == expected[i][0]);
+            REQUIRE(db.getText(1) == expected[i][1]);
+        }
+        db.reset();
+    }
+    SECTION("Unique indexes are not deferred")
+    {
+        db.exec("CREATE TABLE test(a, b)");
+        db.exec("CREATE UNIQUE INDEX test_a ON test(a)");
+        std::string csv = "1,x\n2,y\n1,z\n";
+        options.header = false;
+        CsvImporter importer(db, "test", options);
+        REQUIRE_THROWS_AS(importer.importBuffer(csv.data(), csv.size()), SqliteException);
+        db.setQuery("SELECT (SELECT count(*) FROM test), (SELECT count(*) FROM sqlite_master WHERE name = 'test_a')");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) == 0);
+        REQUIRE(db.getInt(1) == 1);
+        db.reset();
+    }
+    SECTION("Failed index rebuild -> fail and restore the pragmas")
+    {
+        // abs() of the smallest integer is an error, found only when the index is built
+        db.exec("CREATE TABLE test(a)");
+        db.exec("CREATE INDEX test_abs ON test(abs(a))");
+        std::string csv = "a\n-9223372036854775808\n";
+        CsvImporter importer(db, "test", options);
+        REQUIRE_THROWS_AS(importer.importBuffer(csv.data(), csv.size()), SqliteException);
+        db.setQuery("PRAGMA synchronous");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) == 2);
+        db.reset();
+        db.setQuery("PRAGMA cache_size");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) != -262144);
+        db.reset();
+    }
+}
+
+TEST_CASE("Sqlite3cpp: Streaming result export", "[Export]")
+{
+    Sqlite db(":memory:", false);
+    db.exec("CREATE TABLE test(id INTEGER PRIMARY KEY, text TEXT, real REAL, data BLOB)");
+    db.exec("INSERT INTO test VALUES(1, 'plain', 2.5, x'00ff')");
+    db.exec("INSERT INTO test VALUES(2, 'with, \"quotes\"\nand newline', 3.0, NULL)");
+    db.exec("INSERT INTO test VALUES(-3, NULL, 0.1, NULL)");
+    const char* query = "SELECT id, text, real, data FROM test ORDER BY abs(id)";
+
+    SECTION("CSV")
+    {
+        std::ostringstream out;
+        ResultExporter exporter(db, ExportFormat::Csv);
+        REQUIRE(exporter.exportQuery(query, out) == 3);
+        REQUIRE(out.str() == "id,text,real,data\n"
+            "1,plain,2.5,00ff\n"
+            "2,\"with, \"\"quotes\"\"\nand newline\",3.0,\n"
+            "-3,,0.1,\n");
+    }
+    SECTION("JSON Lines")
+    {
+        std::ostringstream out;
+        ResultExporter exporter(db, ExportFormat::JsonLines);
+        REQUIRE(exporter.exportQuery(query, out) == 3);
+        REQUIRE(out.str() ==
+            "{\"id\":1,\"text\":\"plain\",\"real\":2.5,\"data\":\"00ff\"}\n"
+            "{\"id\":2,\"text\":\"with, \\\"quotes\\\"\\nand newline\",\"real\":3.0,\"data\":null}\n"
+            "{\"id\":-3,\"text\":null,\"real\":0.1,\"data\":null}\n");
+    }
+    SECTION("Binary")
+    {
+        std::ostringstream out;
+        ResultExporter exporter(db, ExportFormat::Binary);
+        REQUIRE(exporter.exportQuery("SELECT id, text FROM test WHERE id = 1", out) == 1);
+        std::string expected("SQ3B\x02\0\0\0\x02\0\0\0id\x04\0\0\0text", 22);
+        expected += std::string("\x01\x01\x01\0\0\0\0\0\0\0\x03\x05\0\0\0plain\0", 21);
+        REQUIRE(out.str() == expected);
+    }
+    SECTION("Rows larger than the buffer go straight to the file")
+    {
+        const char* file = "sqlite3cpp_export_test.csv";
+        db.exec("INSERT INTO test VALUES(4, hex(zeroblob(500)), NULL, NULL)");
+        ExportOptions options;
+        options.buffer_size = 16;
+        options.header = false;
+        ResultExporter exporter(db, ExportFormat::Csv, options);
+        REQUIRE(exporter.exportToFile("SELECT text FROM test WHERE id = 4", file) == 1);
+        std::ifstream in(file);
+        std::string line;
+        std::getline(in, line);
+        REQUIRE(line == std::string(1000, '0'));
+        std::remove(file);
+    }
+    SECTION("Faulty query -> fail")
+    {
+        std::ostringstream out;
+        ResultExporter exporter(db, ExportFormat::Csv);
+        REQUIRE_THROWS_AS(exporter.exportQuery("SELECT nothing FROM test", out), SqliteException);
+    }
+}
+
+#ifdef SQLITE3CPP_POSIX
+TEST_CASE("Sqlite3cpp: Read-only mmap VFS", "[VFS]")
+{
+    const char* file = "sqlite3cpp_mmap_test.db";
+    std::remove(file);
+    {
+        Sqlite db(file, false);
+        db.exec("CREATE TABLE test(id INTEGER PRIMARY KEY, text TEXT)");
+        db.exec("BEGIN");
+        for(int i = 1; i <= 1000; ++i) {
+            db.exec("INSERT INTO test(text) VALUES('row " + std::to_string(i) + "')");
+        }
+        db.exec("COMMIT");
+    }
+
+    SECTION("uri() escapes the path and selects the VFS")
+    {
+        REQUIRE(SqliteMmapVfs::uri("a?b#c%.db") == "file:a%3Fb%23c%25.db?immutable=1&vfs=sqlite3cpp-mmap");
+    }
+    SECTION("open() reads through the mapping")
+    {
+        sqlite_ptr db = SqliteMmapVfs::open(file);
+        sqlite3_vfs* vfs = NULL;
+        sqlite3_file_control(db->getHandle(), "main", SQLITE_FCNTL_VFS_POINTER, &vfs);
+        REQUIRE(vfs != NULL);
+        REQUIRE(std::string(vfs->zName) == SqliteMmapVfs::name());
+
+        db->setQuery("SELECT count(*), max(id) FROM test");
+        db->prepare();
+        REQUIRE(db->step());
+        REQUIRE(db->getInt(0) == 1000);
+        REQUIRE(db->getInt(1) == 1000);
+        db->reset();
+        db->setQuery("SELECT text FROM test WHERE id = 777");
+        db->prepare();
+        REQUIRE(db->step());
+        REQUIRE(db->getText(0) == "row 777");
+        db->reset();
+    }
+    SECTION("Several connections share the file")
+    {
+        sqlite_ptr first = SqliteMmapVfs::open(file);
+        sqlite_ptr second = SqliteMmapVfs::open(file);
+        first->setQuery("SELECT text FROM test WHERE id = 1");
+        first->prepare();
+        second->setQuery("SELECT text FROM test WHERE id = 1000");
+        second->prepare();
+        REQUIRE(first->step());
+        REQUIRE(second->step());
+        REQUIRE(first->getText(0) == "row 1");
+        REQUIRE(second->getText(0) == "row 1000");
+        first->reset();
+        second->reset();
+    }
+    SECTION("Write -> fail")
+    {
+        sqlite_ptr db = SqliteMmapVfs::open(file);
+        REQUIRE_THROWS_AS(db->exec("INSERT INTO test(text) VALUES('new')"), SqliteException);
+    }
+    SECTION("Missing file -> fail")
+    {
+        REQUIRE_THROWS_AS(SqliteMmapVfs::open("sqlite3cpp_missing.db"), SqliteException);
+    }
+    std::remove(file);
+}
+#endif
+
+#ifdef SQLITE3CPP_IO_URING
+TEST_CASE("Sqlite3cpp: io_uring VFS", "[VFS]")
+{
+    const char* file = "sqlite3cpp_uring_test.db";
+    std::remove(file);
+    std::remove("sqlite3cpp_uring_test.db-wal");
+    std::remove("sqlite3cpp_uring_test.db-shm");
+    REQUIRE_NOTHROW(SqliteUringVfs::install());
+    const int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+    std::string mode = GENERATE(std::string("DELETE"), std::string("WAL"));
+    INFO("journal_mode " << mode << ", io_uring active " << SqliteUringVfs::active());
+
+    {
+        Sqlite db(file, false, flags, SqliteUringVfs::name());
+        db.exec("PRAGMA journal_mode=" + mode);
+        db.exec("PRAGMA synchronous=FULL");
+        db.exec("CREATE TABLE test(id INTEGER PRIMARY KEY, text TEXT)");
+        for(int i = 1; i <= 50; ++i) {
+            db.exec("INSERT INTO test(text) VALUES('" + std::string(i * 20, 'a' + i % 26) + "')");
+        }
+        db.exec("BEGIN");
+        for(int i = 51; i <= 2000; ++i) {
+            db.exec("INSERT INTO test(text) VALUES('" + std::string(100, 'a' + i % 26) + "')");
+        }
+        db.exec("COMMIT");
+
+        // A second connection sees every commit
+        Sqlite other(file, false, flags, SqliteUringVfs::name());
+        other.setQuery("SELECT count(*), sum(length(text)) FROM test");
+        other.prepare();
+        REQUIRE(other.step());
+        REQUIRE(other.getInt(0) == 2000);
+        REQUIRE(other.getInt(1) == 25500 + 1950 * 100);
+        other.reset();
+
+        db.exec("UPDATE test SET text = 'changed' WHERE id % 3 = 0");
+        REQUIRE(other.step());
+        REQUIRE(other.getInt(0) == 2000);
+        REQUIRE(other.getInt(1) != 25500 + 1950 * 100);
+        other.reset();
+
+        db.exec("BEGIN");
+        db.exec("DELETE FROM test WHERE id > 1000");
+        db.exec("ROLLBACK");
+    }
+    {
+        // Reopened through the stock VFS the file is intact
+        Sqlite db(file, false);
+        db.setQuery("PRAGMA integrity_check");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getText(0) == "ok");
+        db.reset();
+        db.setQuery("SELECT count(*), text FROM test WHERE id = 3");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getText(1) == "changed");
+        db.reset();
+        db.exec("PRAGMA journal_mode=DELETE");
+    }
+    std::remove(file);
+}
+
+TEST_CASE("Sqlite3cpp: io_uring VFS write errors", "[VFS]")
+{
+    // Writes past RLIMIT_FSIZE fail with EFBIG, the commit has to fail with them
+    const char* file = "sqlite3cpp_uring_error.db";
+    const char* other_file = "sqlite3cpp_uring_other.db";
+    std::remove(file);
+    std::remove(other_file);
+    REQUIRE_NOTHROW(SqliteUringVfs::install());
+    const int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+    std::string mode = GENERATE(std::string("DELETE"), std::string("WAL"));
+    INFO("journal_mode " << mode);
+
+    {
+        Sqlite db(file, false, flags, SqliteUringVfs::name());
+        db.exec("PRAGMA journal_mode=" + mode);
+        db.exec("PRAGMA synchronous=FULL");
+        db.exec("CREATE TABLE test(id INTEGER PRIMARY KEY, text TEXT)");
+        for(int i = 0; i < 10; ++i) db.exec("INSERT INTO test(text) VALUES('row')");
+        Sqlite other(other_file, false, flags, SqliteUringVfs::name());
+        other.exec("CREATE TABLE test(id INTEGER PRIMARY KEY)");
+
+        struct rlimit saved;
+        REQUIRE(getrlimit(RLIMIT_FSIZE, &saved) == 0);
+        void (*handler)(int) = std::signal(SIGXFSZ, SIG_IGN);
+        struct rlimit limited = saved;
+        limited.rlim_cur = 64 * 1024;
+        REQUIRE(setrlimit(RLIMIT_FSIZE, &limited) == 0);
+        bool failed = false;
+        try {
+            db.exec("WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM n WHERE i < 500) "
+                "INSERT INTO test(text) SELECT hex(randomblob(500)) FROM n");
+        } catch(SqliteException const&) {
+            failed = true;
+        }
+        // The failure belongs to the first file, the other one is unaffected
+        bool other_failed = false;
+        try {
+            other.exec("INSERT INTO test DEFAULT VALUES");
+        } catch(SqliteException const&) {
+            other_failed = true;
+        }
+        setrlimit(RLIMIT_FSIZE, &saved);
+        std::signal(SIGXFSZ, handler);
+        REQUIRE(failed);
+        REQUIRE_FALSE(other_failed);
+
+        db.setQuery("SELECT count(*) FROM test");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) == 10);
+        db.reset();
+        db.exec("PRAGMA journal_mode=DELETE");
+    }
+    {
+        Sqlite db(file, false);
+        db.setQuery("PRAGMA integrity_check");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getText(0) == "ok");
+        db.reset();
+    }
+    std::remove(file);
+    std::remove(other_file);
+}
+
+namespace {
+// Closes the descriptors of every io_uring instance of the process
+int closeRings()
+{
+    int closed = 0;
+    DIR* dir = opendir("/proc/self/fd");
+    if(!dir) return 0;
+    std::vector<int> rings;
+    while(dirent* entry = readdir(dir)) {
+        char target[64] = {0};
+        std::string link = std::string("/proc/self/fd/") + entry->d_name;
+        if(readlink(link.c_str(), target, sizeof(target) - 1) > 0 && std::string(target) == "anon_inode:[io_uring]") {
+            rings.push_back(std::atoi(entry->d_name));
+        }
+    }
+    closedir(dir);
+    for(size_t i = 0; i < rings.size(); ++i) closed += close(rings[i]) == 0;
+    return closed;
+}
+}
+
+// Comes after the other io_uring tests, the ring stays broken for the rest
+// of the process
+TEST_CASE("Sqlite3cpp: io_uring VFS with a closed ring", "[VFS]")
+{
+    const char* file = "sqlite3cpp_uring_closed.db";
+    std::remove(file);
+    std::remove("sqlite3cpp_uring_closed.db-wal");
+    std::remove("sqlite3cpp_uring_closed.db-shm");
+    REQUIRE_NOTHROW(SqliteUringVfs::install());
+    const int flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
+    std::string mode = GENERATE(std::string("DELETE"), std::string("WAL"));
+    INFO("journal_mode " << mode);
+
+    {
+        Sqlite db(file, false, flags, SqliteUringVfs::name());
+        db.exec("PRAGMA journal_mode=" + mode);
+        db.exec("PRAGMA synchronous=FULL");
+        db.exec("CREATE TABLE IF NOT EXISTS test(id INTEGER PRIMARY KEY, text TEXT)");
+        db.exec("DELETE FROM test");
+        db.exec("INSERT INTO test(text) VALUES('before')");
+        if(SqliteUringVfs::active()) closeRings();
+
+        // Every write the kernel no longer takes is done with pwrite()
+        db.exec("BEGIN");
+        for(int i = 0; i < 2000; ++i) {
+            db.exec("INSERT INTO test(text) VALUES('" + std::string(100, 'a' + i % 26) + "')");
+        }
+        db.exec("COMMIT");
+        db.exec("UPDATE test SET text = 'after' WHERE id = 1");
+
+        {
+            Sqlite other(file, false, flags, SqliteUringVfs::name());
+            other.setQuery("SELECT count(*), max(text = 'after') FROM test");
+            other.prepare();
+            REQUIRE(other.step());
+            REQUIRE(other.getInt(0) == 2001);
+            REQUIRE(other.getInt(1) == 1);
+            other.reset();
+        }
+        db.exec("PRAGMA journal_mode=DELETE");
+    }
+    {
+        Sqlite db(file, false);
+        db.setQuery("PRAGMA integrity_check");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getText(0) == "ok");
+        db.reset();
+    }
+    std::remove(file);
+}
+#endif
+
+#ifdef SQLITE_ENABLE_SNAPSHOT
+TEST_CASE("Sqlite3cpp: WAL snapshots", "[Snapshot]")
+{
+    const char* file = "sqlite3cpp_snapshot_test.db";
+    std::remove(file);
+    Sqlite writer(file, false);
+    writer.exec("PRAGMA journal_mode=WAL");
+    writer.exec("CREATE TABLE test(id INTEGER PRIMARY KEY, text TEXT)");
+    writer.exec("INSERT INTO test(text) VALUES('test1')");
+    Sqlite first(file, false);
+    Sqlite second(file, false);
+
+    auto count = [](Sqlite& db) {
+        db.setQuery("SELECT count(*) FROM test");
+        db.prepare();
+        db.step();
+        int n = db.getInt(0);
+        db.reset();
+        return n;
+    };
+
+    SECTION("Readers of one snapshot see the same data")
+    {
+        SqliteSnapshot snapshot = first.beginSnapshot();
+        REQUIRE(snapshot);
+        writer.exec("INSERT INTO test(text) VALUES('test2')");
+        REQUIRE_NOTHROW(second.openSnapshot(snapshot));
+        REQUIRE(count(first) == 1);
+        REQUIRE(count(second) == 1);
+        writer.exec("INSERT INTO test(text) VALUES('test3')");
+        REQUIRE(count(second) == 1);
+        REQUIRE_NOTHROW(second.endSnapshot());
+        REQUIRE(count(second) == 3);
+        REQUIRE_NOTHROW(first.endSnapshot());
+
+        SqliteSnapshot later = first.beginSnapshot();
+        REQUIRE(snapshot.compare(later) < 0);
+        REQUIRE(later.compare(snapshot) > 0);
+        first.endSnapshot();
+    }
+    SECTION("Empty snapshot -> fail")
+    {
+        REQUIRE_THROWS_AS(second.openSnapshot(SqliteSnapshot()), SqliteException);
+    }
+    SECTION("Snapshot of a rollback journal database -> fail")
+    {
+        Sqlite db(":memory:", false);
+        REQUIRE_THROWS_AS(db.beginSnapshot(), SqliteException);
+        REQUIRE(sqlite3_get_autocommit(db.getHandle()));
+    }
+    std::remove(file);
+}
+#endif
+
+TEST_CASE("Sqlite3cpp: Changeset capture and replay", "[Session]")
+{
+    const char* schema = "CREATE TABLE test(id INTEGER PRIMARY KEY, text TEXT)";
+    Sqlite db(":memory:", false);
+    Sqlite replica(":memory:", false);
+    db.exec(schema);
+    replica.exec(schema);
+    db.exec("CREATE TABLE other(id INTEGER PRIMARY KEY, n INTEGER)");
+    replica.exec("CREATE TABLE other(id INTEGER PRIMARY KEY, n INTEGER)");
+    ChangeTracker tracker(db);
+    tracker.attach("test");
+
+    auto text = [](Sqlite& d, int id) {
+        d.setQuery("SELECT text FROM test WHERE id = " + std::to_string(id));
+        d.prepare();
+        std::string t = d.step() ? d.getText(0) : "<none>";
+        d.reset();
+        return t;
+    };
+
+    REQUIRE(tracker.isEmpty());
+    db.exec("INSERT INTO test VALUES(1, 'test1')");
+    db.exec("INSERT INTO test VALUES(2, 'test2')");
+    db.exec("INSERT INTO other VALUES(1, 1)");
+    REQUIRE_FALSE(tracker.isEmpty());
+
+    SECTION("Deltas keep a replica in sync")
+    {
+        REQUIRE(ChangeTracker::apply(replica, tracker.take()) == 0);
+        REQUIRE(text(replica, 2) == "test2");
+        REQUIRE(tracker.isEmpty());
+
+        db.exec("UPDATE test SET text = 'changed' WHERE id = 1");
+        db.exec("DELETE FROM test WHERE id = 2");
+        std::string patch = tracker.patchset();
+        std::string delta = tracker.take();
+        REQUIRE(patch.size() < delta.size());
+        REQUIRE(ChangeTracker::apply(replica, patch) == 0);
+        REQUIRE(text(replica, 1) == "changed");
+        REQUIRE(text(replica, 2) == "<none>");
+
+        // Untracked table stays untouched
+        replica.setQuery("SELECT count(*) FROM other");
+        replica.prepare();
+        replica.step();
+        REQUIRE(replica.getInt(0) == 0);
+        replica.reset();
+    }
+    SECTION("combine() and invert()")
+    {
+        std::string first = tracker.take();
+        db.exec("UPDATE test SET text = 'changed' WHERE id = 1");
+        std::string both = ChangeTracker::combine(first, tracker.take());
+        ChangeTracker::apply(replica, both);
+        REQUIRE(text(replica, 1) == "changed");
+        ChangeTracker::apply(replica, ChangeTracker::invert(both));
+        REQUIRE(text(replica, 1) == "<none>");
+    }
+    SECTION("Conflicts follow the policy")
+    {
+        replica.exec("INSERT INTO test VALUES(1, 'local')");
+        std::string changes = tracker.changeset();
+        REQUIRE_THROWS_AS(ChangeTracker::apply(replica, changes), SqliteException);
+        REQUIRE(text(replica, 2) == "<none>");
+
+        REQUIRE(ChangeTracker::apply(replica, changes, ChangeConflictAction::Omit) == 1);
+        REQUIRE(text(replica, 1) == "local");
+        REQUIRE(text(replica, 2) == "test2");
+
+        replica.exec("DELETE FROM test WHERE id = 2");
+        REQUIRE(ChangeTracker::apply(replica, changes, ChangeConflictAction::Replace) == 1);
+        REQUIRE(text(replica, 1) == "test1");
+    }
+    SECTION("Conflict handler")
+    {
+        replica.exec("INSERT INTO test VALUES(2, 'local')");
+        std::vector<ChangeConflict> seen;
+        ChangeTracker::apply(replica, tracker.changeset(), ChangeConflictAction::Abort,
+            [&seen](ChangeConflict const& c) {
+                seen.push_back(c);
+                return ChangeConflictAction::Replace;
+            });
+        REQUIRE(seen.size() == 1);
+        REQUIRE(seen[0].type == ChangeConflictType::Conflict);
+        REQUIRE(seen[0].table == "test");
+        REQUIRE(seen[0].operation == SQLITE_INSERT);
+        REQUIRE(text(replica, 2) == "test2");
+    }
+    SECTION("An exception from the conflict handler aborts and is rethrown")
+    {
+        replica.exec("INSERT INTO test VALUES(2, 'local')");
+        REQUIRE_THROWS_WITH(ChangeTracker::apply(replica, tracker.changeset(), ChangeConflictAction::Omit,
+            [](ChangeConflict const&) -> ChangeConflictAction {
+                throw std::runtime_error("handler failed");
+            }), "handler failed");
+        REQUIRE(text(replica, 1) == "<none>");
+        REQUIRE(text(replica, 2) == "local");
+    }
+    SECTION("setEnabled(false) pauses recording")
+    {
+        tracker.take();
+        tracker.setEnabled(false);
+        db.exec("INSERT INTO test VALUES(3, 'test3')");
+        REQUIRE(tracker.isEmpty());
+        tracker.setEnabled(true);
+        db.exec("INSERT INTO test VALUES(4, 'test4')");
+        REQUIRE_FALSE(tracker.isEmpty());
+
+        // take() keeps a paused tracker paused
+        tracker.setEnabled(false);
+        tracker.take();
+        db.exec("INSERT INTO test VALUES(5, 'test5')");
+        REQUIRE(tracker.isEmpty());
+    }
+}
+
+namespace {
+int64_t triple(int64_t n) { return 3 * n; }
+}
+
+TEST_CASE("Sqlite3cpp: Scalar functions", "[Function]")
+{
+    Sqlite db(":memory:", false);
+    db.exec("CREATE TABLE test(id INTEGER PRIMARY KEY, text TEXT, score REAL)");
+    db.exec("INSERT INTO test VALUES(1, 'alpha', 1.5)");
+    db.exec("INSERT INTO test VALUES(2, 'beta', 2.5)");
+
+    auto single = [&db](std::string const& sql) {
+        db.setQuery(sql);
+        db.prepare();
+        REQUIRE(db.step());
+    };
+
+    SECTION("Argument and result types come from the signature")
+    {
+        db.create_function("add2", [](int a, int b) { return a + b; }, SQLITE_DETERMINISTIC);
+        db.create_function("shout", [](std::string const& s) { return s + "!"; });
+        db.create_function("scale", [](double d, float f) { return d * f; });
+        db.create_function("triple", &triple);
+        db.create_function("positive", [](int64_t n) { return n > 0; });
+        db.create_function("size", [](std::vector<char> const& b) { return static_cast<int>(b.size()); });
+        db.create_function("same", [](sqlite3_value* v) { return v; });
+
+        single("SELECT add2(id, 40), shout(text), scale(score, 2), triple(id), positive(-id), size(zeroblob(7)), same(text) FROM test WHERE id = 2");
+        REQUIRE(db.getInt(0) == 42);
+        REQUIRE(db.getText(1) == "beta!");
+        REQUIRE(db.getDouble(2) == 5.0);
+        REQUIRE(db.getInt(3) == 6);
+        REQUIRE(db.getInt(4) == 0);
+        REQUIRE(db.getInt(5) == 7);
+        REQUIRE(db.getText(6) == "beta");
+        db.reset();
+    }
+    SECTION("Deterministic functions can be indexed")
+    {
+        db.create_function("lower_first", [](std::string const& s) { return s.substr(0, 1); },
+            SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS);
+        REQUIRE_NOTHROW(db.exec("CREATE INDEX test_first ON test(lower_first(text))"));
+        single("SELECT id FROM test WHERE lower_first(text) = 'b'");
+        REQUIRE(db.getInt(0) == 2);
+        db.reset();
+
+        db.create_function("impure", [](std::string const& s) { return s; });
+        REQUIRE_THROWS_AS(db.exec("CREATE INDEX test_impure ON test(impure(text))"), SqliteException);
+    }
+    SECTION("Captured state and void results")
+    {
+        int calls = 0;
+        db.create_function("count_call", [&calls](int) { ++calls; });
+        single("SELECT count_call(id) IS NULL FROM test");
+        REQUIRE(db.getInt(0) == 1);
+        while(db.step()) {}
+        db.reset();
+        REQUIRE(calls == 2);
+    }
+    SECTION("Exceptions become SQL errors")
+    {
+        db.create_function("fail", [](int) -> int { throw std::runtime_error("no good"); });
+        db.setQuery("SELECT fail(1)");
+        db.prepare();
+        REQUIRE_THROWS_WITH(db.step(), Catch::Contains("no good"));
+    }
+    SECTION("Wrong argument count -> fail")
+    {
+        db.create_function("one", [](int a) { return a; });
+        db.setQuery("SELECT one(1, 2)");
+        REQUIRE_THROWS_AS(db.prepare(), SqliteException);
+    }
+}
+
+namespace {
+struct WeightedAverage
+{
+    double sum = 0, weights = 0;
+
+    void step(double value, double weight) {
+        sum += value * weight;
+        weights += weight;
+    }
+    double final() {
+        return weights > 0 ? sum / weights : 0.0;
+    }
+};
+
+struct MovingSum
+{
+    int64_t sum = 0;
+
+    void step(int64_t n) { sum += n; }
+    void inverse(int64_t n) { sum -= n; }
+    int64_t value() { return sum; }
+    int64_t final() { return sum; }
+};
+
+struct Joined
+{
+    std::string text;
+
+    void step(std::string const& s) {
+        if(s == "bad") throw std::runtime_error("bad row");
+        text += s;
+    }
+    std::string final() { return text; }
+};
+}
+
+TEST_CASE("Sqlite3cpp: Aggregate and window functions", "[Function]")
+{
+    Sqlite db(":memory:", false);
+    db.exec("CREATE TABLE test(id INTEGER PRIMARY KEY, grp TEXT, value REAL, weight REAL)");
+    db.exec("INSERT INTO test VALUES(1, 'a', 10, 1)");
+    db.exec("INSERT INTO test VALUES(2, 'a', 20, 3)");
+    db.exec("INSERT INTO test VALUES(3, 'b', 5, 2)");
+    db.exec("INSERT INTO test VALUES(4, 'b', 7, 2)");
+    db.create_aggregate<WeightedAverage>("wavg", SQLITE_DETERMINISTIC);
+    db.create_aggregate<MovingSum>("msum");
+    db.create_aggregate<Joined>("joined");
+
+    SECTION("Aggregate per group")
+    {
+        db.setQuery("SELECT grp, wavg(value, weight) FROM test GROUP BY grp ORDER BY grp");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getDouble(1) == 17.5);
+        REQUIRE(db.step());
+        REQUIRE(db.getDouble(1) == 6.0);
+        REQUIRE_FALSE(db.step());
+        db.reset();
+    }
+    SECTION("No rows -> final() of a fresh state")
+    {
+        db.setQuery("SELECT wavg(value, weight), joined(grp) FROM test WHERE id > 100");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getDouble(0) == 0.0);
+        REQUIRE(db.getText(1) == "");
+        db.reset();
+    }
+    SECTION("Window function over a sliding frame")
+    {
+        db.setQuery("SELECT msum(id) OVER (ORDER BY id ROWS BETWEEN 1 PRECEDING AND CURRENT ROW) FROM test");
+        db.prepare();
+        int expected[] = { 1, 3, 5, 7 };
+        for(int i = 0; i < 4; ++i) {
+            REQUIRE(db.step());
+            REQUIRE(db.getInt(0) == expected[i]);
+        }
+        db.reset();
+    }
+    SECTION("Aggregate without inverse() is not a window function")
+    {
+        db.setQuery("SELECT wavg(value, weight) OVER (ORDER BY id ROWS 1 PRECEDING) FROM test");
+        REQUIRE_THROWS_AS(db.prepare(), SqliteException);
+    }
+    SECTION("Exceptions become SQL errors")
+    {
+        db.exec("INSERT INTO test VALUES(5, 'bad', 0, 0)");
+        db.setQuery("SELECT joined(grp) FROM test");
+        db.prepare();
+        REQUIRE_THROWS_WITH(db.step(), Catch::Contains("bad row"));
+    }
+}
+
+TEST_CASE("Sqlite3cpp: Vector similarity functions", "[Vector]")
+{
+    Sqlite db(":memory:", false);
+    SqliteVector::registerFunctions(db);
+    db.exec("CREATE TABLE test(id INTEGER PRIMARY KEY, embedding BLOB)");
+    const float vectors[3][4] = { { 1, 0, 0, 0 }, { 0.8f, 0.6f, 0, 0 }, { 0, 0, 1, 0 } };
+    db.setQuery("INSERT INTO test(embedding) VALUES(?)");
+    db.prepare();
+    for(int i = 0; i < 3; ++i) {
+        db.bind_blob(1, vectors[i], sizeof(vectors[i]));
+        db.step();
+        db.reset();
+    }
+
+    SECTION("Nearest rows first")
+    {
+        const float query[4] = { 0.9f, 0.1f, 0, 0 };
+        db.setQuery("SELECT id, vec_cosine(embedding, ?1), vec_dot(embedding, ?1), vec_l2(embedding, ?1) FROM test ORDER BY 2 LIMIT 2");
+        db.prepare();
+        db.bind_blob(1, query, sizeof(query));
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) == 1);
+        REQUIRE(db.getDouble(2) == Approx(0.9));
+        REQUIRE(db.getDouble(3) == Approx(std::sqrt(0.02)));
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) == 2);
+        REQUIRE(db.getDouble(1) == Approx(1.0 - 0.78 / std::sqrt(0.82)));
+        REQUIRE_FALSE(db.step());
+        db.reset();
+    }
+    SECTION("int8 vectors")
+    {
+        const int8_t a[5] = { 1, -2, 3, 127, -128 };
+        const int8_t b[5] = { 4, 5, -6, 127, -128 };
+        db.setQuery("SELECT vec_dot_i8(?1, ?2), vec_l2_i8(?1, ?2), vec_cosine_i8(?1, ?1)");
+        db.prepare();
+        db.bind_blob(1, a, sizeof(a));
+        db.bind_blob(2, b, sizeof(b));
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) == 4 - 10 - 18 + 127 * 127 + 128 * 128);
+        REQUIRE(db.getDouble(1) == Approx(std::sqrt(9.0 + 49 + 81)));
+        REQUIRE(db.getDouble(2) == Approx(0.0).margin(1e-12));
+        db.reset();
+    }
+    SECTION("Every kernel set agrees with the scalar one")
+    {
+        SqliteSimd simd = GENERATE(SqliteSimd::Avx2, SqliteSimd::Avx512, SqliteSimd::Neon);
+        if(!SqliteVector::supported(simd)) return;
+        Sqlite tested(":memory:", false);
+        SqliteVector::registerFunctions(tested, simd);
+        Sqlite scalar(":memory:", false);
+        SqliteVector::registerFunctions(scalar, SqliteSimd::Scalar);
+        unsigned seed = 7;
+        auto next = [&seed]() {
+            seed = seed * 1103515245 + 12345;
+            return static_cast<int>((seed >> 16) & 0xff) - 128;
+        };
+        for(size_t n = 0; n < 70; n += 3) {
+            std::vector<float> x(n), y(n);
+            std::vector<int8_t> p(n * 40), q(n * 40);
+            for(size_t i = 0; i < n; ++i) {
+                x[i] = next() / 64.0f;
+                y[i] = next() / 64.0f;
+            }
+            for(size_t i = 0; i < p.size(); ++i) {
+                p[i] = static_cast<int8_t>(next());
+                q[i] = static_cast<int8_t>(next());
+            }
+            std::vector<double> results[2];
+            Sqlite* dbs[2] = { &tested, &scalar };
+            for(int d = 0; d < 2; ++d) {
+                dbs[d]->setQuery("SELECT vec_dot(?1, ?2), vec_l2(?1, ?2), vec_cosine(?1, ?2), "
+                    "vec_dot_i8(?3, ?4), vec_l2_i8(?3, ?4), vec_cosine_i8(?3, ?4)");
+                dbs[d]->prepare();
+                dbs[d]->bind_blob(1, x.data(), static_cast<int>(n * sizeof(float)));
+                dbs[d]->bind_blob(2, y.data(), static_cast<int>(n * sizeof(float)));
+                dbs[d]->bind_blob(3, p.data(), static_cast<int>(p.size()));
+                dbs[d]->bind_blob(4, q.data(), static_cast<int>(q.size()));
+                REQUIRE(dbs[d]->step());
+                for(int c = 0; c < 6; ++c) results[d].push_back(dbs[d]->getDouble(c));
+                dbs[d]->reset();
+            }
+            INFO("kernels " << static_cast<int>(simd) << ", n = " << n);
+            for(int c = 0; c < 6; ++c) REQUIRE(results[0][c] == Approx(results[1][c]).margin(1e-4));
+        }
+    }
+    SECTION("NULL and mismatched vectors")
+    {
+        db.setQuery("SELECT vec_dot(embedding, NULL) IS NULL FROM test");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) == 1);
+        db.reset();
+        db.setQuery("SELECT vec_l2(embedding, zeroblob(8)) FROM test");
+        db.prepare();
+        REQUIRE_THROWS_WITH(db.step(), Catch::Contains("different dimensions"));
+        db.setQuery("SELECT vec_l2(zeroblob(3), zeroblob(3))");
+        db.prepare();
+        REQUIRE_THROWS_WITH(db.step(), Catch::Contains("not a float32 vector"));
+    }
+}
+
+namespace {
+struct Person
+{
+    std::string name;
+    int age;
+    double score;
+};
+}
+
+TEST_CASE("Sqlite3cpp: Container virtual table", "[VTab]")
+{
+    std::vector<Person> people = { { "ann", 31, 1.5 }, { "bob", 42, 2.5 }, { "cid", 31, 3.5 } };
+    SqliteContainerTable<std::vector<Person>> table(people);
+    table.column("name", &Person::name).column("age", &Person::age).column("score", &Person::score);
+    Sqlite db(":memory:", false);
+    table.attach(db, "people");
+
+    SECTION("Full scan")
+    {
+        db.setQuery("SELECT rowid, name, age, score FROM people");
+        db.prepare();
+        for(size_t i = 0; i < people.size(); ++i) {
+            REQUIRE(db.step());
+            REQUIRE(db.getInt(0) == static_cast<int>(i));
+            REQUIRE(db.getText(1) == people[i].name);
+            REQUIRE(db.getInt(2) == people[i].age);
+            REQUIRE(db.getDouble(3) == people[i].score);
+        }
+        REQUIRE_FALSE(db.step());
+        db.reset();
+    }
+    SECTION("Rowid and equality lookups")
+    {
+        db.setQuery("EXPLAIN QUERY PLAN SELECT name FROM people WHERE rowid = 1");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getText(3).find("INDEX 1:") != std::string::npos);
+        db.reset();
+
+        db.setQuery("SELECT name FROM people WHERE rowid = 1");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getText(0) == "bob");
+        REQUIRE_FALSE(db.step());
+        db.reset();
+
+        db.setQuery("SELECT count(*) FROM people WHERE rowid = 7 OR rowid = 1.5");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) == 0);
+        db.reset();
+
+        db.setQuery("SELECT group_concat(name) FROM people WHERE age = 31");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getText(0) == "ann,cid");
+        db.reset();
+
+        db.setQuery("SELECT age FROM people WHERE name = 'cid' AND score = 3.5");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) == 31);
+        db.reset();
+    }
+    SECTION("Equality with a collation matches like a real table")
+    {
+        db.setQuery("SELECT count(*) FROM people WHERE name = 'BOB' COLLATE NOCASE");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) == 1);
+        db.reset();
+
+        db.setQuery("SELECT count(*) FROM people WHERE name = 'BOB'");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) == 0);
+        db.reset();
+    }
+    SECTION("Joins read live container data")
+    {
+        db.exec("CREATE TABLE orders(id INTEGER PRIMARY KEY, name TEXT, amount INTEGER)");
+        db.exec("INSERT INTO orders(name, amount) VALUES('ann', 10), ('bob', 20), ('ann', 5), ('dan', 1)");
+        people[1].age = 43;
+        people.push_back(Person{ "dan", 50, 0 });
+        db.setQuery("SELECT people.name, sum(amount), max(age) FROM orders JOIN people ON people.name = orders.name GROUP BY 1 ORDER BY 1");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getText(0) == "ann");
+        REQUIRE(db.getInt(1) == 15);
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(2) == 43);
+        REQUIRE(db.step());
+        REQUIRE(db.getText(0) == "dan");
+        REQUIRE_FALSE(db.step());
+        db.reset();
+    }
+    SECTION("Read-only")
+    {
+        REQUIRE_THROWS_AS(db.exec("DELETE FROM people"), SqliteException);
+    }
+}
+
+TEST_CASE("Sqlite3cpp: Array parameters", "[Array]")
+{
+    Sqlite db(":memory:", false);
+    db.exec("CREATE TABLE test(id INTEGER PRIMARY KEY, text TEXT, score REAL)");
+    db.exec("BEGIN");
+    db.setQuery("INSERT INTO test VALUES(?, ?, ?)");
+    db.prepare();
+    for(int i = 1; i <= 100; ++i) {
+        db.bind(1, i);
+        db.bind(2, "row" + std::to_string(i));
+        db.bind(3, i * 0.5);
+        db.step();
+        db.reset();
+    }
+    db.exec("COMMIT");
+
+    auto collect = [&db]() {
+        std::vector<int> ids;
+        while(db.step()) ids.push_back(db.getInt(0));
+        db.reset();
+        return ids;
+    };
+
+    SECTION("One prepared statement serves lists of any length")
+    {
+        db.setQuery("SELECT id FROM test WHERE id IN carray(?) ORDER BY id");
+        db.prepare();
+        db.bind_array(1, std::vector<int64_t>{ 42, 7, 1000, 7 });
+        REQUIRE(collect() == std::vector<int>({ 7, 42 }));
+
+        std::vector<int64_t> many;
+        for(int64_t i = 2; i <= 100; i += 2) many.push_back(i);
+        db.bind_array(1, many);
+        REQUIRE(collect().size() == 50);
+
+        db.bind_array(1, std::vector<int64_t>());
+        REQUIRE(collect().empty());
+    }
+    SECTION("Floating point and text elements")
+    {
+        db.setQuery("SELECT id FROM test WHERE score IN carray(?) ORDER BY id");
+        db.prepare();
+        db.bind_array(1, std::vector<double>{ 1.5, 2.0, 99.0 });
+        REQUIRE(collect() == std::vector<int>({ 3, 4 }));
+
+        db.setQuery("SELECT id FROM test WHERE text IN carray(?) ORDER BY id");
+        db.prepare();
+        db.bind_array(1, std::vector<std::string>{ "row9", "missing", "row10" });
+        REQUIRE(collect() == std::vector<int>({ 9, 10 }));
+
+        const char* names[] = { "row1", "row100" };
+        db.bind_array(1, names, 2);
+        REQUIRE(collect() == std::vector<int>({ 1, 100 }));
+    }
+    SECTION("Rows of the table-valued function keep the element order")
+    {
+        db.setQuery("SELECT value FROM carray(?)");
+        db.prepare();
+        int values[] = { 3, 1, 2 };
+        db.bind_array(1, values, 3);
+        REQUIRE(collect() == std::vector<int>({ 3, 1, 2 }));
+    }
+    SECTION("Unbound and foreign pointers yield no rows")
+    {
+        db.setQuery("SELECT count(*) FROM carray(?)");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) == 0);
+        db.reset();
+        db.bind(1, 5);
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) == 0);
+        db.reset();
+    }
+    SECTION("Without an argument the table is empty")
+    {
+        db.setQuery("SELECT count(*) FROM carray");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) == 0);
+        db.reset();
+    }
+}
+
+TEST_CASE("Sqlite3cpp: Batched point lookups", "[Lookup]")
+{
+    Sqlite db(":memory:", false);
+    db.exec("CREATE TABLE people(id INTEGER PRIMARY KEY, name TEXT, score REAL)");
+    db.exec("BEGIN");
+    db.setQuery("INSERT INTO people VALUES(?, ?, ?)");
+    db.prepare();
+    for(int i = 1; i <= 1000; ++i) {
+        db.bind(1, i);
+        db.bind(2, "person" + std::to_string(i));
+        db.bind(3, i * 0.25);
+        db.step();
+        db.reset();
+    }
+    db.exec("COMMIT");
+
+    typedef SqliteLookup<int64_t, std::string, double> People;
+
+    SECTION("Results follow the key order and mark missing keys")
+    {
+        People people(db, "SELECT id, name, score FROM people WHERE id IN carray(?)");
+        std::vector<People::Result> r = people.multi_get(std::vector<int64_t>{ 500, 2, 5000, 2, 1 });
+        REQUIRE(r.size() == 5);
+        REQUIRE(r[0].found);
+        REQUIRE(std::get<0>(r[0].row) == "person500");
+        REQUIRE(std::get<1>(r[0].row) == 125.0);
+        REQUIRE(std::get<0>(r[1].row) == "person2");
+        REQUIRE_FALSE(r[2].found);
+        REQUIRE(std::get<0>(r[2].row).empty());
+        REQUIRE(r[3].found);
+        REQUIRE(std::get<0>(r[3].row) == "person2");
+        REQUIRE(std::get<0>(r[4].row) == "person1");
+
+        REQUIRE(people.multi_get(std::vector<int64_t>()).empty());
+    }
+    SECTION("Long lists are split into batches")
+    {
+        People people(db, "SELECT id, name, score FROM people WHERE id IN carray(?)", 7);
+        REQUIRE(people.maxBatch() == 7);
+        std::vector<int64_t> keys;
+        for(int64_t k = 1100; k > 0; k -= 3) keys.push_back(k);
+        std::vector<People::Result> r;
+        people.multi_get(keys.data(), keys.size(), r);
+        REQUIRE(r.size() == keys.size());
+        for(size_t i = 0; i < keys.size(); ++i) {
+            REQUIRE(r[i].found == (keys[i] <= 1000));
+            if(r[i].found) REQUIRE(std::get<0>(r[i].row) == "person" + std::to_string(keys[i]));
+        }
+        people.setMaxBatch(0);
+        REQUIRE(people.maxBatch() == 1);
+        people.multi_get(keys.data() + 33, 3, r);
+        REQUIRE(r.size() == 3);
+        REQUIRE_FALSE(r[0].found);
+        REQUIRE(std::get<1>(r[2].row) == 995 * 0.25);
+    }
+    SECTION("Text keys and the connection query are independent")
+    {
+        db.setQuery("SELECT count(*) FROM people");
+        db.prepare();
+        SqliteLookup<std::string, int64_t> ids(db, "SELECT name, id FROM people WHERE name IN carray(?)");
+        std::vector<SqliteLookup<std::string, int64_t>::Result> r =
+            ids.multi_get(std::vector<std::string>{ "person7", "nobody" });
+        REQUIRE(std::get<0>(r[0].row) == 7);
+        REQUIRE_FALSE(r[1].found);
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) == 1000);
+        db.reset();
+    }
+    SECTION("Invalid queries throw")
+    {
+        REQUIRE_THROWS_AS(People(db, "SELECT id FROM nowhere WHERE id IN carray(?)"), SqliteException);
+        REQUIRE_THROWS_AS(People(db, "SELECT id, name FROM people WHERE id IN carray(?)"), SqliteException);
+    }
+}
+
+TEST_CASE("Sqlite3cpp: Collations", "[Collation]")
+{
+    Sqlite db(":memory:", false);
+    db.exec("CREATE TABLE files(name TEXT)");
+    const char* names[] = { "file10.txt", "File2.txt", "file1.txt", "file02.txt", "file2.txt", "apple", "Zebra" };
+    db.setQuery("INSERT INTO files VALUES(?)");
+    db.prepare();
+    for(size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        db.bind(1, std::string(names[i]));
+        db.step();
+        db.reset();
+    }
+
+    auto ordered = [&db](std::string const& sql) {
+        std::vector<std::string> rows;
+        db.setQuery(sql);
+        db.prepare();
+        while(db.step()) rows.push_back(db.getText(0));
+        db.reset();
+        return rows;
+    };
+
+    SECTION("ASCII case folding")
+    {
+        db.create_collation("ASCII_NOCASE", &SqliteCollation::asciiNoCase);
+        REQUIRE(ordered("SELECT name FROM files ORDER BY name COLLATE ASCII_NOCASE, name").front() == "apple");
+        REQUIRE(ordered("SELECT name FROM files ORDER BY name COLLATE ASCII_NOCASE").back() == "Zebra");
+        REQUIRE(ordered("SELECT name FROM files WHERE name = 'FILE2.TXT' COLLATE ASCII_NOCASE").size() == 2);
+        REQUIRE(SqliteCollation::asciiNoCase("abcdefghijKLM", 13, "ABCDEFGHIJklm", 13) == 0);
+        REQUIRE(SqliteCollation::asciiNoCase("abcdefghij", 10, "ABCDEFGHIJK", 11) < 0);
+        REQUIRE(SqliteCollation::asciiNoCase("\xc3\xa9", 2, "\xc3\x89", 2) > 0);
+    }
+    SECTION("Natural order")
+    {
+        db.create_collation("NATSORT", &SqliteCollation::natural);
+        std::vector<std::string> expected = { "apple", "file1.txt", "File2.txt", "file02.txt", "file2.txt", "file10.txt", "Zebra" };
+        REQUIRE(ordered("SELECT name FROM files ORDER BY name COLLATE NATSORT") == expected);
+        REQUIRE(SqliteCollation::natural("v1.10", 5, "v1.9", 4) > 0);
+        REQUIRE(SqliteCollation::natural("x007", 4, "x7", 2) < 0);
+        REQUIRE(SqliteCollation::natural("12345678901234567890", 20, "9", 1) > 0);
+    }
+    SECTION("Indexes built with a collation serve ORDER BY")
+    {
+        db.create_collation("NATSORT", &SqliteCollation::natural);
+        db.exec("CREATE INDEX files_natural ON files(name COLLATE NATSORT)");
+        bool sorted = false, indexed = false;
+        db.setQuery("EXPLAIN QUERY PLAN SELECT name FROM files ORDER BY name COLLATE NATSORT");
+        db.prepare();
+        while(db.step()) {
+            std::string detail = db.getText(3);
+            if(detail.find("TEMP B-TREE") != std::string::npos) sorted = true;
+            if(detail.find("files_natural") != std::string::npos) indexed = true;
+        }
+        db.reset();
+        REQUIRE(indexed);
+        REQUIRE_FALSE(sorted);
+        REQUIRE(ordered("SELECT name FROM files ORDER BY name COLLATE NATSORT").front() == "apple");
+    }
+    SECTION("Lambda comparators")
+    {
+        int calls = 0;
+        db.create_collation("REVERSE", [&calls](const char* a, int na, const char* b, int nb) {
+            ++calls;
+            return -SqliteCollation::binary(a, na, b, nb);
+        });
+        REQUIRE(ordered("SELECT name FROM files ORDER BY name COLLATE REVERSE").front() == "file2.txt");
+        REQUIRE(calls > 0);
+        REQUIRE_THROWS_AS(ordered("SELECT name FROM files ORDER BY name COLLATE MISSING"), SqliteException);
+    }
+}
+
+static_assert(SqlitePlaceholders::count("SELECT 1") == 0, "no parameters");
+static_assert(SqlitePlaceholders::count("SELECT ?, ?") == 2, "anonymous parameters");
+static_assert(SqlitePlaceholders::count("SELECT ?5, ?") == 6, "numbered parameters");
+static_assert(SqlitePlaceholders::count("SELECT :a, @b, :a, $c, :ab") == 4, "named parameters");
+static_assert(SqlitePlaceholders::count("SELECT '?', \"?\", [?], `?` -- ?\n /* :a ? */ , 'it''s ?', ?") == 1,
+    "quoted text and comments");
+
+namespace {
+
+int countStatements(Sqlite& db)
+{
+    int n = 0;
+    for(sqlite3_stmt* s = sqlite3_next_stmt(db.getHandle(), NULL); s; s = sqlite3_next_stmt(db.getHandle(), s)) ++n;
+    return n;
+}
+
+} // namespace
+
+TEST_CASE("Sqlite3cpp: Typed queries", "[Query]")
+{
+    static constexpr SqliteQuery<void()> create("CREATE TABLE people(id INTEGER PRIMARY KEY, name TEXT, score REAL)");
+    static constexpr SqliteQuery<void(int64_t, std::string, double)> insert("INSERT INTO people VALUES(?, ?, ?)");
+    static constexpr SqliteQuery<std::tuple<int64_t, std::string>(double)> best(
+        "SELECT id, name FROM people WHERE score > ? ORDER BY id");
+    static constexpr SqliteQuery<std::string(int64_t)> name("SELECT name FROM people WHERE id = :id OR :id IS NULL");
+    static_assert(best.key() != name.key(), "queries have distinct keys");
+
+    Sqlite db(":memory:", false);
+    db.run(create);
+    db.run(insert, 1, "ann", 1.5);
+    db.run(insert, 2, std::string("bob"), 3.5);
+    db.run(insert, 3, "cid", 2.5);
+
+    SECTION("Rows come back typed")
+    {
+        std::vector<std::tuple<int64_t, std::string>> rows = db.run(best, 2.0);
+        REQUIRE(rows.size() == 2);
+        REQUIRE(std::get<0>(rows[0]) == 2);
+        REQUIRE(std::get<1>(rows[0]) == "bob");
+        REQUIRE(std::get<1>(rows[1]) == "cid");
+        REQUIRE(db.run(name, 3) == std::vector<std::string>{ "cid" });
+        REQUIRE(db.run(name, 4).empty());
+    }
+    SECTION("Each query is prepared once per connection")
+    {
+        int before = countStatements(db);
+        for(int i = 0; i < 10; ++i) db.run(best, i * 0.5);
+        REQUIRE(countStatements(db) == before + 1);
+
+        SqliteQuery<std::tuple<int64_t, std::string>(double)> again("SELECT id, name FROM people WHERE score > ? ORDER BY id");
+        REQUIRE(again.key() == best.key());
+        REQUIRE(db.run(again, 3.0).size() == 1);
+        REQUIRE(countStatements(db) == before + 1);
+
+        db.clearQueryCache();
+        REQUIRE(countStatements(db) == 0);
+        REQUIRE(db.run(best, 0.0).size() == 3);
+    }
+    SECTION("Typed queries leave the connection query alone")
+    {
+        db.setQuery("SELECT count(*) FROM people");
+        db.prepare();
+        REQUIRE(db.run(best, 0.0).size() == 3);
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) == 3);
+        db.reset();
+    }
+    SECTION("Errors")
+    {
+        // Not constexpr, so the mismatch is found at run time
+        REQUIRE_THROWS_AS((SqliteQuery<void(int)>("SELECT ?, ?")), SqliteException);
+        static constexpr SqliteQuery<int()> missing("SELECT x FROM nowhere");
+        REQUIRE_THROWS_AS(db.run(missing), SqliteException);
+        REQUIRE_THROWS_AS(db.run(insert, 1, "duplicate", 0.0), SqliteException);
+        REQUIRE(db.run(name, 1) == std::vector<std::string>{ "ann" });
+    }
+}
+
+namespace {
+
+struct Account
+{
+    int64_t id;
+    std::string owner;
+    double balance;
+    std::vector<char> note;
+};
+
+} // namespace
+
+TEST_CASE("Sqlite3cpp: Named parameters", "[Bind]")
+{
+    Sqlite db(":memory:", false);
+    db.exec("CREATE TABLE accounts(id INTEGER PRIMARY KEY, owner TEXT, balance REAL, note BLOB)");
+
+    SECTION("Binding by name")
+    {
+        db.setQuery("INSERT INTO accounts VALUES(:id, @owner, $balance, :note)");
+        db.prepare();
+        for(int i = 1; i <= 3; ++i) {
+            db.bind(":id", i);
+            db.bind("@owner", "owner" + std::to_string(i));
+            db.bind("$balance", i * 10.0);
+            db.bind_blob(":note", "abc", i);
+            db.step();
+            db.reset();
+        }
+        db.setQuery("SELECT owner, length(note) FROM accounts WHERE id = :id AND balance > :min OR id = :id + 10");
+        db.prepare();
+        db.bind(":id", 2);
+        db.bind(":min", 5.0);
+        REQUIRE(db.step());
+        REQUIRE(db.getText(0) == "owner2");
+        REQUIRE(db.getInt(1) == 2);
+        db.reset();
+
+        // Another string with the same name resolves the same way
+        std::string name = ":id";
+        db.bind(name.c_str(), 3);
+        REQUIRE(db.step());
+        REQUIRE(db.getText(0) == "owner3");
+        db.reset();
+        db.bind_null(":min");
+        REQUIRE_FALSE(db.step());
+        db.reset();
+    }
+    SECTION("A re-prepared statement resolves names again")
+    {
+        db.exec("INSERT INTO accounts VALUES(1, 'ann', 1.0, NULL)");
+        db.setQuery("SELECT :a, :b");
+        db.prepare();
+        db.bind(":b", 2);
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(1) == 2);
+        db.reset();
+        db.setQuery("SELECT :b, :a");
+        db.prepare();
+        db.bind(":b", 3);
+        REQUIRE(db.step());
+        REQUIRE(db.getInt(0) == 3);
+        db.reset();
+    }
+    SECTION("Unknown names")
+    {
+        db.setQuery("SELECT :a");
+        db.prepare();
+        REQUIRE_THROWS_AS(db.bind(":b", 1), SqliteException);
+        REQUIRE_THROWS_AS(db.bind("a", 1), SqliteException);
+        REQUIRE_FALSE(db.tryBind(":b", 1));
+        REQUIRE(db.tryBind(":a", 1));
+        db.reset();
+    }
+    SECTION("Struct fields bind to parameters of the same name")
+    {
+        SqliteBinding<Account> fields;
+        fields.field("id", &Account::id)
+            .field("owner", &Account::owner)
+            .field("balance", &Account::balance)
+            .field("note", &Account::note);
+
+        db.setQuery("INSERT INTO accounts VALUES(:id, :owner, @balance, $note)");
+        db.prepare();
+        Account a = { 7, "eve", 12.5, std::vector<char>{ 'x', 'y' } };
+        db.bind(fields, a);
+        db.step();
+        db.reset();
+        a.id = 8;
+        a.note.clear();
+        db.bind(fields, a);
+        db.step();
+        db.reset();
+
+        // Fields without a parameter are skipped
+        db.setQuery("UPDATE accounts SET balance = :balance WHERE id = :id");
+        db.prepare();
+        a.balance = 99.0;
+        db.bind(fields, a);
+        db.step();
+        db.reset();
+
+        db.setQuery("SELECT owner, balance, length(note), typeof(note) FROM accounts ORDER BY id");
+        db.prepare();
+        REQUIRE(db.step());
+        REQUIRE(db.getText(0) == "eve");
+        REQUIRE(db.getDouble(1) == 12.5);
+        REQUIRE(db.getInt(2) == 2);
+        REQUIRE(db.step());
+        REQUIRE(db.getDouble(1) == 99.0);
+        REQUIRE(db.getText(3) == "blob");
+        db.reset();
+    }
+}
+
+TEST_CASE("Sqlite3cpp: Result cache", "[Cache]")
+{
+    const char* file = "sqlite3cpp_cache_test.db";
+    std::remove(file);
+    std::remove("sqlite3cpp_cache_test.db-wal");
+    std::remove("sqlite3cpp_cache_test.db-shm");
+    {
+        Sqlite db(file, false);
+        db.exec("CREATE TABLE items(id INTEGER PRIMARY KEY, name TEXT, price REAL, data BLOB)");
+        db.exec("CREATE TABLE tags(name TEXT PRIMARY KEY, item INTEGER) WITHOUT ROWID");
+        db.exec("INSERT INTO items VALUES(1, 'apple', 0.5, x'0102'), (2, 'pear', 0.75, NULL), (3, 'plum', 1.25, x'')");
+        db.exec("INSERT INTO tags VALUES('fruit', 1), ('green', 2)");
+
+        SqliteResultCache cache(db);
+        const std::string by_id = "SELECT name, price, data, id FROM items WHERE id = ?";
+
+        SECTION("Repeated reads are served from the cache")
+        {
+            SqliteResultCache::Rows rows = cache.fetch(by_id, 1);
+            REQUIRE(rows->size() == 1);
+            REQUIRE(rows->columns() == 4);
+            REQUIRE(rows->getText(0, 0) == "apple");
+            REQUIRE(rows->getDouble(0, 1) == 0.5);
+            REQUIRE(rows->getBlob(0, 2) == std::string("\x01\x02", 2));
+            REQUIRE(rows->getInt(0, 3) == 1);
+            REQUIRE(rows->getText(0, 3) == "1");
+            REQUIRE(rows->type(0, 1) == SQLITE_FLOAT);
+            REQUIRE(cache.misses() == 1);
+
+            REQUIRE(cache.fetch(by_id, 1) == rows);
+            REQUIRE(cache.hits() == 1);
+            // Arguments are part of the key, NULL and an empty blob differ
+            REQUIRE(cache.fetch(by_id, 2)->getText(0, 0) == "pear");
+            REQUIRE(cache.fetch(by_id, 2)->type(0, 2) == SQLITE_NULL);
+            REQUIRE(cache.fetch(by_id, 3)->type(0, 2) == SQLITE_BLOB);
+            REQUIRE(cache.fetch(by_id, 3)->getBlob(0, 2).empty());
+            REQUIRE(cache.fetch(by_id, nullptr)->size() == 0);
+            REQUIRE(cache.fetch("SELECT count(*) FROM items WHERE name > ? AND price < ?", std::string("b"), 1.0)
+                ->getInt(0, 0) == 1);
+            REQUIRE(cache.entries() == 5);
+            REQUIRE(cache.hits() == 3);
+        }
+        SECTION("Writes drop the results of the tables they change")
+        {
+            SqliteResultCache::Rows before = cache.fetch(by_id, 1);
+            cache.fetch("SELECT item FROM tags WHERE name = ?", "fruit");
+            cache.fetch("SELECT count(*) FROM items JOIN tags ON item = id");
+            db.exec("UPDATE items SET price = 0.6 WHERE id = 1");
+
+            SqliteResultCache::Rows after = cache.fetch(by_id, 1);
+            REQUIRE(after != before);
+            REQUIRE(after->getDouble(0, 1) == 0.6);
+            // The result kept by the caller is unchanged
+            REQUIRE(before->getDouble(0, 1) == 0.5);
+            uint64_t hits = cache.hits();
+            cache.fetch("SELECT item FROM tags WHERE name = ?", "fruit");
+            REQUIRE(cache.hits() == hits + 1);
+            REQUIRE(cache.fetch("SELECT count(*) FROM items JOIN tags ON item = id")->getInt(0, 0) == 2);
+            REQUIRE(cache.hits() == hits + 1);
+
+            // WITHOUT ROWID tables are not reported by the update hook
+            db.exec("UPDATE tags SET item = 3 WHERE name = 'fruit'");
+            REQUIRE(cache.fetch("SELECT item FROM tags WHERE name = ?", "fruit")->getInt(0, 0) == 3);
+            db.exec("DELETE FROM items");
+            REQUIRE(cache.fetch(by_id, 1)->size() == 0);
+        }
+        SECTION("Transactions")
+        {
+            db.exec("BEGIN");
+            db.exec("UPDATE items SET name = 'quince' WHERE id = 1");
+            REQUIRE(cache.fetch(by_id, 1)->getText(0, 0) == "quince");
+            // Not kept while the transaction could still roll back
+            REQUIRE(cache.entries() == 0);
+            db.exec("ROLLBACK");
+            REQUIRE(cache.fetch(by_id, 1)->getText(0, 0) == "apple");
+            REQUIRE(cache.entries() == 1);
+
+            db.exec("BEGIN");
+            db.exec("UPDATE items SET name = 'quince' WHERE id = 1");
+            db.exec("COMMIT");
+            REQUIRE(cache.fetch(by_id, 1)->getText(0, 0) == "quince");
+            REQUIRE(cache.fetch(by_id, 1)->getText(0, 0) == "quince");
+            REQUIRE(cache.hits() == 1);
+        }
+        SECTION("Schema changes and other connections")
+        {
+            cache.fetch(by_id, 1);
+            db.exec("ALTER TABLE items RENAME COLUMN name TO title");
+            REQUIRE_THROWS_AS(cache.fetch(by_id, 1), SqliteException);
+            REQUIRE(cache.entries() == 0);
+            db.exec("ALTER TABLE items RENAME COLUMN title TO name");
+
+            REQUIRE(cache.fetch(by_id, 2)->getText(0, 0) == "pear");
+            {
+                Sqlite other(file, false);
+                other.exec("UPDATE items SET name = 'nashi' WHERE id = 2");
+            }
+            REQUIRE(cache.fetch(by_id, 2)->getText(0, 0) == "nashi");
+        }
+        SECTION("Writing queries and the budget")
+        {
+            REQUIRE(cache.fetch("SELECT random()")->size() == 1);
+            cache.fetch("INSERT INTO items(name) VALUES('fig') RETURNING id");
+            REQUIRE(cache.entries() == 1);
+            REQUIRE(cache.fetch("INSERT INTO items(name) VALUES('fig') RETURNING id")->getInt(0, 0) == 5);
+
+            cache.clear();
+            for(int i = 1; i <= 3; ++i) cache.fetch(by_id, i);
+            size_t all = cache.bytes();
+            REQUIRE(cache.entries() == 3);
+            cache.setBudget(all - 1);
+            REQUIRE(cache.entries() == 2);
+            REQUIRE(cache.bytes() < all);
+            // The oldest result went first
+            cache.fetch(by_id, 3);
+            cache.fetch(by_id, 2);
+            REQUIRE(cache.hits() == 2);
+            cache.setBudget(0);
+            cache.fetch(by_id, 1);
+            REQUIRE(cache.entries() == 0);
+            REQUIRE(cache.bytes() == 0);
+            REQUIRE_THROWS_AS(cache.fetch("SELECT * FROM nothing"), SqliteException);
+        }
+    }
+    std::remove(file);
+    std::remove("sqlite3cpp_cache_test.db-wal");
+    std::remove("sqlite3cpp_cache_test.db-shm");
+}
@@ -0,0 +1,519 @@
+// Throughput benchmark comparing the Sqlite wrapper against the raw sqlite3 C API.
+// Build: g++ -O2 -std=c++11 bench_sqlite3cpp.cc -lsqlite3 -o bench_sqlite3cpp
+// Usage: ./bench_sqlite3cpp [rows]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "sqlite3cpp.h"
+#include "sqlite3cpp_cache.h"
+#include "sqlite3cpp_lookup.h"
+
+namespace {
+
+typedef std::chrono::steady_clock bench_clock;
+
+// Only the section between start() and stop() is measured, so table setup
+// and teardown do not count against either API
+class Stopwatch {
+public:
+    void start() { this->begin = bench_clock::now(); }
+    void stop() { this->end = bench_clock::now(); }
+    double seconds() const { return std::chrono::duration<double>(this->end - this->begin).count(); }
+private:
+    bench_clock::time_point begin, end;
+};
+
+struct Workload {
+    typedef std::function<long(long, Stopwatch&)> Run;
+
+    Workload(std::string const& name, Run wrapper, Run capi, bool cached = false)
+        :name{name}, wrapper{wrapper}, capi{capi}, cached{cached} {}
+
+    std::string name;
+    Run wrapper;
+    Run capi;
+    // The wrapper side serves repeats from SqliteResultCache while the C API
+    // runs the query each time, so it is reported as a speedup
+    bool cached;
+};
+
+// Keeps the optimizer from dropping fetched values
+volatile long long sink = 0;
+
+const std::string payload_text(100, 't');
+
+// Keys per multi_get() in lookup_burst
+const long lookup_burst = 200;
+// Distinct ranges summed over and over in cached_range
+const long cached_ranges = 64;
+
+double run(std::function<long(long, Stopwatch&)> const& f, long rows, long& ops)
+{
+    Stopwatch sw;
+    ops = f(rows, sw);
+    return sw.seconds();
+}
+
+void report(std::string const& workload, std::string const& api, long ops, double seconds, double base_ns, bool speedup = false)
+{
+    double ns_op = seconds * 1e9 / ops;
+    double ops_sec = ops / seconds;
+    char line[160];
+    if(base_ns > 0 && speedup) {
+        std::snprintf(line, sizeof(line), "%-16s %-8s %10ld %12.1f %14.0f %9.1fx",
+            workload.c_str(), api.c_str(), ops, ns_op, ops_sec, base_ns / ns_op);
+    } else if(base_ns > 0) {
+        std::snprintf(line, sizeof(line), "%-16s %-8s %10ld %12.1f %14.0f %+9.1f%%",
+            workload.c_str(), api.c_str(), ops, ns_op, ops_sec, (ns_op - base_ns) * 100.0 / base_ns);
+    } else {
+        std::snprintf(line, sizeof(line), "%-16s %-8s %10ld %12.1f %14.0f %10s",
+            workload.c_str(), api.c_str(), ops, ns_op, ops_sec, "-");
+    }
+    std::cout << line << std::endl;
+}
+
+// Raw C API helpers
+sqlite3* capiOpen()
+{
+    sqlite3* db = NULL;
+    if(sqlite3_open(":memory:", &db) != SQLITE_OK) {
+        std::cerr << "Can't open database: " << sqlite3_errmsg(db) << std::endl;
+        std::exit(1);
+    }
+    return db;
+}
+
+void capiExec(sqlite3* db, const char* sql)
+{
+    char* err = NULL;
+    if(sqlite3_exec(db, sql, 0, 0, &err) != SQLITE_OK) {
+        std::cerr << "exec failed: " << err << std::endl;
+        sqlite3_free(err);
+        std::exit(1);
+    }
+}
+
+sqlite3_stmt* capiPrepare(sqlite3* db, const char* sql)
+{
+    sqlite3_stmt* stmt = NULL;
+    if(sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        std::cerr << "prepare failed: " << sqlite3_errmsg(db) << std::endl;
+        std::exit(1);
+    }
+    return stmt;
+}
+
+void capiPopulate(sqlite3* db, long rows)
+{
+    capiExec(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, val INTEGER, txt TEXT, bin BLOB)");
+    capiExec(db, "BEGIN");
+    sqlite3_stmt* stmt = capiPrepare(db, "INSERT INTO t(val, txt, bin) VALUES(?, ?, zeroblob(256))");
+    for(long i = 0; i < rows; ++i) {
+        sqlite3_bind_int(stmt, 1, static_cast<int>(i));
+        sqlite3_bind_text(stmt, 2, payload_text.c_str(), payload_text.length(), SQLITE_STATIC);
+        sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+    capiExec(db, "COMMIT");
+}
+
+// Wrapper helpers
+void wrapperPopulate(Sqlite& db, long rows)
+{
+    db.exec("CREATE TABLE t(id INTEGER PRIMARY KEY, val INTEGER, txt TEXT, bin BLOB)");
+    db.exec("BEGIN");
+    db.setQuery("INSERT INTO t(val, txt, bin) VALUES(?, ?, zeroblob(256))");
+    db.prepare();
+    for(long i = 0; i < rows; ++i) {
+        db.bind(1, static_cast<int>(i));
+        db.bind(2, payload_text);
+        db.step();
+        db.reset();
+    }
+    db.exec("COMMIT");
+}
+
+long nextKey(long& state, long rows)
+{
+    state = (state * 1103515245 + 12345) & 0x7fffffff;
+    return state % rows + 1;
+}
+
+std::vector<Workload> workloads()
+{
+    std::vector<Workload> w;
+
+    w.push_back(Workload{"insert_single",
+        [](long rows, Stopwatch& sw) {
+            Sqlite db(":memory:", false);
+            db.exec("CREATE TABLE t(id INTEGER PRIMARY KEY, val INTEGER, txt TEXT)");
+            db.setQuery("INSERT INTO t(val, txt) VALUES(?, ?)");
+            db.prepare();
+            sw.start();
+            for(long i = 0; i < rows; ++i) {
+                db.bind(1, static_cast<int>(i));
+                db.bind(2, payload_text);
+                db.step();
+                db.reset();
+            }
+            sw.stop();
+            return rows;
+        },
+        [](long rows, Stopwatch& sw) {
+            sqlite3* db = capiOpen();
+            capiExec(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, val INTEGER, txt TEXT)");
+            sqlite3_stmt* stmt = capiPrepare(db, "INSERT INTO t(val, txt) VALUES(?, ?)");
+            sw.start();
+            for(long i = 0; i < rows; ++i) {
+                sqlite3_bind_int(stmt, 1, static_cast<int>(i));
+                sqlite3_bind_text(stmt, 2, payload_text.c_str(), payload_text.length(), SQLITE_TRANSIENT);
+                sqlite3_step(stmt);
+                sqlite3_reset(stmt);
+            }
+            sw.stop();
+            sqlite3_finalize(stmt);
+            sqlite3_close(db);
+            return rows;
+        }});
+
+    w.push_back(Workload{"insert_batch",
+        [](long rows, Stopwatch& sw) {
+            Sqlite db(":memory:", false);
+            db.exec("CREATE TABLE t(id INTEGER PRIMARY KEY, val INTEGER, txt TEXT)");
+            sw.start();
+            db.exec("BEGIN");
+            db.setQuery("INSERT INTO t(val, txt) VALUES(?, ?)");
+            db.prepare();
+            for(long i = 0; i < rows; ++i) {
+                db.bind(1, static_cast<int>(i));
+                db.bind(2, payload_text);
+                db.step();
+                db.reset();
+            }
+            db.exec("COMMIT");
+            sw.stop();
+            return rows;
+        },
+        [](long rows, Stopwatch& sw) {
+            sqlite3* db = capiOpen();
+            capiExec(db, "CREATE TABLE t(id INTEGER PRIMARY KEY, val INTEGER, txt TEXT)");
+            sw.start();
+            capiExec(db, "BEGIN");
+            sqlite3_stmt* stmt = capiPrepare(db, "INSERT INTO t(val, txt) VALUES(?, ?)");
+            for(long i = 0; i < rows; ++i) {
+                sqlite3_bind_int(stmt, 1, static_cast<int>(i));
+                sqlite3_bind_text(stmt, 2, payload_text.c_str(), payload_text.length(), SQLITE_TRANSIENT);
+                sqlite3_step(stmt);
+                sqlite3_reset(stmt);
+            }
+            sqlite3_finalize(stmt);
+            capiExec(db, "COMMIT");
+            sw.stop();
+            sqlite3_close(db);
+            return rows;
+        }});
+
+    w.push_back(Workload{"point_lookup",
+        [](long rows, Stopwatch& sw) {
+            Sqlite db(":memory:", false);
+            wrapperPopulate(db, rows);
+            db.setQuery("SELECT val FROM t WHERE id = ?");
+            db.prepare();
+            long state = 1;
+            sw.start();
+            for(long i = 0; i < rows; ++i) {
+                db.bind(1, static_cast<int>(nextKey(state, rows)));
+                if(db.step()) sink += db.getInt(0);
+                db.reset();
+            }
+            sw.stop();
+            return rows;
+        },
+        [](long rows, Stopwatch& sw) {
+            sqlite3* db = capiOpen();
+            capiPopulate(db, rows);
+            sqlite3_stmt* stmt = capiPrepare(db, "SELECT val FROM t WHERE id = ?");
+            long state = 1;
+            sw.start();
+            for(long i = 0; i < rows; ++i) {
+                sqlite3_bind_int(stmt, 1, static_cast<int>(nextKey(state, rows)));
+                if(sqlite3_step(stmt) == SQLITE_ROW) sink += sqlite3_column_int(stmt, 0);
+                sqlite3_reset(stmt);
+            }
+            sw.stop();
+            sqlite3_finalize(stmt);
+            sqlite3_close(db);
+            return rows;
+        }});
+
+    // The same random keys in bursts of lookup_burst: one multi_get() per
+    // burst against one step/reset cycle per key
+    w.push_back(Workload{"lookup_burst",
+        [](long rows, Stopwatch& sw) {
+            Sqlite db(":memory:", false);
+            wrapperPopulate(db, rows);
+            SqliteLookup<int64_t, int64_t> lookup(db, "SELECT id, val FROM t WHERE id IN carray(?)");
+            std::vector<int64_t> keys(lookup_burst);
+            std::vector<SqliteLookup<int64_t, int64_t>::Result> results;
+            long state = 1;
+            sw.start();
+            for(long i = 0; i < rows; i += lookup_burst) {
+                for(long k = 0; k < lookup_burst; ++k) keys[k] = nextKey(state, rows);
+                lookup.multi_get(keys.data(), keys.size(), results);
+                for(size_t k = 0; k < results.size(); ++k) sink += std::get<0>(results[k].row);
+            }
+            sw.stop();
+            return (rows + lookup_burst - 1) / lookup_burst * lookup_burst;
+        },
+        [](long rows, Stopwatch& sw) {
+            sqlite3* db = capiOpen();
+            capiPopulate(db, rows);
+            sqlite3_stmt* stmt = capiPrepare(db, "SELECT val FROM t WHERE id = ?");
+            std::vector<long> keys(lookup_burst);
+            long state = 1;
+            sw.start();
+            for(long i = 0; i < rows; i += lookup_burst) {
+                for(long k = 0; k < lookup_burst; ++k) keys[k] = nextKey(state, rows);
+                for(long k = 0; k < lookup_burst; ++k) {
+                    sqlite3_bind_int64(stmt, 1, keys[k]);
+                    if(sqlite3_step(stmt) == SQLITE_ROW) sink += sqlite3_column_int(stmt, 0);
+                    sqlite3_reset(stmt);
+                }
+            }
+            sw.stop();
+            sqlite3_finalize(stmt);
+            sqlite3_close(db);
+            return (rows + lookup_burst - 1) / lookup_burst * lookup_burst;
+        }});
+
+    w.push_back(Workload{"full_scan",
+        [](long rows, Stopwatch& sw) {
+            Sqlite db(":memory:", false);
+            wrapperPopulate(db, rows);
+            db.setQuery("SELECT id, val FROM t");
+            db.prepare();
+            long ops = 0;
+            sw.start();
+            while(db.step()) {
+                sink += db.getInt(0) + db.getInt(1);
+                ++ops;
+            }
+            sw.stop();
+            db.reset();
+            return ops;
+        },
+        [](long rows, Stopwatch& sw) {
+            sqlite3* db = capiOpen();
+            capiPopulate(db, rows);
+            sqlite3_stmt* stmt = capiPrepare(db, "SELECT id, val FROM t");
+            long ops = 0;
+            sw.start();
+            while(sqlite3_step(stmt) == SQLITE_ROW) {
+                sink += sqlite3_column_int(stmt, 0) + sqlite3_column_int(stmt, 1);
+                ++ops;
+            }
+            sw.stop();
+            sqlite3_finalize(stmt);
+            sqlite3_close(db);
+            return ops;
+        }});
+
+    w.push_back(Workload{"text_blob_fetch",
+        [](long rows, Stopwatch& sw) {
+            Sqlite db(":memory:", false);
+            wrapperPopulate(db, rows);
+            db.setQuery("SELECT txt, bin FROM t");
+            db.prepare();
+            long ops = 0;
+            sw.start();
+            while(db.step()) {
+                sink += db.getText(0).length() + db.getBlob(1).length();
+                ++ops;
+            }
+            sw.stop();
+            db.reset();
+            return ops;
+        },
+        [](long rows, Stopwatch& sw) {
+            sqlite3* db = capiOpen();
+            capiPopulate(db, rows);
+            sqlite3_stmt* stmt = capiPrepare(db, "SELECT txt, bin FROM t");
+            long ops = 0;
+            sw.start();
+            while(sqlite3_step(stmt) == SQLITE_ROW) {
+                sqlite3_column_text(stmt, 0);
+                sink += sqlite3_column_bytes(stmt, 0);
+                sqlite3_column_blob(stmt, 1);
+                sink += sqlite3_column_bytes(stmt, 1);
+                ++ops;
+            }
+            sw.stop();
+            sqlite3_finalize(stmt);
+            sqlite3_close(db);
+            return ops;
+        }});
+
+    w.push_back(Workload{"bind_heavy",
+        [](long rows, Stopwatch& sw) {
+            Sqlite db(":memory:", false);
+            db.setQuery("SELECT ?, ?, ?, ?, ?, ?, ?, ?");
+            db.prepare();
+            sw.start();
+            for(long i = 0; i < rows; ++i) {
+                db.bind(1, static_cast<int>(i));
+                db.bind(2, static_cast<int>(i + 1));
+                db.bind(3, 0.5 * i);
+                db.bind(4, 0.25 * i);
+                db.bind(5, payload_text);
+                db.bind(6, payload_text);
+                db.bind_null(7);
+                db.bind(8, static_cast<int>(i + 2));
+                db.step();
+                db.reset();
+            }
+            sw.stop();
+            return rows;
+        },
+        [](long rows, Stopwatch& sw) {
+            sqlite3* db = capiOpen();
+            sqlite3_stmt* stmt = capiPrepare(db, "SELECT ?, ?, ?, ?, ?, ?, ?, ?");
+            sw.start();
+            for(long i = 0; i < rows; ++i) {
+                sqlite3_bind_int(stmt, 1, static_cast<int>(i));
+                sqlite3_bind_int(stmt, 2, static_cast<int>(i + 1));
+                sqlite3_bind_double(stmt, 3, 0.5 * i);
+                sqlite3_bind_double(stmt, 4, 0.25 * i);
+                sqlite3_bind_text(stmt, 5, payload_text.c_str(), payload_text.length(), SQLITE_TRANSIENT);
+                sqlite3_bind_text(stmt, 6, payload_text.c_str(), payload_text.length(), SQLITE_TRANSIENT);
+                sqlite3_bind_null(stmt, 7);
+                sqlite3_bind_int(stmt, 8, static_cast<int>(i + 2));
+                sqlite3_step(stmt);
+                sqlite3_reset(stmt);
+            }
+            sw.stop();
+            sqlite3_finalize(stmt);
+            sqlite3_close(db);
+            return rows;
+        }});
+
+    // Named parameters, against looking each index up by hand
+    w.push_back(Workload{"bind_named",
+        [](long rows, Stopwatch& sw) {
+            Sqlite db(":memory:", false);
+            db.setQuery("SELECT :id, :val, :score, :txt, :flag, :ref");
+            db.prepare();
+            sw.start();
+            for(long i = 0; i < rows; ++i) {
+                db.bind(":id", static_cast<int>(i));
+                db.bind(":val", static_cast<int>(i + 1));
+                db.bind(":score", 0.5 * i);
+                db.bind(":txt", payload_text);
+                db.bind_null(":flag");
+                db.bind(":ref", static_cast<int>(i + 2));
+                db.step();
+                db.reset();
+            }
+            sw.stop();
+            return rows;
+        },
+        [](long rows, Stopwatch& sw) {
+            sqlite3* db = capiOpen();
+            sqlite3_stmt* stmt = capiPrepare(db, "SELECT :id, :val, :score, :txt, :flag, :ref");
+            sw.start();
+            for(long i = 0; i < rows; ++i) {
+                sqlite3_bind_int(stmt, sqlite3_bind_parameter_index(stmt, ":id"), static_cast<int>(i));
+                sqlite3_bind_int(stmt, sqlite3_bind_parameter_index(stmt, ":val"), static_cast<int>(i + 1));
+                sqlite3_bind_double(stmt, sqlite3_bind_parameter_index(stmt, ":score"), 0.5 * i);
+                sqlite3_bind_text(stmt, sqlite3_bind_parameter_index(stmt, ":txt"), payload_text.c_str(),
+                    payload_text.length(), SQLITE_TRANSIENT);
+                sqlite3_bind_null(stmt, sqlite3_bind_parameter_index(stmt, ":flag"));
+                sqlite3_bind_int(stmt, sqlite3_bind_parameter_index(stmt, ":ref"), static_cast<int>(i + 2));
+                sqlite3_step(stmt);
+                sqlite3_reset(stmt);
+            }
+            sw.stop();
+            sqlite3_finalize(stmt);
+            sqlite3_close(db);
+            return rows;
+        }});
+
+    // A small set of range sums read again and again, served by the result
+    // cache against running each one. Not an overhead, the last column is
+    // how many times faster the cache is.
+    w.push_back(Workload{"cached_range",
+        [](long rows, Stopwatch& sw) {
+            Sqlite db(":memory:", false);
+            wrapperPopulate(db, rows);
+            SqliteResultCache cache(db);
+            long ops = rows / 10;
+            sw.start();
+            for(long i = 0; i < ops; ++i) {
+                long start = i % cached_ranges * 100;
+                sink += cache.fetch("SELECT sum(val) FROM t WHERE id BETWEEN ? AND ? + 99", start, start)->getInt64(0, 0);
+            }
+            sw.stop();
+            return ops;
+        },
+        [](long rows, Stopwatch& sw) {
+            sqlite3* db = capiOpen();
+            capiPopulate(db, rows);
+            sqlite3_stmt* stmt = capiPrepare(db, "SELECT sum(val) FROM t WHERE id BETWEEN ? AND ? + 99");
+            long ops = rows / 10;
+            sw.start();
+            for(long i = 0; i < ops; ++i) {
+                long start = i % cached_ranges * 100;
+                sqlite3_bind_int64(stmt, 1, start);
+                sqlite3_bind_int64(stmt, 2, start);
+                if(sqlite3_step(stmt) == SQLITE_ROW) sink += sqlite3_column_int64(stmt, 0);
+                sqlite3_reset(stmt);
+            }
+            sw.stop();
+            sqlite3_finalize(stmt);
+            sqlite3_close(db);
+            return ops;
+        }, true});
+
+    return w;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    long rows = 100000;
+    if(argc > 1) rows = std::atol(argv[1]);
+    if(rows <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [rows]" << std::endl;
+        return 1;
+    }
+
+    char header[160];
+    std::snprintf(header, sizeof(header), "%-16s %-8s %10s %12s %14s %10s",
+        "workload", "api", "ops", "ns/op", "ops/sec", "overhead");
+    std::cout << header << std::endl;
+    try
+    {
+        std::vector<Workload> w = workloads();
+        for(size_t i = 0; i < w.size(); ++i) {
+            long ops = 0;
+            double capi_sec = run(w[i].capi, rows, ops);
+            report(w[i].name, "capi", ops, capi_sec, 0);
+            double base_ns = capi_sec * 1e9 / ops;
+            double wrapper_sec = run(w[i].wrapper, rows, ops);
+            report(w[i].name, w[i].cached ? "cache" : "wrapper", ops, wrapper_sec, base_ns, w[i].cached);
+        }
+        std::cout << "Values ending in x are the speedup of the result cache over an uncached query" << std::endl;
+    }
+    catch(SqliteException const& e)
+    {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,136 @@
+// Commit latency of the io_uring VFS against the stock unix VFS.
+// Build: g++ -O2 -std=c++11 bench_sqlite3cpp_vfs.cc -lsqlite3 -o bench_sqlite3cpp_vfs
+// Usage: ./bench_sqlite3cpp_vfs [commits] [rows_per_commit] [directory]
+//
+// Each commit inserts rows_per_commit rows into a file database and is timed
+// on its own. Run it on the disk the real databases live on, tmpfs hides
+// the cost of fsync.
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "sqlite3cpp.h"
+#include "sqlite3cpp_vfs.h"
+
+namespace {
+
+typedef std::chrono::steady_clock bench_clock;
+
+struct Mode {
+    const char* journal;
+    const char* synchronous;
+};
+
+const std::string payload_text(200, 't');
+
+void removeDatabase(std::string const& path)
+{
+    std::remove(path.c_str());
+    std::remove((path + "-journal").c_str());
+    std::remove((path + "-wal").c_str());
+    std::remove((path + "-shm").c_str());
+}
+
+// Commit latencies in microseconds, sorted
+std::vector<double> run(std::string const& path, const char* vfs, Mode const& mode, long commits, long rows)
+{
+    removeDatabase(path);
+    std::vector<double> latency;
+    latency.reserve(commits);
+    {
+        Sqlite db(path, false, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, vfs);
+        db.exec(std::string("PRAGMA journal_mode=") + mode.journal);
+        db.exec(std::string("PRAGMA synchronous=") + mode.synchronous);
+        db.exec("CREATE TABLE t(id INTEGER PRIMARY KEY, val INTEGER, txt TEXT)");
+        for(long c = 0; c < commits; ++c) {
+            bench_clock::time_point begin = bench_clock::now();
+            db.exec("BEGIN");
+            db.setQuery("INSERT INTO t(val, txt) VALUES(?, ?)");
+            db.prepare();
+            for(long r = 0; r < rows; ++r) {
+                db.bind(1, static_cast<int>(c * rows + r));
+                db.bind(2, payload_text);
+                db.step();
+                db.reset();
+            }
+            db.exec("COMMIT");
+            latency.push_back(std::chrono::duration<double, std::micro>(bench_clock::now() - begin).count());
+        }
+    }
+    removeDatabase(path);
+    std::sort(latency.begin(), latency.end());
+    return latency;
+}
+
+void report(Mode const& mode, const char* vfs, std::vector<double> const& latency, double base_mean)
+{
+    double sum = 0;
+    for(size_t i = 0; i < latency.size(); ++i) sum += latency[i];
+    double mean = sum / latency.size();
+    double p50 = latency[latency.size() / 2];
+    double p99 = latency[std::min(latency.size() - 1, latency.size() * 99 / 100)];
+    std::string mode_name = std::string(mode.journal) + "/" + mode.synchronous;
+    char line[160];
+    if(base_mean > 0) {
+        std::snprintf(line, sizeof(line), "%-14s %-18s %10.1f %10.1f %10.1f %+9.1f%%",
+            mode_name.c_str(), vfs, mean, p50, p99, (mean - base_mean) * 100.0 / base_mean);
+    } else {
+        std::snprintf(line, sizeof(line), "%-14s %-18s %10.1f %10.1f %10.1f %10s",
+            mode_name.c_str(), vfs, mean, p50, p99, "-");
+    }
+    std::cout << line << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    long commits = argc > 1 ? std::atol(argv[1]) : 500;
+    long rows = argc > 2 ? std::atol(argv[2]) : 100;
+    std::string dir = argc > 3 ? argv[3] : ".";
+    if(commits <= 0 || rows <= 0) {
+        std::cerr << "Usage: " << argv[0] << " [commits] [rows_per_commit] [directory]" << std::endl;
+        return 1;
+    }
+#ifndef SQLITE3CPP_IO_URING
+    std::cerr << "Built without io_uring support" << std::endl;
+    return 1;
+#else
+    SqliteUringVfs::install();
+    if(!SqliteUringVfs::active()) std::cerr << "io_uring unavailable, the VFS falls back to unix" << std::endl;
+
+    const Mode modes[] = {
+        { "DELETE", "FULL" },
+        { "WAL", "FULL" },
+        { "WAL", "NORMAL" },
+    };
+    std::string path = dir + "/bench_sqlite3cpp_vfs.db";
+
+    std::cout << commits << " commits of " << rows << " rows, latency in microseconds" << std::endl;
+    char header[160];
+    std::snprintf(header, sizeof(header), "%-14s %-18s %10s %10s %10s %10s",
+        "mode", "vfs", "mean", "p50", "p99", "change");
+    std::cout << header << std::endl;
+    try
+    {
+        for(size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); ++m) {
+            std::vector<double> stock = run(path, "unix", modes[m], commits, rows);
+            report(modes[m], "unix", stock, 0);
+            double sum = 0;
+            for(size_t i = 0; i < stock.size(); ++i) sum += stock[i];
+            std::vector<double> uring = run(path, SqliteUringVfs::name(), modes[m], commits, rows);
+            report(modes[m], SqliteUringVfs::name(), uring, sum / stock.size());
+        }
+    }
+    catch(SqliteException const& e)
+    {
+        std::cerr << "Exception: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+#endif
+}
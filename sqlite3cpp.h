@@ -1,11 +1,40 @@
 #ifndef SQLITE3CPP_H
 #define SQLITE3CPP_H
 // C++ includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <new>
 #include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
 // Library includes
 #include <sqlite3.h>
+#if defined(__unix__) || defined(__APPLE__)
+#define SQLITE3CPP_POSIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Builds with -fno-exceptions report the error and abort instead of throwing.
+// Such builds should use the non-throwing try*() functions.
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS) || defined(_CPPUNWIND)
+#define SQLITE3CPP_EXCEPTIONS
+#define SQLITE3CPP_THROW(e) throw e
+#else
+#include <cstdlib>
+#define SQLITE3CPP_THROW(e) do { std::cerr << "Sqlite3cpp: " << (e).what() << std::endl; std::abort(); } while(0)
+#endif
 
 
 class SqliteException : public std::exception
@@ -26,6 +55,1156 @@ private:
     std::string msg;
 };
 
+struct SqliteLookasideStats
+{
+    int used;      // Slots currently checked out
+    int peak;      // Most slots checked out at once
+    int hits;      // Allocations served by lookaside
+    int miss_size; // Allocations too large for a slot
+    int miss_full; // Allocations made while every slot was taken
+};
+
+
+// Thrown by step() when a statement is stopped by its deadline or a cancellation
+class SqliteInterruptException : public SqliteException
+{
+public:
+    SqliteInterruptException(int no, const std::string& msg, bool timed_out)
+        :SqliteException(no, msg), timed_out{timed_out} {}
+
+    bool timedOut() {
+        return this->timed_out;
+    }
+private:
+    bool timed_out;
+};
+
+
+// Shared flag which can be set from any thread to stop the statements of the
+// connections it is attached to. Copies refer to the same flag.
+class CancellationToken
+{
+public:
+    CancellationToken()
+        :flag{std::make_shared<std::atomic<bool>>(false)} {}
+
+    void cancel() {
+        this->flag->store(true);
+    }
+
+    bool isCancelled() const {
+        return this->flag->load();
+    }
+
+    void reset() {
+        this->flag->store(false);
+    }
+private:
+    std::shared_ptr<std::atomic<bool>> flag;
+};
+
+
+// Outcome of a non-throwing call. Only the SQLite code and a static context
+// are stored, the message is formatted when asked for.
+class SqliteStatus
+{
+public:
+    SqliteStatus() noexcept
+        :rc{SQLITE_OK}, ctx{""} {}
+    SqliteStatus(int rc, const char* context) noexcept
+        :rc{rc}, ctx{context} {}
+
+    explicit operator bool() const noexcept {
+        return this->rc == SQLITE_OK || this->rc == SQLITE_ROW || this->rc == SQLITE_DONE;
+    }
+
+    int code() const noexcept {
+        return this->rc;
+    }
+
+    const char* context() const noexcept {
+        return this->ctx;
+    }
+
+    std::string message() const {
+        if(*this) return "";
+        if(this->rc == -1) return this->ctx;
+        return std::string(this->ctx) + ": " + sqlite3_errstr(this->rc);
+    }
+private:
+    int rc;
+    const char* ctx;
+};
+
+template<typename T>
+class SqliteResult : public SqliteStatus
+{
+public:
+    SqliteResult(T value) noexcept
+        :SqliteStatus(), val(value) {}
+    SqliteResult(int rc, const char* context) noexcept
+        :SqliteStatus(rc, context), val() {}
+
+    T const& value() const noexcept {
+        return this->val;
+    }
+private:
+    T val;
+};
+
+
+// Stream buffer over an incremental blob handle. Data moves between SQLite
+// and the stream in chunks of a fixed size, so a blob of any size is never
+// held in memory as a whole. A blob can not change size through the handle,
+// writing past its end fails the stream.
+class BlobStreamBuf : public std::streambuf
+{
+public:
+    BlobStreamBuf(sqlite3_blob* blob, size_t chunk_size)
+        :blob{blob}, buffer(chunk_size), offset{0} {}
+    ~BlobStreamBuf() {
+        close();
+    }
+    BlobStreamBuf(BlobStreamBuf const& copy) = delete;
+    BlobStreamBuf &operator = (const BlobStreamBuf &copy) = delete;
+
+    int size() const {
+        return this->blob ? sqlite3_blob_bytes(this->blob) : 0;
+    }
+
+    // Moves the handle to the same column of another row and rewinds
+    int reopen(sqlite3_int64 rowid) {
+        sync();
+        clearAreas(0);
+        return sqlite3_blob_reopen(this->blob, rowid);
+    }
+
+    int close() {
+        if(!this->blob) return SQLITE_OK;
+        sync();
+        int rc = sqlite3_blob_close(this->blob);
+        this->blob = NULL;
+        return rc;
+    }
+
+protected:
+    int_type underflow() override {
+        int pos = position();
+        if(flush() != 0) return traits_type::eof();
+        int n = chunk(pos);
+        if(n <= 0) return traits_type::eof();
+        if(sqlite3_blob_read(this->blob, this->buffer.data(), n, pos) != SQLITE_OK) {
+            return traits_type::eof();
+        }
+        this->offset = pos;
+        setg(this->buffer.data(), this->buffer.data(), this->buffer.data() + n);
+        return traits_type::to_int_type(this->buffer[0]);
+    }
+
+    int_type overflow(int_type c) override {
+        if(flush() != 0) return traits_type::eof();
+        int pos = position();
+        int n = chunk(pos);
+        clearAreas(pos);
+        if(traits_type::eq_int_type(c, traits_type::eof())) return traits_type::not_eof(c);
+        if(n <= 0) return traits_type::eof();
+        setp(this->buffer.data(), this->buffer.data() + n);
+        *pptr() = traits_type::to_char_type(c);
+        pbump(1);
+        return c;
+    }
+
+    int sync() override {
+        return flush();
+    }
+
+    pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode) override {
+        off_type base = dir == std::ios_base::beg ? 0 : dir == std::ios_base::end ? size() : position();
+        return seekpos(base + off, std::ios_base::in | std::ios_base::out);
+    }
+
+    pos_type seekpos(pos_type pos, std::ios_base::openmode) override {
+        if(flush() != 0 || pos < 0 || pos > size()) return pos_type(off_type(-1));
+        clearAreas(static_cast<int>(pos));
+        return pos;
+    }
+
+private:
+    // Blob offset of the next character to get or put
+    int position() const {
+        if(pbase()) return this->offset + static_cast<int>(pptr() - pbase());
+        if(eback()) return this->offset + static_cast<int>(gptr() - eback());
+        return this->offset;
+    }
+
+    int chunk(int pos) const {
+        int left = size() - pos;
+        int max = static_cast<int>(this->buffer.size());
+        return left < max ? left : max;
+    }
+
+    void clearAreas(int pos) {
+        setg(NULL, NULL, NULL);
+        setp(NULL, NULL);
+        this->offset = pos;
+    }
+
+    // Writes out the put area, 0 on success
+    int flush() {
+        if(!pbase() || pptr() == pbase()) {
+            if(pbase()) clearAreas(position());
+            return 0;
+        }
+        int n = static_cast<int>(pptr() - pbase());
+        int rc = sqlite3_blob_write(this->blob, pbase(), n, this->offset);
+        clearAreas(this->offset + n);
+        return rc == SQLITE_OK ? 0 : -1;
+    }
+
+    sqlite3_blob* blob;
+    std::vector<char> buffer;
+    int offset;
+};
+
+
+// Reads and writes a single blob value as a std::iostream, see
+// Sqlite::openBlob(). reopen() steps to another row for sequential scans.
+class BlobStream : public std::iostream
+{
+public:
+    BlobStream(sqlite3_blob* blob, size_t chunk_size)
+        :std::iostream(NULL), buf(blob, chunk_size)
+    {
+        rdbuf(&this->buf);
+    }
+
+    int size() const {
+        return this->buf.size();
+    }
+
+    void reopen(sqlite3_int64 rowid) {
+        int rc = this->buf.reopen(rowid);
+        if(rc != SQLITE_OK) {
+            SqliteException e(rc, "Could not reopen blob: " + std::string(sqlite3_errstr(rc)));
+            SQLITE3CPP_THROW(e);
+        }
+        clear();
+    }
+
+    void close() {
+        flush();
+        this->buf.close();
+    }
+private:
+    BlobStreamBuf buf;
+};
+
+
+
+// Conversion between C++ types and SQL values for user defined functions
+// and typed queries. Each argument is decoded by the conversion of its
+// declared type, SQL NULL reads as 0, 0.0 or an empty string.
+// std::vector<char> is a BLOB and sqlite3_value* passes the value through
+// untouched.
+template<typename T, typename Enable = void>
+struct SqliteValue;
+
+template<typename T>
+struct SqliteValue<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type>
+{
+    static T get(sqlite3_value* v) { return static_cast<T>(sqlite3_value_int64(v)); }
+    static void result(sqlite3_context* ctx, T t) { sqlite3_result_int64(ctx, static_cast<sqlite3_int64>(t)); }
+    static int bind(sqlite3_stmt* stmt, int i, T t) { return sqlite3_bind_int64(stmt, i, static_cast<sqlite3_int64>(t)); }
+};
+
+template<>
+struct SqliteValue<bool>
+{
+    static bool get(sqlite3_value* v) { return sqlite3_value_int(v) != 0; }
+    static void result(sqlite3_context* ctx, bool b) { sqlite3_result_int(ctx, b ? 1 : 0); }
+    static int bind(sqlite3_stmt* stmt, int i, bool b) { return sqlite3_bind_int(stmt, i, b ? 1 : 0); }
+};
+
+template<typename T>
+struct SqliteValue<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+    static T get(sqlite3_value* v) { return static_cast<T>(sqlite3_value_double(v)); }
+    static void result(sqlite3_context* ctx, T d) { sqlite3_result_double(ctx, static_cast<double>(d)); }
+    static int bind(sqlite3_stmt* stmt, int i, T d) { return sqlite3_bind_double(stmt, i, static_cast<double>(d)); }
+};
+
+template<>
+struct SqliteValue<std::string>
+{
+    static std::string get(sqlite3_value* v) {
+        const unsigned char* text = sqlite3_value_text(v);
+        return text ? std::string(reinterpret_cast<const char*>(text), sqlite3_value_bytes(v)) : std::string();
+    }
+    static void result(sqlite3_context* ctx, std::string const& s) {
+        sqlite3_result_text(ctx, s.data(), static_cast<int>(s.size()), SQLITE_TRANSIENT);
+    }
+    static int bind(sqlite3_stmt* stmt, int i, std::string const& s) {
+        return sqlite3_bind_text(stmt, i, s.data(), static_cast<int>(s.size()), SQLITE_TRANSIENT);
+    }
+};
+
+template<>
+struct SqliteValue<std::vector<char>>
+{
+    static std::vector<char> get(sqlite3_value* v) {
+        const char* blob = static_cast<const char*>(sqlite3_value_blob(v));
+        return blob ? std::vector<char>(blob, blob + sqlite3_value_bytes(v)) : std::vector<char>();
+    }
+    static void result(sqlite3_context* ctx, std::vector<char> const& b) {
+        sqlite3_result_blob(ctx, b.data(), static_cast<int>(b.size()), SQLITE_TRANSIENT);
+    }
+    // An empty vector may have no data(), which would bind NULL
+    static int bind(sqlite3_stmt* stmt, int i, std::vector<char> const& b) {
+        return b.empty() ? sqlite3_bind_zeroblob(stmt, i, 0)
+            : sqlite3_bind_blob(stmt, i, b.data(), static_cast<int>(b.size()), SQLITE_TRANSIENT);
+    }
+};
+
+template<>
+struct SqliteValue<sqlite3_value*>
+{
+    static sqlite3_value* get(sqlite3_value* v) { return v; }
+    static void result(sqlite3_context* ctx, sqlite3_value* v) { sqlite3_result_value(ctx, v); }
+    static int bind(sqlite3_stmt* stmt, int i, sqlite3_value* v) { return sqlite3_bind_value(stmt, i, v); }
+};
+
+
+// Argument and result types of a function, function pointer or lambda
+template<typename F>
+struct SqliteCallable : SqliteCallable<decltype(&F::operator())> {};
+
+template<typename R, typename... A>
+struct SqliteCallable<R(A...)>
+{
+    typedef R result;
+    typedef std::tuple<typename std::decay<A>::type...> arguments;
+    static const int arity = sizeof...(A);
+};
+
+template<typename R, typename... A>
+struct SqliteCallable<R(*)(A...)> : SqliteCallable<R(A...)> {};
+
+template<typename C, typename R, typename... A>
+struct SqliteCallable<R(C::*)(A...)> : SqliteCallable<R(A...)> {};
+
+template<typename C, typename R, typename... A>
+struct SqliteCallable<R(C::*)(A...) const> : SqliteCallable<R(A...)> {};
+
+// std::index_sequence for C++11
+template<size_t... I>
+struct SqliteIndices {};
+
+template<size_t N, size_t... I>
+struct SqliteMakeIndices : SqliteMakeIndices<N - 1, N - 1, I...> {};
+
+template<size_t... I>
+struct SqliteMakeIndices<0, I...>
+{
+    typedef SqliteIndices<I...> type;
+};
+
+
+// Trampoline between sqlite3_create_function_v2 and a C++ callable. The
+// argument conversions are picked at compile time from the signature of F.
+template<typename F>
+struct SqliteScalarFunction
+{
+    typedef SqliteCallable<F> signature;
+    typedef typename signature::result result_type;
+    typedef typename signature::arguments argument_types;
+
+    static void call(sqlite3_context* ctx, int, sqlite3_value** argv) {
+        F* f = static_cast<F*>(sqlite3_user_data(ctx));
+#ifdef SQLITE3CPP_EXCEPTIONS
+        try {
+            invoke(*f, ctx, argv, typename SqliteMakeIndices<signature::arity>::type(),
+                std::is_void<result_type>());
+        }
+        catch(std::exception const& e) {
+            sqlite3_result_error(ctx, e.what(), -1);
+        }
+#else
+        invoke(*f, ctx, argv, typename SqliteMakeIndices<signature::arity>::type(),
+            std::is_void<result_type>());
+#endif
+    }
+
+    static void destroy(void* f) {
+        delete static_cast<F*>(f);
+    }
+
+private:
+    template<size_t... I>
+    static void invoke(F& f, sqlite3_context* ctx, sqlite3_value** argv, SqliteIndices<I...>, std::false_type) {
+        SqliteValue<typename std::decay<result_type>::type>::result(ctx,
+            f(SqliteValue<typename std::tuple_element<I, argument_types>::type>::get(argv[I])...));
+    }
+
+    // A void function returns NULL
+    template<size_t... I>
+    static void invoke(F& f, sqlite3_context* ctx, sqlite3_value** argv, SqliteIndices<I...>, std::true_type) {
+        f(SqliteValue<typename std::tuple_element<I, argument_types>::type>::get(argv[I])...);
+        sqlite3_result_null(ctx);
+    }
+};
+
+
+// Detects the optional window function members of an aggregate class
+template<typename A>
+struct SqliteIsWindow
+{
+    template<typename U> static std::true_type test(decltype(&U::inverse), decltype(&U::value));
+    template<typename U> static std::false_type test(...);
+    static const bool value = decltype(test<A>(0, 0))::value;
+};
+
+// Trampolines between sqlite3_create_window_function and an aggregate class
+// A. The A object is constructed in place inside sqlite3_aggregate_context,
+// so the engine owns its memory and no allocation is made per group. A has
+// to be default constructible and needs:
+//   void step(Args...)     called for every row
+//   R final()              the result of the group
+// and, to be usable as a window function:
+//   void inverse(Args...)  undoes step() for a row leaving the window
+//   R value()              the current result without ending the group
+template<typename A>
+struct SqliteAggregateFunction
+{
+    typedef SqliteCallable<decltype(&A::step)> signature;
+    typedef typename signature::arguments argument_types;
+
+    static_assert(std::alignment_of<A>::value <= 8, "SQLite aligns aggregate state to 8 bytes");
+
+    static void step(sqlite3_context* ctx, int, sqlite3_value** argv) {
+        A* a = state(ctx);
+        if(!a) return;
+        guard(ctx, [&]() { call(*a, &A::step, argv, typename SqliteMakeIndices<signature::arity>::type()); });
+    }
+
+    static void inverse(sqlite3_context* ctx, int, sqlite3_value** argv) {
+        A* a = state(ctx);
+        if(!a) return;
+        guard(ctx, [&]() { call(*a, &A::inverse, argv, typename SqliteMakeIndices<signature::arity>::type()); });
+    }
+
+    static void value(sqlite3_context* ctx) {
+        A* a = state(ctx);
+        if(!a) return;
+        guard(ctx, [&]() { result(ctx, a->value()); });
+    }
+
+    static void final(sqlite3_context* ctx) {
+        Slot* slot = static_cast<Slot*>(sqlite3_aggregate_context(ctx, 0));
+        if(slot && slot->constructed) {
+            A* a = reinterpret_cast<A*>(&slot->storage);
+            guard(ctx, [&]() { result(ctx, a->final()); });
+            a->~A();
+            slot->constructed = false;
+            return;
+        }
+        // No rows: the result of a fresh object
+        A empty;
+        guard(ctx, [&]() { result(ctx, empty.final()); });
+    }
+
+private:
+    struct Slot
+    {
+        typename std::aligned_storage<sizeof(A), std::alignment_of<A>::value>::type storage;
+        bool constructed; // SQLite hands out the context zeroed
+    };
+
+    static A* state(sqlite3_context* ctx) {
+        Slot* slot = static_cast<Slot*>(sqlite3_aggregate_context(ctx, sizeof(Slot)));
+        if(!slot) {
+            sqlite3_result_error_nomem(ctx);
+            return NULL;
+        }
+        if(!slot->constructed) {
+            new (&slot->storage) A();
+            slot->constructed = true;
+        }
+        return reinterpret_cast<A*>(&slot->storage);
+    }
+
+    template<typename M, size_t... I>
+    static void call(A& a, M method, sqlite3_value** argv, SqliteIndices<I...>) {
+        (a.*method)(SqliteValue<typename std::tuple_element<I, argument_types>::type>::get(argv[I])...);
+    }
+
+    template<typename R>
+    static void result(sqlite3_context* ctx, R const& r) {
+        SqliteValue<typename std::decay<R>::type>::result(ctx, r);
+    }
+
+    // An exception thrown by A becomes an SQL error
+    template<typename F>
+    static void guard(sqlite3_context* ctx, F f) {
+#ifdef SQLITE3CPP_EXCEPTIONS
+        try {
+            f();
+        }
+        catch(std::exception const& e) {
+            sqlite3_result_error(ctx, e.what(), -1);
+        }
+#else
+        (void)ctx;
+        f();
+#endif
+    }
+};
+
+
+// Comparators for Sqlite::create_collation(). Only ASCII letters fold and
+// only ASCII digits count as numbers, any other byte compares by value,
+// which for UTF-8 is code point order. No locale is consulted, so the order
+// is the same everywhere and safe to build indexes on.
+struct SqliteCollation
+{
+    // memcmp order, the same as the built-in BINARY
+    static int binary(const char* a, int na, const char* b, int nb) {
+        int c = std::memcmp(a, b, static_cast<size_t>(na < nb ? na : nb));
+        if(c) return c < 0 ? -1 : 1;
+        return na < nb ? -1 : (na > nb ? 1 : 0);
+    }
+
+    // Case-insensitive for A-Z, strings differing only in case are equal
+    static int asciiNoCase(const char* a, int na, const char* b, int nb) {
+        int n = na < nb ? na : nb;
+        int i = 0;
+        // Equal bytes stay equal after folding, so skip them a word at a time
+        for(; i + 8 <= n; i += 8) {
+            uint64_t wa, wb;
+            std::memcpy(&wa, a + i, 8);
+            std::memcpy(&wb, b + i, 8);
+            if(wa != wb) break;
+        }
+        for(; i < n; ++i) {
+            int c = fold(a[i]) - fold(b[i]);
+            if(c) return c < 0 ? -1 : 1;
+        }
+        return na < nb ? -1 : (na > nb ? 1 : 0);
+    }
+
+    // Natural order: runs of digits compare as numbers, so "file9" sorts
+    // before "file10", and the text in between as in asciiNoCase. Strings
+    // that are still equal, like "a01" and "A1", fall back to binary so
+    // distinct strings never compare equal.
+    static int natural(const char* a, int na, const char* b, int nb) {
+        int i = 0, j = 0;
+        while(i < na && j < nb) {
+            if(isDigit(a[i]) && isDigit(b[j])) {
+                int za = i, zb = j;
+                while(za < na && a[za] == '0') ++za;
+                while(zb < nb && b[zb] == '0') ++zb;
+                int ea = za, eb = zb;
+                while(ea < na && isDigit(a[ea])) ++ea;
+                while(eb < nb && isDigit(b[eb])) ++eb;
+                // Without leading zeros the longer number is the larger one
+                if(ea - za != eb - zb) return ea - za < eb - zb ? -1 : 1;
+                int c = std::memcmp(a + za, b + zb, static_cast<size_t>(ea - za));
+                if(c) return c < 0 ? -1 : 1;
+                i = ea;
+                j = eb;
+                continue;
+            }
+            int c = fold(a[i]) - fold(b[j]);
+            if(c) return c < 0 ? -1 : 1;
+            ++i;
+            ++j;
+        }
+        if(i < na) return 1;
+        if(j < nb) return -1;
+        return binary(a, na, b, nb);
+    }
+
+private:
+    static int fold(char c) {
+        unsigned u = static_cast<unsigned char>(c);
+        return static_cast<int>(u - 'A' < 26u ? u + ('a' - 'A') : u);
+    }
+
+    static bool isDigit(char c) {
+        return static_cast<unsigned>(static_cast<unsigned char>(c)) - '0' < 10u;
+    }
+};
+
+
+// Trampoline between sqlite3_create_collation_v2 and a C++ comparator with
+// the signature int(const char* a, int a_size, const char* b, int b_size),
+// returning a negative, zero or positive value like memcmp. The strings are
+// UTF-8 and not terminated.
+template<typename F>
+struct SqliteCollationFunction
+{
+    static int compare(void* data, int na, const void* a, int nb, const void* b) {
+        F* f = static_cast<F*>(data);
+#ifdef SQLITE3CPP_EXCEPTIONS
+        // A collation cannot report errors, binary order keeps sorting sane
+        try {
+            return (*f)(static_cast<const char*>(a), na, static_cast<const char*>(b), nb);
+        }
+        catch(...) {
+            return SqliteCollation::binary(static_cast<const char*>(a), na, static_cast<const char*>(b), nb);
+        }
+#else
+        return (*f)(static_cast<const char*>(a), na, static_cast<const char*>(b), nb);
+#endif
+    }
+
+    static void destroy(void* f) {
+        delete static_cast<F*>(f);
+    }
+};
+
+
+// Reads the current row of a statement as T, either one SqliteValue type
+// from the first column or a std::tuple with one element per column
+template<typename T>
+struct SqliteRow
+{
+    static T read(sqlite3_stmt* stmt) {
+        return SqliteValue<T>::get(sqlite3_column_value(stmt, 0));
+    }
+};
+
+template<typename... T>
+struct SqliteRow<std::tuple<T...>>
+{
+    static std::tuple<T...> read(sqlite3_stmt* stmt) {
+        return read(stmt, typename SqliteMakeIndices<sizeof...(T)>::type());
+    }
+
+private:
+    template<size_t... I>
+    static std::tuple<T...> read(sqlite3_stmt* stmt, SqliteIndices<I...>) {
+        return std::tuple<T...>(SqliteValue<T>::get(sqlite3_column_value(stmt, static_cast<int>(I)))...);
+    }
+};
+
+
+// Counts the parameters of SQL text at compile time, the number
+// sqlite3_bind_parameter_count() reports once it is prepared. "?" takes the
+// next index, "?NNN" index NNN, and ":name", "@name" and "$name" the next
+// index at their first use. Quoted text and comments are skipped.
+//
+// C++11 constexpr functions can only recurse. Tokens are taken in halves
+// and quotes and comment ends are searched in halves, so the depth grows
+// with the log of the length and long queries stay within compiler limits.
+struct SqlitePlaceholders
+{
+    static constexpr int count(const char* sql) {
+        return scan(sql, Scan{0, 0}, all).last;
+    }
+
+private:
+    // Upper bound on tokens and characters, halving it takes a few levels
+    static constexpr int all = 1 << 24;
+
+    struct Scan
+    {
+        int pos;
+        int last; // Highest parameter index so far
+    };
+
+    struct Find
+    {
+        int pos;
+        bool found;
+    };
+
+    static constexpr bool isDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    static constexpr bool isWord(char c) {
+        return isDigit(c) || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '$'
+            || static_cast<unsigned char>(c) >= 0x80;
+    }
+
+    static constexpr bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+    }
+
+    static constexpr bool isNamed(const char* s, int i) {
+        return (s[i] == ':' || s[i] == '@' || s[i] == '$') && isWord(s[i + 1]);
+    }
+
+    static constexpr int skipWord(const char* s, int i) {
+        return isWord(s[i]) ? skipWord(s, i + 1) : i;
+    }
+
+    static constexpr int skipDigits(const char* s, int i) {
+        return isDigit(s[i]) ? skipDigits(s, i + 1) : i;
+    }
+
+    static constexpr int skipSpace(const char* s, int i) {
+        return isSpace(s[i]) ? skipSpace(s, i + 1) : i;
+    }
+
+    // First position in [i, i + n) holding c or the terminator, else i + n.
+    // The right half is only read when the left one has neither.
+    static constexpr int find(const char* s, int i, int n, char c) {
+        return n == 1 ? (s[i] == '\0' || s[i] == c ? i : i + 1)
+            : findRight(s, find(s, i, n / 2, c), i + n / 2, n - n / 2, c);
+    }
+
+    static constexpr int findRight(const char* s, int left, int mid, int n, char c) {
+        return left < mid ? left : find(s, mid, n, c);
+    }
+
+    // Past the quote that closes at or after i, a doubled quote is part of the text
+    static constexpr int skipQuoted(const char* s, int i, char quote) {
+        return closeQuote(s, find(s, i, all, quote), quote);
+    }
+
+    static constexpr int closeQuote(const char* s, int i, char quote) {
+        return s[i] == '\0' ? i : quote != ']' && s[i + 1] == quote ? skipQuoted(s, i + 2, quote) : i + 1;
+    }
+
+    static constexpr int skipBlock(const char* s, int i) {
+        return closeBlock(s, find(s, i, all, '*'));
+    }
+
+    static constexpr int closeBlock(const char* s, int i) {
+        return s[i] == '\0' ? i : s[i + 1] == '/' ? i + 2 : skipBlock(s, i + 1);
+    }
+
+    // End of the token that starts at i
+    static constexpr int skip(const char* s, int i) {
+        return s[i] == '\'' || s[i] == '"' || s[i] == '`' ? skipQuoted(s, i + 1, s[i])
+            : s[i] == '[' ? skipQuoted(s, i + 1, ']')
+            : s[i] == '-' && s[i + 1] == '-' ? find(s, i + 2, all, '\n')
+            : s[i] == '/' && s[i + 1] == '*' ? skipBlock(s, i + 2)
+            : s[i] == '?' ? skipDigits(s, i + 1)
+            : isNamed(s, i) ? skipWord(s, i + 1)
+            : isWord(s[i]) ? skipWord(s, i)
+            : isSpace(s[i]) ? skipSpace(s, i)
+            : i + 1;
+    }
+
+    static constexpr int number(const char* s, int i, int value) {
+        return isDigit(s[i]) ? number(s, i + 1, value * 10 + (s[i] - '0')) : value;
+    }
+
+    static constexpr bool same(const char* s, int a, int b, int n) {
+        return n == 0 || (s[a] == s[b] && same(s, a + 1, b + 1, n - 1));
+    }
+
+    // Whether one of the next tokens before end is a parameter with the
+    // name at [name, name + n)
+    static constexpr Find seen(const char* s, Find at, int end, int name, int n, int tokens) {
+        return at.found || at.pos >= end ? at
+            : tokens == 1 ? Find{skip(s, at.pos), isNamed(s, at.pos) && skip(s, at.pos) - at.pos == n
+                && same(s, at.pos, name, n)}
+            : seen(s, seen(s, at, end, name, n, tokens / 2), end, name, n, tokens - tokens / 2);
+    }
+
+    // Parameter index after the token at i
+    static constexpr int next(const char* s, int i, int last) {
+        return s[i] == '?' ? (!isDigit(s[i + 1]) ? last + 1 : number(s, i + 1, 0) > last ? number(s, i + 1, 0) : last)
+            : isNamed(s, i) ? (seen(s, Find{0, false}, i, i, skip(s, i) - i, all).found ? last : last + 1)
+            : last;
+    }
+
+    static constexpr Scan scan(const char* s, Scan at, int tokens) {
+        return s[at.pos] == '\0' ? at
+            : tokens == 1 ? Scan{skip(s, at.pos), next(s, at.pos, at.last)}
+            : scan(s, scan(s, at, tokens / 2), tokens - tokens / 2);
+    }
+};
+
+
+// 64-bit FNV-1a of text, usable in constant expressions. Long text is
+// hashed in halves so the recursion depth grows with the log of its length.
+struct SqliteHash
+{
+    static constexpr uint64_t of(const char* s, size_t begin, size_t end) {
+        return end - begin <= 16 ? fnv(s, begin, end, 14695981039346656037ULL)
+            : mix(of(s, begin, begin + (end - begin) / 2), of(s, begin + (end - begin) / 2, end));
+    }
+
+private:
+    static constexpr uint64_t fnv(const char* s, size_t i, size_t end, uint64_t h) {
+        return i == end ? h : fnv(s, i + 1, end, (h ^ static_cast<unsigned char>(s[i])) * 1099511628211ULL);
+    }
+
+    static constexpr uint64_t mix(uint64_t a, uint64_t b) {
+        return a ^ (b + 0x9e3779b97f4a7c15ULL + (a << 6) + (a >> 2));
+    }
+};
+
+
+// Keeps a parameter pack out of template argument deduction
+template<typename T>
+struct SqliteIdentity
+{
+    typedef T type;
+};
+
+
+// A statement from a string literal whose argument and row types are part
+// of its type, run with Sqlite::run():
+//
+//   static constexpr SqliteQuery<std::tuple<int64_t, std::string>(double)> best(
+//       "SELECT id, name FROM people WHERE score > ?");
+//   std::vector<std::tuple<int64_t, std::string>> rows = db.run(best, 2.5);
+//
+// R is a std::tuple for several columns, one SqliteValue type for the first
+// column, or void for statements without rows. When the query is declared
+// constexpr, placeholders that do not match Args fail to compile; otherwise
+// the constructor throws. Each connection prepares a query once and finds
+// it again by the hash computed here.
+template<typename Signature>
+class SqliteQuery;
+
+template<typename R, typename... Args>
+class SqliteQuery<R(Args...)>
+{
+public:
+    typedef R result_type;
+    static constexpr int arity = sizeof...(Args);
+
+    template<size_t N>
+    constexpr SqliteQuery(const char (&sql)[N])
+        :text{SqlitePlaceholders::count(sql) == arity ? sql : placeholderMismatch(sql)},
+        length{N - 1}, hash{SqliteHash::of(sql, 0, N - 1)} {}
+
+    constexpr const char* sql() const { return this->text; }
+    constexpr size_t size() const { return this->length; }
+    constexpr uint64_t key() const { return this->hash; }
+
+private:
+    // Not constexpr, so reaching it while checking a constexpr query is the
+    // compile error
+    static const char* placeholderMismatch(const char* sql) {
+        SqliteException e(SQLITE_RANGE, "Placeholders of '" + std::string(sql) + "' do not match its arguments");
+        SQLITE3CPP_THROW(e);
+        return sql;
+    }
+
+    const char* text;
+    size_t length;
+    uint64_t hash;
+};
+
+template<typename R, typename... Args>
+constexpr int SqliteQuery<R(Args...)>::arity;
+
+
+// Binds the fields of a T to the parameters of a statement by name, with
+// Sqlite::bind(binding, value). A field named "id" goes to :id, @id or $id;
+// fields the statement has no parameter for are left out, so one binding
+// serves both an INSERT and an UPDATE of T.
+//
+//   SqliteBinding<Person> fields;
+//   fields.field("id", &Person::id).field("name", &Person::name);
+//   db.setQuery("UPDATE people SET name = :name WHERE id = :id");
+//   db.prepare();
+//   db.bind(fields, person);
+//
+// Names are matched once per prepared statement, after that binding costs
+// no string comparisons.
+template<typename T>
+class SqliteBinding
+{
+public:
+    SqliteBinding()
+        :statement{0} {}
+
+    // The field type has to be one SqliteValue can convert
+    template<typename F>
+    SqliteBinding& field(std::string const& name, F T::* member) {
+        Field f;
+        f.name = name;
+        f.index = 0;
+        f.bind = [member](sqlite3_stmt* stmt, int index, T const& value) {
+            return SqliteValue<F>::bind(stmt, index, value.*member);
+        };
+        this->fields.push_back(f);
+        this->statement = 0;
+        return *this;
+    }
+
+private:
+    friend class Sqlite;
+
+    struct Field
+    {
+        std::string name;
+        int index; // Parameter index in the resolved statement, 0 for none
+        std::function<int(sqlite3_stmt*, int, T const&)> bind;
+    };
+
+    void resolve(sqlite3_stmt* stmt, uint64_t id) noexcept {
+        int count = sqlite3_bind_parameter_count(stmt);
+        for(size_t f = 0; f < this->fields.size(); ++f) {
+            this->fields[f].index = 0;
+            for(int i = 1; i <= count; ++i) {
+                // Anonymous parameters have no name, the rest start with the prefix
+                const char* name = sqlite3_bind_parameter_name(stmt, i);
+                if(name && std::strcmp(name + 1, this->fields[f].name.c_str()) == 0) {
+                    this->fields[f].index = i;
+                    break;
+                }
+            }
+        }
+        this->statement = id;
+    }
+
+    int apply(sqlite3_stmt* stmt, T const& value) const {
+        for(size_t f = 0; f < this->fields.size(); ++f) {
+            if(!this->fields[f].index) continue;
+            int rc = this->fields[f].bind(stmt, this->fields[f].index, value);
+            if(rc != SQLITE_OK) return rc;
+        }
+        return SQLITE_OK;
+    }
+
+    std::vector<Field> fields;
+    uint64_t statement; // Id of the statement the indexes belong to
+};
+
+
+#ifdef SQLITE_ENABLE_SNAPSHOT
+// A point in the WAL history of a database, taken with
+// Sqlite::beginSnapshot() and pinned by other connections with
+// Sqlite::openSnapshot(). Copies share the handle, which is freed with the
+// last one.
+class SqliteSnapshot
+{
+public:
+    SqliteSnapshot() {}
+
+    explicit operator bool() const {
+        return static_cast<bool>(this->snap);
+    }
+
+    // Negative if this snapshot is older than other, positive if newer.
+    // Only meaningful for snapshots of the same database file.
+    int compare(SqliteSnapshot const& other) const {
+        return sqlite3_snapshot_cmp(this->snap.get(), other.snap.get());
+    }
+
+    sqlite3_snapshot* get() const {
+        return this->snap.get();
+    }
+private:
+    friend class Sqlite;
+    explicit SqliteSnapshot(sqlite3_snapshot* s)
+        :snap{s, sqlite3_snapshot_free} {}
+
+    std::shared_ptr<sqlite3_snapshot> snap;
+};
+#endif
+
+
+// The values bound by Sqlite::bind_array(). SQLite owns the copy and frees it
+// with the statement binding, so the caller's container may go away at once.
+struct SqliteArray
+{
+    int type = SQLITE_NULL; // SQLITE_INTEGER, SQLITE_FLOAT or SQLITE_TEXT
+    std::vector<sqlite3_int64> integers;
+    std::vector<double> reals;
+    std::vector<std::string> texts;
+
+    // Pointer type checked by sqlite3_value_pointer(), so carray() never
+    // reads a pointer some other extension bound
+    static const char* pointerType() { return "sqlite3cpp-array"; }
+
+    template<typename T>
+    typename std::enable_if<std::is_integral<T>::value>::type add(T v) {
+        this->type = SQLITE_INTEGER;
+        this->integers.push_back(static_cast<sqlite3_int64>(v));
+    }
+    template<typename T>
+    typename std::enable_if<std::is_floating_point<T>::value>::type add(T v) {
+        this->type = SQLITE_FLOAT;
+        this->reals.push_back(static_cast<double>(v));
+    }
+    void add(std::string const& v) {
+        this->type = SQLITE_TEXT;
+        this->texts.push_back(v);
+    }
+    void add(const char* v) {
+        add(std::string(v));
+    }
+
+    size_t size() const {
+        return this->integers.size() + this->reals.size() + this->texts.size();
+    }
+
+    static void destroy(void* array) {
+        delete static_cast<SqliteArray*>(array);
+    }
+
+    // Binds a copy of count values to parameter column of stmt, or returns
+    // SQLITE_NOMEM if the copy can not be made
+    template<typename T>
+    static int bind(sqlite3_stmt* stmt, int column, const T* values, size_t count) noexcept {
+        std::unique_ptr<SqliteArray> array;
+#ifdef SQLITE3CPP_EXCEPTIONS
+        try {
+            array.reset(new SqliteArray());
+            for(size_t i = 0; i < count; ++i) array->add(values[i]);
+        } catch(std::exception const&) {
+            return SQLITE_NOMEM;
+        }
+#else
+        array.reset(new SqliteArray());
+        for(size_t i = 0; i < count; ++i) array->add(values[i]);
+#endif
+        // SQLite calls destroy() even when binding fails
+        return sqlite3_bind_pointer(stmt, column, array.release(), pointerType(), &SqliteArray::destroy);
+    }
+};
+
+
+// The carray(?) table-valued function every connection gets: one row per
+// element of the array bound to its argument, in order, in the column value.
+// A prepared "WHERE id IN carray(?)" then takes lists of any length without
+// building SQL text.
+class SqliteArrayTable
+{
+public:
+    static const char* name() { return "carray"; }
+
+    static int registerModule(sqlite3* db) {
+        return sqlite3_create_module_v2(db, name(), module(), NULL, NULL);
+    }
+
+private:
+    struct Cursor
+    {
+        sqlite3_vtab_cursor base;
+        const SqliteArray* array;
+        size_t pos;
+    };
+
+    // Columns of the declared table
+    static const int value_column = 0;
+    static const int pointer_column = 1;
+
+    // Zeroed first, the module has more members than one SQLite version knows
+    static sqlite3_module* module() {
+        static sqlite3_module m = []() {
+            sqlite3_module methods;
+            std::memset(&methods, 0, sizeof(methods));
+            // No xCreate makes the table eponymous-only
+            methods.xConnect = &SqliteArrayTable::xConnect;
+            methods.xBestIndex = &SqliteArrayTable::xBestIndex;
+            methods.xDisconnect = &SqliteArrayTable::xDisconnect;
+            methods.xOpen = &SqliteArrayTable::xOpen;
+            methods.xClose = &SqliteArrayTable::xClose;
+            methods.xFilter = &SqliteArrayTable::xFilter;
+            methods.xNext = &SqliteArrayTable::xNext;
+            methods.xEof = &SqliteArrayTable::xEof;
+            methods.xColumn = &SqliteArrayTable::xColumn;
+            methods.xRowid = &SqliteArrayTable::xRowid;
+            return methods;
+        }();
+        return &m;
+    }
+
+    static int xConnect(sqlite3* db, void*, int, const char* const*, sqlite3_vtab** out, char** err) {
+        int rc = sqlite3_declare_vtab(db, "CREATE TABLE x(value, pointer HIDDEN)");
+        if(rc != SQLITE_OK) {
+            *err = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+            return rc;
+        }
+        sqlite3_vtab_config(db, SQLITE_VTAB_INNOCUOUS);
+        sqlite3_vtab* vtab = static_cast<sqlite3_vtab*>(sqlite3_malloc(sizeof(sqlite3_vtab)));
+        if(!vtab) return SQLITE_NOMEM;
+        std::memset(vtab, 0, sizeof(sqlite3_vtab));
+        *out = vtab;
+        return SQLITE_OK;
+    }
+
+    static int xDisconnect(sqlite3_vtab* vtab) {
+        sqlite3_free(vtab);
+        return SQLITE_OK;
+    }
+
+    // Without its argument the table is empty, so such plans are priced out
+    static int xBestIndex(sqlite3_vtab*, sqlite3_index_info* info) {
+        info->idxNum = 0;
+        info->estimatedCost = 1e12;
+        info->estimatedRows = 1;
+        for(int i = 0; i < info->nConstraint; ++i) {
+            sqlite3_index_info::sqlite3_index_constraint const& c = info->aConstraint[i];
+            if(c.iColumn != pointer_column || c.op != SQLITE_INDEX_CONSTRAINT_EQ) continue;
+            if(!c.usable) return SQLITE_CONSTRAINT;
+            info->idxNum = 1;
+            info->aConstraintUsage[i].argvIndex = 1;
+            info->aConstraintUsage[i].omit = 1;
+            info->estimatedCost = 1;
+            info->estimatedRows = 100;
+            break;
+        }
+        return SQLITE_OK;
+    }
+
+    static int xOpen(sqlite3_vtab*, sqlite3_vtab_cursor** out) {
+        Cursor* cursor = static_cast<Cursor*>(sqlite3_malloc(sizeof(Cursor)));
+        if(!cursor) return SQLITE_NOMEM;
+        std::memset(cursor, 0, sizeof(Cursor));
+        *out = &cursor->base;
+        return SQLITE_OK;
+    }
+
+    static int xClose(sqlite3_vtab_cursor* base) {
+        sqlite3_free(base);
+        return SQLITE_OK;
+    }
+
+    static int xFilter(sqlite3_vtab_cursor* base, int plan, const char*, int argc, sqlite3_value** argv) {
+        Cursor* cursor = reinterpret_cast<Cursor*>(base);
+        cursor->pos = 0;
+        cursor->array = NULL;
+        if(plan == 1 && argc > 0) {
+            cursor->array = static_cast<const SqliteArray*>(
+                sqlite3_value_pointer(argv[0], SqliteArray::pointerType()));
+        }
+        return SQLITE_OK;
+    }
+
+    static int xNext(sqlite3_vtab_cursor* base) {
+        ++reinterpret_cast<Cursor*>(base)->pos;
+        return SQLITE_OK;
+    }
+
+    static int xEof(sqlite3_vtab_cursor* base) {
+        Cursor* cursor = reinterpret_cast<Cursor*>(base);
+        return !cursor->array || cursor->pos >= cursor->array->size();
+    }
+
+    // The array outlives the cursor, so text is handed over without a copy
+    static int xColumn(sqlite3_vtab_cursor* base, sqlite3_context* ctx, int column) {
+        Cursor* cursor = reinterpret_cast<Cursor*>(base);
+        if(column != value_column) return SQLITE_OK;
+        const SqliteArray& array = *cursor->array;
+        switch(array.type) {
+            case SQLITE_INTEGER: sqlite3_result_int64(ctx, array.integers[cursor->pos]); break;
+            case SQLITE_FLOAT: sqlite3_result_double(ctx, array.reals[cursor->pos]); break;
+            default: {
+                std::string const& text = array.texts[cursor->pos];
+                sqlite3_result_text(ctx, text.data(), static_cast<int>(text.size()), SQLITE_STATIC);
+            }
+        }
+        return SQLITE_OK;
+    }
+
+    static int xRowid(sqlite3_vtab_cursor* base, sqlite3_int64* rowid) {
+        *rowid = static_cast<sqlite3_int64>(reinterpret_cast<Cursor*>(base)->pos) + 1;
+        return SQLITE_OK;
+    }
+};
+
 
 class Sqlite
 {
@@ -36,23 +1215,43 @@ public:
         rows_left{false}, query{""}, tail{""}, stmt{NULL}
     { 
         if(debug) std::cout << "Open database: " << file.c_str() << std::endl;
-        int rc = sqlite3_open(file.c_str(), &this->db);
-        if(rc != SQLITE_OK) { 
-            std::string error_msg = "Can't open '" + file + "' : "
-                + std::string(sqlite3_errmsg(this->db));
-            SqliteException e(rc, error_msg);
-            throw e;
+        int rc = sqlite3_open(file.c_str(), &this->db);
+        if(rc != SQLITE_OK) { 
+            failOpen(rc, "Can't open '" + file + "' : " + std::string(sqlite3_errmsg(this->db)));
+        }
+        rc = SqliteArrayTable::registerModule(this->db);
+        if(rc != SQLITE_OK) {
+            failOpen(rc, "Could not register carray: " + std::string(sqlite3_errmsg(this->db)));
+        }
+    }
+    // Opens through sqlite3_open_v2 with explicit SQLITE_OPEN_* flags and
+    // optionally a registered VFS. Pass SQLITE_OPEN_URI to open "file:" URIs.
+    Sqlite(std::string file, bool debug, int flags, const char* vfs = NULL)
+        :file{file}, db{}, debug{debug}, prepared{false}, valid{true},
+        rows_left{false}, query{""}, tail{""}, stmt{NULL}
+    {
+        if(debug) std::cout << "Open database: " << file.c_str() << std::endl;
+        int rc = sqlite3_open_v2(file.c_str(), &this->db, flags, vfs);
+        if(rc != SQLITE_OK) {
+            failOpen(rc, "Can't open '" + file + "' : " + std::string(sqlite3_errmsg(this->db)));
+        }
+        rc = SqliteArrayTable::registerModule(this->db);
+        if(rc != SQLITE_OK) {
+            failOpen(rc, "Could not register carray: " + std::string(sqlite3_errmsg(this->db)));
         }
     }
     ~Sqlite() {
         sqlite3_finalize(this->stmt);
+        clearQueryCache();
         sqlite3_close(this->db);
+        unmapImage();
     }
-    // TODO This does not work due to pointers
-    Sqlite(Sqlite const& copy) = default;
-    Sqlite &operator = (const Sqlite &copy) = default;
-    Sqlite(Sqlite &&move) = default;
-    Sqlite &operator = (Sqlite &&move) = default;
+    // Callbacks registered with SQLite hold this pointer, so a connection
+    // stays where it was opened; share it through sqlite_ptr instead
+    Sqlite(Sqlite const& copy) = delete;
+    Sqlite &operator = (const Sqlite &copy) = delete;
+    Sqlite(Sqlite &&move) = delete;
+    Sqlite &operator = (Sqlite &&move) = delete;
 
     void exec(std::string q) {
         // alt sqlite3_exec(this->db, q, 0, 0, 0);
@@ -63,72 +1262,64 @@ public:
     }
 
     void setQuery(std::string const& q) {
-        if(debug) std::cout << "Set query: " << q << std::endl;
-        if(this->prepared || q == "") {
-            SqliteException e(-1, "Can not set sql on prepared query or the query is empty");
-            throw e;
-        } else {
-            this->query = q;
-        }
+        check(trySetQuery(q));
     }
 
     void prepare() {
-        if(this->query != "") {
-            if(debug) std::cout << "Prepare query" << std::endl;
-            const char* tail;
-            int rc = sqlite3_prepare_v2(
-                this->db, 
-                this->query.c_str(), 
-                this->query.length(), 
-                &this->stmt, 
-                &tail);
-            if(rc != SQLITE_OK) {
-                SqliteException e(rc, "Could not prepare query: " + std::string(sqlite3_errmsg(this->db)));
-                throw e;
-            }
-            this->prepared = true;
-            this->tail = std::string(tail);
-        } else {
-            SqliteException e(-1, "No query set" );
-            throw e;
-        }
-        
+        check(tryPrepare());
     }
 
     bool step() {
-        if(debug) std::cout << "Step query" << std::endl;
-        if(!this->valid) {
-            SqliteException e(-1, "Trying to step an invalid statement.");
-        }
-        int rc = sqlite3_step(this->stmt);
-        bool return_value = NULL;
-        switch(rc){ 
-            case SQLITE_DONE: {
-                this->valid = false;
-                return_value = false;
-                break;
-            }
-            case SQLITE_ROW: {
-                this->rows_left = true;
-                return_value = true;
-                break;
-            }
-            default:
-                SqliteException e(rc, "Sqlite had an error: " + std::string(sqlite3_errmsg(this->db)));
+        SqliteResult<bool> r = tryStep();
+        if(r.code() == SQLITE_INTERRUPT) {
+            SqliteInterruptException e(r.code(), r.context(), this->interrupt_timed_out);
+            SQLITE3CPP_THROW(e);
         }
-        return return_value;
+        check(r);
+        return r.value();
     }
 
     void reset() {
-        if(debug) std::cout << "Reset query" << std::endl;
-        int rc = sqlite3_reset(this->stmt);
-        if(rc != SQLITE_OK) {
-            SqliteException e(rc, "Could not reset the query: "  + std::string(sqlite3_errmsg(this->db)));
-            throw e;
-        }
-        this->valid = true;
-        this->rows_left = false;
-        this->prepared = false;
+        check(tryReset());
+    }
+
+    // Deadlines and cancellation. The progress handler is only installed while
+    // a deadline or token is active, and only registered or removed when that
+    // changes, so ordinary statements pay nothing.
+    // Every statement started after this call must finish within timeout,
+    // zero disables it.
+    void setTimeout(std::chrono::milliseconds timeout) {
+        this->timeout = timeout;
+    }
+
+    // Deadline for the current statement only, cleared by reset()
+    void setDeadline(std::chrono::steady_clock::time_point deadline) {
+        this->deadline = deadline;
+        this->has_deadline = true;
+        if(this->running) updateProgressHandler();
+    }
+
+    void setCancellationToken(CancellationToken const& token) {
+        this->token = std::make_shared<CancellationToken>(token);
+        if(this->running) updateProgressHandler();
+    }
+
+    void clearCancellationToken() {
+        this->token.reset();
+        if(this->running) updateProgressHandler();
+    }
+
+    // Stops the running statement at once; safe to call from another thread
+    void interrupt() {
+        sqlite3_interrupt(this->db);
+    }
+
+    uint64_t getTimedOutCount() {
+        return this->timed_out_count.load();
+    }
+
+    uint64_t getCancelledCount() {
+        return this->cancelled_count.load();
     }
 
     double getDouble(int fieldnumber)
@@ -148,50 +1339,527 @@ public:
 
     std::string getBlob(int fieldnumber)
     {
-        return std::string(reinterpret_cast<const char*>(sqlite3_column_blob(this->stmt, fieldnumber), 
-                sqlite3_column_bytes(this->stmt, fieldnumber)));
+        const char* blob = reinterpret_cast<const char*>(sqlite3_column_blob(this->stmt, fieldnumber));
+        return std::string(blob, sqlite3_column_bytes(this->stmt, fieldnumber));
     }
 
     // Bind functions 
     void bind(int column, std::string const& text)
     {
+        check(tryBind(column, text));
+    }
+
+    void bind(int column, double const& d)
+    {
+        check(tryBind(column, d));
+    }
+
+    void bind(int column, int i)
+    {
+        check(tryBind(column, i));
+    }
+
+    void bind_null(int column) {
+        check(tryBind_null(column));
+    }
+
+    void bind_blob(int column, const void* data, int size) {
+        check(tryBind_blob(column, data, size));
+    }
+
+    // Reserves size bytes of zeros, to be filled later through openBlob()
+    void bind_zeroblob(int column, sqlite3_int64 size) {
+        check(tryBind_zeroblob(column, size));
+    }
+
+    // Binding by parameter name, including its prefix as in ":id". Names
+    // are resolved once per prepared statement and found again by address,
+    // so pass literals or other strings that stay put.
+    void bind(const char* name, std::string const& text) {
+        check(tryBind(name, text));
+    }
+
+    void bind(const char* name, double const& d) {
+        check(tryBind(name, d));
+    }
+
+    void bind(const char* name, int i) {
+        check(tryBind(name, i));
+    }
+
+    void bind_null(const char* name) {
+        check(tryBind_null(name));
+    }
+
+    void bind_blob(const char* name, const void* data, int size) {
+        check(tryBind_blob(name, data, size));
+    }
+
+    // Binds the fields of value, see SqliteBinding
+    template<typename T>
+    void bind(SqliteBinding<T>& binding, T const& value) {
+        check(tryBind(binding, value));
+    }
+
+    // Binds count values as one array for the carray() table-valued
+    // function, so "WHERE id IN carray(?)" is prepared once for lists of any
+    // length. Elements are integers, floating point or strings, and copied.
+    template<typename T>
+    void bind_array(int column, const T* values, size_t count) {
+        check(tryBind_array(column, values, count));
+    }
+
+    template<typename T>
+    void bind_array(int column, std::vector<T> const& values) {
+        check(tryBind_array(column, values.data(), values.size()));
+    }
+
+    // Opens the blob in column of row rowid for incremental I/O. chunk_size
+    // is the amount transferred per sqlite3_blob_read/write call.
+    std::unique_ptr<BlobStream> openBlob(std::string const& table, std::string const& column,
+        sqlite3_int64 rowid, bool writable = false, size_t chunk_size = 64 * 1024)
+    {
+        sqlite3_blob* blob = NULL;
+        int rc = sqlite3_blob_open(this->db, "main", table.c_str(), column.c_str(), rowid,
+            writable ? 1 : 0, &blob);
+        if(rc != SQLITE_OK) {
+            sqlite3_blob_close(blob);
+            check(SqliteStatus(rc, "Could not open blob"));
+        }
+        return std::unique_ptr<BlobStream>(new BlobStream(blob, chunk_size));
+    }
+
+    // Non-throwing counterparts of the functions above. Failures are returned
+    // as a status carrying the SQLite code; errorMessage() gives the detailed
+    // message of the connection until the next call.
+    SqliteStatus tryExec(std::string const& q) noexcept {
+        SqliteStatus r = trySetQuery(q);
+        if(r) r = tryPrepare();
+        if(r) r = tryStep();
+        if(r) r = tryReset();
+        return r;
+    }
+
+    SqliteStatus trySetQuery(std::string const& q) noexcept {
+        trace("Set query: ", q.c_str());
+        if(this->prepared || q == "") {
+            return SqliteStatus(-1, "Can not set sql on prepared query or the query is empty");
+        }
+        return assign(this->query, q.c_str(), q.length());
+    }
+
+    SqliteStatus tryPrepare() noexcept {
+        if(this->query == "") {
+            return SqliteStatus(-1, "No query set");
+        }
+        trace("Prepare query");
+        const char* tail;
+        // Re-preparing replaces the previous statement
+        sqlite3_finalize(this->stmt);
+        this->stmt = NULL;
+        int rc = sqlite3_prepare_v2(
+            this->db, 
+            this->query.c_str(), 
+            this->query.length(), 
+            &this->stmt, 
+            &tail);
+        forgetParameters();
+        if(rc != SQLITE_OK) {
+            return SqliteStatus(rc, "Could not prepare query");
+        }
+        SqliteStatus r = assign(this->tail, tail, std::strlen(tail));
+        if(!r) {
+            sqlite3_finalize(this->stmt);
+            this->stmt = NULL;
+            forgetParameters();
+            return r;
+        }
+        this->prepared = true;
+        this->running = false;
+        return r;
+    }
+
+    SqliteResult<bool> tryStep() noexcept {
+        trace("Step query");
+        if(!this->running) {
+            this->running = true;
+            if(!this->has_deadline && this->timeout.count() > 0) {
+                this->deadline = std::chrono::steady_clock::now() + this->timeout;
+                this->has_deadline = true;
+            }
+            updateProgressHandler();
+        }
+        int rc = sqlite3_step(this->stmt);
+        switch(rc){ 
+            case SQLITE_DONE: {
+                this->valid = false;
+                return SqliteResult<bool>(false);
+            }
+            case SQLITE_ROW: {
+                this->rows_left = true;
+                return SqliteResult<bool>(true);
+            }
+            case SQLITE_INTERRUPT: {
+                bool timed_out = this->has_deadline && std::chrono::steady_clock::now() >= this->deadline;
+                if(timed_out) this->timed_out_count++;
+                else this->cancelled_count++;
+                this->interrupt_timed_out = timed_out;
+                finishStatement();
+                return SqliteResult<bool>(rc, timed_out ? "Query deadline exceeded" : "Query cancelled");
+            }
+            default:
+                finishStatement();
+                return SqliteResult<bool>(rc, "Sqlite had an error");
+        }
+    }
+
+    SqliteStatus tryReset() noexcept {
+        trace("Reset query");
+        int rc = sqlite3_reset(this->stmt);
+        if(rc != SQLITE_OK) {
+            return SqliteStatus(rc, "Could not reset the query");
+        }
+        clearStatementState();
+        return SqliteStatus();
+    }
+
+    SqliteStatus tryBind(int column, std::string const& text) noexcept {
         int rc = sqlite3_bind_text(
             this->stmt, 
             column, 
             text.c_str(), 
             text.length(), 
             SQLITE_TRANSIENT); //SQLITE_STATIC
-        if(rc != SQLITE_OK) {
-            SqliteException e(rc, "Could not bind text: " + std::string(sqlite3_errmsg(this->db)));
-            throw e;
+        return SqliteStatus(rc, "Could not bind text");
+    }
+
+    SqliteStatus tryBind(int column, double const& d) noexcept {
+        return SqliteStatus(sqlite3_bind_double(this->stmt, column, d), "Could not bind double");
+    }
+
+    SqliteStatus tryBind(int column, int i) noexcept {
+        return SqliteStatus(sqlite3_bind_int(this->stmt, column, i), "Could not bind int");
+    }
+
+    SqliteStatus tryBind_null(int column) noexcept {
+        return SqliteStatus(sqlite3_bind_null(this->stmt, column), "Could not bind to NULL");
+    }
+
+    SqliteStatus tryBind_blob(int column, const void* data, int size) noexcept {
+        return SqliteStatus(sqlite3_bind_blob(this->stmt, column, data, size, SQLITE_TRANSIENT),
+            "Could not bind blob");
+    }
+
+    SqliteStatus tryBind_zeroblob(int column, sqlite3_int64 size) noexcept {
+        return SqliteStatus(sqlite3_bind_zeroblob64(this->stmt, column, size), "Could not bind zeroblob");
+    }
+
+    SqliteStatus tryBind(const char* name, std::string const& text) noexcept {
+        int column = parameterIndex(name);
+        return column ? tryBind(column, text) : unknownParameter();
+    }
+
+    SqliteStatus tryBind(const char* name, double const& d) noexcept {
+        int column = parameterIndex(name);
+        return column ? tryBind(column, d) : unknownParameter();
+    }
+
+    SqliteStatus tryBind(const char* name, int i) noexcept {
+        int column = parameterIndex(name);
+        return column ? tryBind(column, i) : unknownParameter();
+    }
+
+    SqliteStatus tryBind_null(const char* name) noexcept {
+        int column = parameterIndex(name);
+        return column ? tryBind_null(column) : unknownParameter();
+    }
+
+    SqliteStatus tryBind_blob(const char* name, const void* data, int size) noexcept {
+        int column = parameterIndex(name);
+        return column ? tryBind_blob(column, data, size) : unknownParameter();
+    }
+
+    template<typename T>
+    SqliteStatus tryBind(SqliteBinding<T>& binding, T const& value) noexcept {
+        if(binding.statement != this->statement_id) binding.resolve(this->stmt, this->statement_id);
+        return SqliteStatus(binding.apply(this->stmt, value), "Could not bind fields");
+    }
+
+    template<typename T>
+    SqliteStatus tryBind_array(int column, const T* values, size_t count) noexcept {
+        return SqliteStatus(SqliteArray::bind(this->stmt, column, values, count), "Could not bind array");
+    }
+
+    std::string errorMessage() {
+        return std::string(sqlite3_errmsg(this->db));
+    }
+
+    // Runs a typed query (see SqliteQuery) and returns its rows. The
+    // statement is prepared on first use and kept apart from the one of
+    // setQuery(), until clearQueryCache() or the connection closes.
+    template<typename R, typename... Args>
+    typename std::enable_if<!std::is_void<R>::value, std::vector<R>>::type
+    run(SqliteQuery<R(Args...)> const& q, typename SqliteIdentity<Args>::type const&... args) {
+        std::vector<R> rows;
+        sqlite3_stmt* stmt = startQuery(q, args...);
+        if(!stmt) return rows;
+        int rc;
+        while((rc = sqlite3_step(stmt)) == SQLITE_ROW) rows.push_back(SqliteRow<R>::read(stmt));
+        finishQuery(stmt, rc);
+        return rows;
+    }
+
+    template<typename... Args>
+    void run(SqliteQuery<void(Args...)> const& q, typename SqliteIdentity<Args>::type const&... args) {
+        sqlite3_stmt* stmt = startQuery(q, args...);
+        if(!stmt) return;
+        int rc;
+        while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {}
+        finishQuery(stmt, rc);
+    }
+
+    // Finalizes the statements of typed queries
+    void clearQueryCache() {
+        for(std::unordered_map<uint64_t, CachedQuery>::iterator it = this->queries.begin(); it != this->queries.end(); ++it) {
+            sqlite3_finalize(it->second.stmt);
         }
+        this->queries.clear();
     }
 
-    void bind(int column, double const& d)
-    {
-        int rc = sqlite3_bind_double(this->stmt, column, d);
-        if(rc != SQLITE_OK) {
-            SqliteException e(rc, "Could not bind double: " + std::string(sqlite3_errmsg(this->db)));
-            throw e;
+    // Registers f as the SQL function name. The number and types of its
+    // arguments and its result come from the signature of f; see
+    // SqliteValue for the supported types. flags may add
+    // SQLITE_DETERMINISTIC, so the planner can fold constant calls and use
+    // the function in indexes, SQLITE_INNOCUOUS and SQLITE_DIRECTONLY.
+    // An exception thrown by f becomes an SQL error.
+    template<typename F>
+    void create_function(std::string const& name, F f, int flags = 0) {
+        typedef typename std::decay<F>::type Function;
+        typedef SqliteScalarFunction<Function> Trampoline;
+        // SQLite calls destroy() for the copy even when registration fails
+        int rc = sqlite3_create_function_v2(this->db, name.c_str(), Trampoline::signature::arity,
+            SQLITE_UTF8 | flags, new Function(f), &Trampoline::call, NULL, NULL, &Trampoline::destroy);
+        check(SqliteStatus(rc, "Could not create function"));
+    }
+
+    // Registers the aggregate class A (see SqliteAggregateFunction) as name.
+    // If A has inverse() and value() it is also a window function and can be
+    // used with OVER clauses and sliding frames.
+    template<typename A>
+    void create_aggregate(std::string const& name, int flags = 0) {
+        typedef SqliteAggregateFunction<A> Trampoline;
+        const bool window = SqliteIsWindow<A>::value;
+        int rc = sqlite3_create_window_function(this->db, name.c_str(), Trampoline::signature::arity,
+            SQLITE_UTF8 | flags, NULL, &Trampoline::step, &Trampoline::final,
+            window ? windowValue<A>() : NULL, window ? windowInverse<A>() : NULL, NULL);
+        check(SqliteStatus(rc, "Could not create aggregate"));
+    }
+
+    // Registers f (see SqliteCollationFunction) as the collating sequence
+    // name, for COLLATE clauses and columns, and for indexes that ORDER BY
+    // can then walk instead of sorting. For example
+    // create_collation("NATSORT", &SqliteCollation::natural).
+    template<typename F>
+    void create_collation(std::string const& name, F f) {
+        typedef typename std::decay<F>::type Function;
+        typedef SqliteCollationFunction<Function> Trampoline;
+        Function* copy = new Function(f);
+        int rc = sqlite3_create_collation_v2(this->db, name.c_str(), SQLITE_UTF8, copy,
+            &Trampoline::compare, &Trampoline::destroy);
+        // Unlike the function registrations, a failed one leaves the copy to us
+        if(rc != SQLITE_OK) delete copy;
+        check(SqliteStatus(rc, "Could not create collation"));
+    }
+
+    // Gives this connection its own lookaside allocator of slots slots of
+    // slot_size bytes. Has to be called before the connection runs queries.
+    void configureLookaside(int slot_size, int slots) {
+        int rc = sqlite3_db_config(this->db, SQLITE_DBCONFIG_LOOKASIDE, NULL, slot_size, slots);
+        check(SqliteStatus(rc, "Could not configure lookaside"));
+    }
+
+    SqliteLookasideStats lookasideStats() {
+        SqliteLookasideStats s;
+        int high = 0;
+        sqlite3_db_status(this->db, SQLITE_DBSTATUS_LOOKASIDE_USED, &s.used, &s.peak, 0);
+        sqlite3_db_status(this->db, SQLITE_DBSTATUS_LOOKASIDE_HIT, &high, &s.hits, 0);
+        sqlite3_db_status(this->db, SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE, &high, &s.miss_size, 0);
+        sqlite3_db_status(this->db, SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL, &high, &s.miss_full, 0);
+        return s;
+    }
+
+    // Frees as much cache memory as this connection can spare
+    void releaseMemory() {
+        check(SqliteStatus(sqlite3_db_release_memory(this->db), "Could not release memory"));
+    }
+
+    // True while no statement of this connection is part way through its rows
+    bool isIdle() {
+        for(sqlite3_stmt* s = sqlite3_next_stmt(this->db, NULL); s; s = sqlite3_next_stmt(this->db, s)) {
+            if(sqlite3_stmt_busy(s)) return false;
         }
+        return true;
     }
 
-    void bind(int column, int i)
-    {
-        int rc = sqlite3_bind_int(this->stmt, column, i);
-        if(rc != SQLITE_OK)
-        {
-            SqliteException e(rc, "Could not bind int: " + std::string(sqlite3_errmsg(this->db)));
-            throw e;
+    // In-memory database images. deserialize() replaces the main database of
+    // this connection with a copy of the image; the copy can grow, so the
+    // database stays writable unless read_only is set.
+    void deserialize(const void* data, size_t size, bool read_only = false) {
+        unsigned char* copy = static_cast<unsigned char*>(sqlite3_malloc64(size ? size : 1));
+        if(!copy) {
+            check(SqliteStatus(SQLITE_NOMEM, "Could not deserialize database"));
+            return;
         }
+        std::copy(static_cast<const char*>(data), static_cast<const char*>(data) + size, reinterpret_cast<char*>(copy));
+        unsigned flags = SQLITE_DESERIALIZE_FREEONCLOSE | SQLITE_DESERIALIZE_RESIZEABLE;
+        if(read_only) flags |= SQLITE_DESERIALIZE_READONLY;
+        check(SqliteStatus(loadImage(copy, size, flags), "Could not deserialize database"));
+        unmapImage();
     }
 
-    void bind_null(int column) {
-        int rc = sqlite3_bind_null(this->stmt, column);
-        if(rc != SQLITE_OK) {
-            SqliteException e(rc, "Could not bind to NULL: " + std::string(sqlite3_errmsg(this->db)));
-            throw e;
+    // Loads a database file into memory with one sequential read. With
+    // use_mmap the file is mapped instead and served read-only straight from
+    // the page cache of the OS; the mapping lives as long as the connection.
+    void deserializeFile(std::string const& path, bool use_mmap = false) {
+#ifdef SQLITE3CPP_POSIX
+        if(use_mmap) {
+            int fd = ::open(path.c_str(), O_RDONLY);
+            struct stat st;
+            if(fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+                if(fd >= 0) ::close(fd);
+                SqliteException e(SQLITE_CANTOPEN, "Can't map '" + path + "'");
+                SQLITE3CPP_THROW(e);
+                return;
+            }
+            void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if(map == MAP_FAILED) {
+                SqliteException e(SQLITE_IOERR, "Can't map '" + path + "'");
+                SQLITE3CPP_THROW(e);
+                return;
+            }
+            madvise(map, st.st_size, MADV_WILLNEED);
+            int rc = loadImage(static_cast<unsigned char*>(map), st.st_size, SQLITE_DESERIALIZE_READONLY);
+            if(rc != SQLITE_OK) munmap(map, st.st_size);
+            check(SqliteStatus(rc, "Could not deserialize database"));
+            unmapImage();
+            this->mapping = map;
+            this->mapping_size = st.st_size;
+            return;
+        }
+#endif
+        std::ifstream in(path.c_str(), std::ios::binary);
+        if(!in) {
+            SqliteException e(SQLITE_CANTOPEN, "Can't open '" + path + "'");
+            SQLITE3CPP_THROW(e);
+            return;
+        }
+        in.seekg(0, std::ios::end);
+        sqlite3_int64 size = in.tellg();
+        in.seekg(0, std::ios::beg);
+        unsigned char* image = static_cast<unsigned char*>(sqlite3_malloc64(size ? size : 1));
+        if(!image || !in.read(reinterpret_cast<char*>(image), size)) {
+            sqlite3_free(image);
+            SqliteException e(SQLITE_IOERR, "Can't read '" + path + "'");
+            SQLITE3CPP_THROW(e);
+            return;
+        }
+        int rc = loadImage(image, size, SQLITE_DESERIALIZE_FREEONCLOSE | SQLITE_DESERIALIZE_RESIZEABLE);
+        check(SqliteStatus(rc, "Could not deserialize database"));
+        unmapImage();
+    }
+
+    // Image of the main database as it would be stored on disk
+    std::string serialize() {
+        sqlite3_int64 size = 0;
+        // An in-memory image can be read without an intermediate copy
+        unsigned char* image = sqlite3_serialize(this->db, "main", &size, SQLITE_SERIALIZE_NOCOPY);
+        if(image) return std::string(reinterpret_cast<const char*>(image), size);
+        image = sqlite3_serialize(this->db, "main", &size, 0);
+        if(!image) {
+            check(SqliteStatus(SQLITE_NOMEM, "Could not serialize database"));
+            return std::string();
+        }
+        std::string result(reinterpret_cast<const char*>(image), size);
+        sqlite3_free(image);
+        return result;
+    }
+
+    // Writes the image next to path and renames it into place, so readers
+    // of path see either the old or the new database, never a partial one.
+    void serializeToFile(std::string const& path) {
+        std::string image = serialize();
+        std::string tmp = path + ".tmp";
+        bool ok = false;
+#ifdef SQLITE3CPP_POSIX
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd >= 0) {
+            size_t written = 0;
+            while(written < image.size()) {
+                ssize_t n = ::write(fd, image.data() + written, image.size() - written);
+                if(n <= 0) break;
+                written += n;
+            }
+            ok = written == image.size() && fsync(fd) == 0;
+            ok = ::close(fd) == 0 && ok;
         }
+#else
+        std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+        ok = static_cast<bool>(out.write(image.data(), image.size()));
+        out.close();
+#endif
+        if(!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+            std::remove(tmp.c_str());
+            SqliteException e(SQLITE_IOERR, "Can't write '" + path + "'");
+            SQLITE3CPP_THROW(e);
+            return;
+        }
+        // The rename itself only lasts once the directory entry is on disk
+        if(!syncDirectory(path)) {
+            SqliteException e(SQLITE_IOERR, "Can't sync the directory of '" + path + "'");
+            SQLITE3CPP_THROW(e);
+        }
+    }
+
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    // Consistent reads across connections of a WAL database. beginSnapshot()
+    // starts a read transaction and returns the snapshot it sees; any other
+    // connection to the same file can then openSnapshot() it and read exactly
+    // the same data while writers keep committing. Each reader ends its view
+    // with endSnapshot(). A snapshot stays usable while at least one
+    // connection is reading it, checkpoints can not move past it then.
+    SqliteSnapshot beginSnapshot(const char* schema = "main") {
+        bool started = false;
+        int rc = startRead(schema, started);
+        sqlite3_snapshot* snap = NULL;
+        if(rc == SQLITE_OK) rc = sqlite3_snapshot_get(this->db, schema, &snap);
+        if(rc != SQLITE_OK && started) sqlite3_exec(this->db, "ROLLBACK", NULL, NULL, NULL);
+        check(SqliteStatus(rc, "Could not take snapshot"));
+        return SqliteSnapshot(snap);
+    }
+
+    // Starts a read transaction on snapshot. Fails with SQLITE_BUSY_SNAPSHOT
+    // once the WAL has been checkpointed past it.
+    void openSnapshot(SqliteSnapshot const& snapshot, const char* schema = "main") {
+        if(!snapshot) check(SqliteStatus(-1, "Could not open snapshot: empty snapshot"));
+        bool started = sqlite3_get_autocommit(this->db) != 0;
+        int rc = started ? sqlite3_exec(this->db, "BEGIN", NULL, NULL, NULL) : SQLITE_OK;
+        if(rc == SQLITE_OK) rc = sqlite3_snapshot_open(this->db, schema, snapshot.get());
+        if(rc != SQLITE_OK && started) sqlite3_exec(this->db, "ROLLBACK", NULL, NULL, NULL);
+        check(SqliteStatus(rc, "Could not open snapshot"));
+    }
+
+    // Ends the read transaction of beginSnapshot() or openSnapshot()
+    void endSnapshot() {
+        if(sqlite3_get_autocommit(this->db)) return;
+        finishStatement();
+        check(SqliteStatus(sqlite3_exec(this->db, "COMMIT", NULL, NULL, NULL), "Could not end snapshot"));
+    }
+#endif
+
+    // Raw connection for the companion headers and direct C API use
+    sqlite3* getHandle() {
+        return this->db;
     }
 
     int64_t lastInsertId() {
@@ -199,6 +1867,263 @@ public:
     }
 
 private:
+    // Turns a failed status into the exception the throwing API has always raised
+    void check(SqliteStatus const& r) {
+        if(r) return;
+        std::string msg = r.context();
+        if(r.code() != -1) msg += ": " + std::string(sqlite3_errmsg(this->db));
+        SqliteException e(r.code(), msg);
+        SQLITE3CPP_THROW(e);
+    }
+
+    // The destructor does not run for a constructor that throws, so the
+    // handle is closed here
+    void failOpen(int rc, std::string const& error_msg) {
+        sqlite3_close(this->db);
+        this->db = NULL;
+        SqliteException e(rc, error_msg);
+        SQLITE3CPP_THROW(e);
+    }
+
+#ifdef SQLITE_ENABLE_SNAPSHOT
+    // Opens a read transaction on schema, BEGIN alone does not take one
+    int startRead(const char* schema, bool& started) {
+        started = sqlite3_get_autocommit(this->db) != 0;
+        int rc = started ? sqlite3_exec(this->db, "BEGIN", NULL, NULL, NULL) : SQLITE_OK;
+        if(rc != SQLITE_OK) return rc;
+        std::string sql = "SELECT count(*) FROM \"" + std::string(schema) + "\".sqlite_master";
+        return sqlite3_exec(this->db, sql.c_str(), NULL, NULL, NULL);
+    }
+#endif
+
+    struct CachedQuery
+    {
+        const char* sql;
+        std::string text;
+        sqlite3_stmt* stmt;
+    };
+
+    template<typename R, typename... Args>
+    sqlite3_stmt* startQuery(SqliteQuery<R(Args...)> const& q, typename SqliteIdentity<Args>::type const&... args) {
+        sqlite3_stmt* stmt = cachedQuery(q.sql(), q.size(), q.key(), sizeof...(Args));
+        if(!stmt) return NULL;
+        // Left running by an exception while reading the last rows
+        sqlite3_reset(stmt);
+        int rc = bindArguments(stmt, typename SqliteMakeIndices<sizeof...(Args)>::type(), args...);
+        if(rc != SQLITE_OK) {
+            check(SqliteStatus(rc, "Could not bind query arguments"));
+            return NULL;
+        }
+        return stmt;
+    }
+
+    void finishQuery(sqlite3_stmt* stmt, int rc) {
+        sqlite3_reset(stmt);
+        if(rc != SQLITE_DONE) check(SqliteStatus(rc, "Query failed"));
+    }
+
+    template<size_t... I, typename... Values>
+    static int bindArguments(sqlite3_stmt* stmt, SqliteIndices<I...>, Values const&... values) {
+        (void)stmt; // Unused by a query without arguments
+        int rc[] = { SQLITE_OK, SqliteValue<Values>::bind(stmt, static_cast<int>(I) + 1, values)... };
+        for(size_t i = 0; i < sizeof(rc) / sizeof(rc[0]); ++i) {
+            if(rc[i] != SQLITE_OK) return rc[i];
+        }
+        return SQLITE_OK;
+    }
+
+    // The key was hashed at compile time, so a query from the same literal
+    // is found without looking at its text
+    sqlite3_stmt* cachedQuery(const char* sql, size_t size, uint64_t key, int arity) {
+        std::unordered_map<uint64_t, CachedQuery>::iterator it = this->queries.find(key);
+        if(it != this->queries.end()) {
+            if(it->second.sql == sql) return it->second.stmt;
+            if(it->second.text.size() == size && std::memcmp(it->second.text.data(), sql, size) == 0) {
+                it->second.sql = sql;
+                return it->second.stmt;
+            }
+            // Different text with the same hash replaces the older query
+            sqlite3_finalize(it->second.stmt);
+            this->queries.erase(it);
+        }
+        sqlite3_stmt* stmt = NULL;
+        int rc = sqlite3_prepare_v3(this->db, sql, static_cast<int>(size) + 1, SQLITE_PREPARE_PERSISTENT, &stmt, NULL);
+        if(rc != SQLITE_OK) {
+            check(SqliteStatus(rc, "Could not prepare query"));
+            return NULL;
+        }
+        // The constexpr count models the tokenizer, SQLite has the last word
+        if(sqlite3_bind_parameter_count(stmt) != arity) {
+            sqlite3_finalize(stmt);
+            check(SqliteStatus(-1, "Placeholders of the query do not match its arguments"));
+            return NULL;
+        }
+        CachedQuery entry = { sql, std::string(sql, size), stmt };
+        this->queries[key] = entry;
+        return stmt;
+    }
+
+    // Name of a parameter resolved for the current statement. name points
+    // into the statement and confirms a hit on the caller's pointer.
+    struct NameSlot
+    {
+        const char* key;
+        const char* name;
+        int index;
+    };
+
+    static const int name_slots = 16;
+
+    // Ids tell statements apart even when one is allocated where a
+    // finalized one was
+    static uint64_t nextStatementId() {
+        static std::atomic<uint64_t> next{0};
+        return ++next;
+    }
+
+    void forgetParameters() noexcept {
+        this->statement_id = this->stmt ? nextStatementId() : 0;
+        this->names_used = 0;
+    }
+
+    // A known name costs a pointer compare and one strcmp, an unknown one
+    // the linear search of sqlite3_bind_parameter_index()
+    int parameterIndex(const char* name) noexcept {
+        for(int i = 0; i < this->names_used; ++i) {
+            NameSlot& slot = this->names[i];
+            if(slot.key == name && std::strcmp(slot.name, name) == 0) return slot.index;
+        }
+        int index = sqlite3_bind_parameter_index(this->stmt, name);
+        if(index && this->names_used < name_slots) {
+            NameSlot slot = { name, sqlite3_bind_parameter_name(this->stmt, index), index };
+            this->names[this->names_used++] = slot;
+        }
+        return index;
+    }
+
+    // Copies for the try*() functions, which report running out of memory
+    // instead of throwing std::bad_alloc
+    static SqliteStatus assign(std::string& to, const char* data, size_t size) noexcept {
+#ifdef SQLITE3CPP_EXCEPTIONS
+        try {
+            to.assign(data, size);
+        } catch(std::exception const&) {
+            return SqliteStatus(SQLITE_NOMEM, "Out of memory");
+        }
+#else
+        to.assign(data, size);
+#endif
+        return SqliteStatus();
+    }
+
+    // Debug output of the try*() functions, a std::cout set to throw on
+    // failure loses the line instead
+    void trace(const char* what, const char* detail = "") noexcept {
+        if(!this->debug) return;
+#ifdef SQLITE3CPP_EXCEPTIONS
+        try {
+            std::cout << what << detail << std::endl;
+        } catch(std::exception const&) {
+        }
+#else
+        std::cout << what << detail << std::endl;
+#endif
+    }
+
+    static SqliteStatus unknownParameter() noexcept {
+        return SqliteStatus(-1, "No parameter with that name");
+    }
+
+    // Only instantiated for aggregates that have inverse() and value()
+    typedef void (*WindowValue)(sqlite3_context*);
+    typedef void (*WindowInverse)(sqlite3_context*, int, sqlite3_value**);
+
+    template<typename A>
+    static typename std::enable_if<SqliteIsWindow<A>::value, WindowValue>::type windowValue() {
+        return &SqliteAggregateFunction<A>::value;
+    }
+    template<typename A>
+    static typename std::enable_if<!SqliteIsWindow<A>::value, WindowValue>::type windowValue() {
+        return NULL;
+    }
+    template<typename A>
+    static typename std::enable_if<SqliteIsWindow<A>::value, WindowInverse>::type windowInverse() {
+        return &SqliteAggregateFunction<A>::inverse;
+    }
+    template<typename A>
+    static typename std::enable_if<!SqliteIsWindow<A>::value, WindowInverse>::type windowInverse() {
+        return NULL;
+    }
+
+    // The image replaces the main database, so no statement may hold it
+    // SQLite frees an image it owns even when deserializing fails
+    int loadImage(unsigned char* image, sqlite3_int64 size, unsigned flags) {
+        sqlite3_finalize(this->stmt);
+        this->stmt = NULL;
+        forgetParameters();
+        clearQueryCache();
+        clearStatementState();
+        return sqlite3_deserialize(this->db, "main", image, size, size, flags);
+    }
+
+    static bool syncDirectory(std::string const& path) {
+#ifdef SQLITE3CPP_POSIX
+        size_t slash = path.find_last_of('/');
+        std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+        int fd = ::open(dir.c_str(), O_RDONLY);
+        if(fd < 0) return false;
+        bool ok = fsync(fd) == 0;
+        return ::close(fd) == 0 && ok;
+#else
+        (void)path;
+        return true;
+#endif
+    }
+
+    void unmapImage() {
+#ifdef SQLITE3CPP_POSIX
+        if(this->mapping) munmap(this->mapping, this->mapping_size);
+#endif
+        this->mapping = NULL;
+        this->mapping_size = 0;
+    }
+
+    // A failed step leaves the statement reset, so the error is reported once
+    // and the connection can take the next query
+    void finishStatement() {
+        sqlite3_reset(this->stmt);
+        clearStatementState();
+    }
+
+    void clearStatementState() {
+        this->valid = true;
+        this->rows_left = false;
+        this->prepared = false;
+        this->running = false;
+        this->has_deadline = false;
+        updateProgressHandler();
+    }
+
+    // Number of virtual machine instructions between deadline checks
+    static const int progress_interval = 1000;
+
+    static int progressCallback(void* data) {
+        Sqlite* self = static_cast<Sqlite*>(data);
+        if(self->token && self->token->isCancelled()) return 1;
+        if(self->has_deadline && std::chrono::steady_clock::now() >= self->deadline) return 1;
+        return 0;
+    }
+
+    void updateProgressHandler() {
+        bool wanted = this->has_deadline || this->token;
+        if(wanted == this->progress_installed) return;
+        if(wanted) {
+            sqlite3_progress_handler(this->db, progress_interval, &Sqlite::progressCallback, this);
+        } else {
+            sqlite3_progress_handler(this->db, 0, NULL, NULL);
+        }
+        this->progress_installed = wanted;
+    }
     
     std::string file;
     sqlite3* db = NULL;
@@ -208,6 +2133,25 @@ private:
     std::string query;
     std::string tail;
     sqlite3_stmt* stmt = NULL;
+    // Deadline and cancellation state
+    bool running = false;
+    bool has_deadline = false;
+    std::chrono::milliseconds timeout{0};
+    std::chrono::steady_clock::time_point deadline;
+    std::shared_ptr<CancellationToken> token;
+    bool progress_installed = false;
+    std::atomic<uint64_t> timed_out_count{0};
+    std::atomic<uint64_t> cancelled_count{0};
+    bool interrupt_timed_out = false;
+    // Memory map backing a deserialized image
+    void* mapping = NULL;
+    size_t mapping_size = 0;
+    // Statements of typed queries by the hash of their text
+    std::unordered_map<uint64_t, CachedQuery> queries;
+    // Parameter names of the current statement
+    uint64_t statement_id = 0;
+    NameSlot names[name_slots];
+    int names_used = 0;
 };
 
 typedef std::shared_ptr<Sqlite> sqlite_ptr;
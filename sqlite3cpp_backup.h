@@ -0,0 +1,194 @@
+#ifndef SQLITE3CPP_BACKUP_H
+#define SQLITE3CPP_BACKUP_H
+// C++ includes
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+// Library includes
+#include "sqlite3cpp.h"
+
+
+struct BackupProgress
+{
+    int remaining; // Pages still to copy
+    int pagecount; // Pages in the source database
+    int restarts;  // Times the source changed and the copy started over
+    bool done;
+};
+
+
+// Online backup of a live database. Each step copies pages_per_step pages
+// and then sleeps for pause, so the source connection is only locked for
+// short periods and writers keep going. When another connection writes to
+// the source, SQLite restarts the copy by itself; those restarts are counted.
+// A source that stays locked for longer than the busy timeout ends the backup
+// with SQLITE_BUSY.
+class SqliteBackup
+{
+public:
+    SqliteBackup(Sqlite& source, Sqlite& destination, int pages_per_step = 100,
+        std::chrono::milliseconds pause = std::chrono::milliseconds(10))
+        :source{source.getHandle()}, destination{destination.getHandle()},
+        pages_per_step{pages_per_step}, pause{pause}, busy_timeout{std::chrono::seconds(30)},
+        cancelled{false}, finished{false}, rc{SQLITE_OK}
+    {
+        this->state.remaining = -1;
+        this->state.pagecount = -1;
+        this->state.restarts = 0;
+        this->state.done = false;
+    }
+    ~SqliteBackup() {
+        cancel();
+        if(this->worker.joinable()) this->worker.join();
+    }
+    SqliteBackup(SqliteBackup const& copy) = delete;
+    SqliteBackup &operator = (const SqliteBackup &copy) = delete;
+
+    // How long steps may keep finding the source or destination locked
+    // before the backup gives up
+    void setBusyTimeout(std::chrono::milliseconds timeout) {
+        this->busy_timeout = timeout;
+    }
+
+    // Called on the backup thread after every step
+    void setProgressCallback(std::function<void(BackupProgress const&)> callback) {
+        this->callback = callback;
+    }
+
+    // Runs the backup on a background thread, once at a time
+    void start() {
+        if(this->worker.joinable()) {
+            SqliteException e(SQLITE_MISUSE, "Backup already started");
+            SQLITE3CPP_THROW(e);
+            return;
+        }
+        this->cancelled = false;
+        this->worker = std::thread(&SqliteBackup::copy, this);
+    }
+
+    // Waits for a backup started with start(), throws if it failed
+    void wait() {
+        if(this->worker.joinable()) this->worker.join();
+        check();
+    }
+
+    void cancel() {
+        this->cancelled = true;
+    }
+
+    // The whole database was copied
+    bool isDone() {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return this->finished && this->rc == SQLITE_OK;
+    }
+
+    // The backup ended, copied, failed or cancelled
+    bool isFinished() {
+        return this->finished.load();
+    }
+
+    // The backup ended without copying everything, wait() throws the reason
+    bool hasFailed() {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return this->finished && this->rc != SQLITE_OK;
+    }
+
+    BackupProgress progress() {
+        std::lock_guard<std::mutex> guard(this->lock);
+        return this->state;
+    }
+
+    // Runs the whole backup on the calling thread. An earlier cancel() does
+    // not carry over, the same object can back up again.
+    void run() {
+        this->cancelled = false;
+        copy();
+    }
+
+private:
+    void copy() {
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->finished = false;
+            this->rc = SQLITE_OK;
+        }
+        sqlite3_backup* backup = sqlite3_backup_init(this->destination, "main", this->source, "main");
+        if(!backup) {
+            finish(sqlite3_errcode(this->destination), sqlite3_errmsg(this->destination));
+            return;
+        }
+        int result = SQLITE_OK;
+        int last_remaining = -1;
+        bool busy = false;
+        std::chrono::steady_clock::time_point busy_since;
+        while(!this->cancelled) {
+            result = sqlite3_backup_step(backup, this->pages_per_step);
+            int remaining = sqlite3_backup_remaining(backup);
+            {
+                std::lock_guard<std::mutex> guard(this->lock);
+                // A step that copied pages without bringing remaining down started over
+                bool progressed = result == SQLITE_OK || result == SQLITE_DONE;
+                if(progressed && last_remaining >= 0 && remaining >= last_remaining) this->state.restarts++;
+                this->state.remaining = remaining;
+                this->state.pagecount = sqlite3_backup_pagecount(backup);
+                this->state.done = result == SQLITE_DONE;
+            }
+            if(result == SQLITE_OK || result == SQLITE_DONE) last_remaining = remaining;
+            if(this->callback) this->callback(progress());
+            if(result == SQLITE_DONE) break;
+            if(result != SQLITE_OK && result != SQLITE_BUSY && result != SQLITE_LOCKED) break;
+            if(result == SQLITE_OK) {
+                busy = false;
+            } else if(!busy) {
+                busy = true;
+                busy_since = std::chrono::steady_clock::now();
+            } else if(std::chrono::steady_clock::now() - busy_since >= this->busy_timeout) {
+                break;
+            }
+            // Without a pause a locked source is still not polled in a tight loop
+            if(busy && this->pause.count() == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            else std::this_thread::sleep_for(this->pause);
+        }
+        sqlite3_backup_finish(backup);
+        if(result == SQLITE_DONE) {
+            finish(SQLITE_OK, "");
+        } else if(this->cancelled) {
+            finish(SQLITE_ABORT, "Backup cancelled");
+        } else {
+            finish(result, sqlite3_errstr(result));
+        }
+    }
+
+    void finish(int result, std::string const& msg) {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->rc = result;
+        this->error = msg;
+        this->finished = true;
+    }
+
+    void check() {
+        std::lock_guard<std::mutex> guard(this->lock);
+        if(this->rc == SQLITE_OK) return;
+        SqliteException e(this->rc, "Backup failed: " + this->error);
+        SQLITE3CPP_THROW(e);
+    }
+
+    sqlite3* source;
+    sqlite3* destination;
+    int pages_per_step;
+    std::chrono::milliseconds pause;
+    std::chrono::milliseconds busy_timeout;
+    std::function<void(BackupProgress const&)> callback;
+    std::thread worker;
+    std::mutex lock;
+    BackupProgress state;
+    std::atomic<bool> cancelled;
+    std::atomic<bool> finished;
+    int rc;
+    std::string error;
+};
+
+#endif //SQLITE3CPP_BACKUP_H
@@ -0,0 +1,600 @@
+#ifndef SQLITE3CPP_CACHE_H
+#define SQLITE3CPP_CACHE_H
+// C++ includes
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+// Library includes
+#include "sqlite3cpp.h"
+
+
+// Rows of a query materialized in one buffer. Each cell is a type byte
+// followed by 8 bytes for numbers or a u32 length and the bytes for text
+// and blobs; NULL has no payload. Getters convert like sqlite3_column_*.
+class SqliteCachedRows
+{
+public:
+    SqliteCachedRows()
+        :ncolumns{0}, nrows{0} {}
+
+    size_t size() const {
+        return this->nrows;
+    }
+
+    int columns() const {
+        return this->ncolumns;
+    }
+
+    // SQLITE_INTEGER, SQLITE_FLOAT, SQLITE_TEXT, SQLITE_BLOB or SQLITE_NULL
+    int type(size_t row, int column) const {
+        return static_cast<unsigned char>(*cell(row, column));
+    }
+
+    sqlite3_int64 getInt64(size_t row, int column) const {
+        const char* c = cell(row, column);
+        switch(*c) {
+            case SQLITE_INTEGER: return number<sqlite3_int64>(c + 1);
+            case SQLITE_FLOAT: return static_cast<sqlite3_int64>(number<double>(c + 1));
+            case SQLITE_TEXT: return std::strtoll(getText(row, column).c_str(), NULL, 10);
+            default: return 0;
+        }
+    }
+
+    int getInt(size_t row, int column) const {
+        return static_cast<int>(getInt64(row, column));
+    }
+
+    double getDouble(size_t row, int column) const {
+        const char* c = cell(row, column);
+        switch(*c) {
+            case SQLITE_INTEGER: return static_cast<double>(number<sqlite3_int64>(c + 1));
+            case SQLITE_FLOAT: return number<double>(c + 1);
+            case SQLITE_TEXT: return std::strtod(getText(row, column).c_str(), NULL);
+            default: return 0.0;
+        }
+    }
+
+    // Numbers come out as text the way SQLite prints them
+    std::string getText(size_t row, int column) const {
+        const char* c = cell(row, column);
+        switch(*c) {
+            case SQLITE_TEXT:
+            case SQLITE_BLOB:
+                return std::string(c + 5, number<uint32_t>(c + 1));
+            case SQLITE_INTEGER:
+            case SQLITE_FLOAT: {
+                char* s = *c == SQLITE_INTEGER ? sqlite3_mprintf("%lld", number<sqlite3_int64>(c + 1))
+                    : sqlite3_mprintf("%!.15g", number<double>(c + 1));
+                std::string text = s ? s : "";
+                sqlite3_free(s);
+                return text;
+            }
+            default:
+                return std::string();
+        }
+    }
+
+    std::string getBlob(size_t row, int column) const {
+        return getText(row, column);
+    }
+
+    // Memory charged to the cache for these rows
+    size_t bytes() const {
+        return sizeof(*this) + this->data.capacity() + this->offsets.capacity() * sizeof(size_t);
+    }
+
+private:
+    friend class SqliteResultCache;
+
+    const char* cell(size_t row, int column) const {
+        return this->data.data() + this->offsets[row * this->ncolumns + column];
+    }
+
+    template<typename T>
+    static T number(const char* p) {
+        T t;
+        std::memcpy(&t, p, sizeof(T));
+        return t;
+    }
+
+    std::string data;
+    std::vector<size_t> offsets;
+    int ncolumns;
+    size_t nrows;
+};
+
+
+// Opt-in cache of query results for one connection, for repeated reads of
+// tables that rarely change. fetch() keys the rows by the SQL text and the
+// bound arguments; a repeated read is a hash lookup and shares the rows.
+//
+//   SqliteResultCache cache(db, 64 << 20);
+//   SqliteResultCache::Rows rows = cache.fetch("SELECT name FROM people WHERE team = ?", 7);
+//   for(size_t r = 0; r < rows->size(); ++r) std::cout << rows->getText(r, 0);
+//
+// The tables a query reads are found with the authorizer while it is
+// prepared. Every row changed through this connection bumps the version
+// of its table with the update hook, which drops the results that read
+// it; results read inside a transaction that has written are not kept,
+// and commit and rollback hooks close that window. Changes the update hook
+// does not report (WITHOUT ROWID tables, DELETE without WHERE), schema
+// changes and commits by other connections to the main database clear the
+// whole cache.
+//
+// Installing or removing an authorizer expires every prepared statement of
+// the connection. Each query the cache prepares for the first time
+// therefore makes all other statements of the connection, the wrapper's own
+// included, prepare again on their next step. That is free once the cache
+// is warm, but costly while new query texts keep arriving next to many live
+// statements.
+//
+// The cache takes over the update, commit, rollback and authorizer hooks
+// of the connection and has to be destroyed before it. Only cache queries
+// whose result depends on nothing but tables and arguments: not random(),
+// the current time or virtual tables.
+class SqliteResultCache
+{
+public:
+    typedef std::shared_ptr<const SqliteCachedRows> Rows;
+
+    SqliteResultCache(Sqlite& db, size_t budget = 16 << 20)
+        :db{db.getHandle()}, limit{budget}, used{0}, hit_count{0}, miss_count{0},
+        version_stmt{NULL}, schema_stmt{NULL}, schema{0}, data_version{0}, own_commits{0},
+        hooked_rows{0}, hooked_seen{0}, changes_seen{0}, txn_dirty{false}, preparing{NULL}
+    {
+        int rc = sqlite3_prepare_v3(this->db, "PRAGMA data_version", -1, SQLITE_PREPARE_PERSISTENT,
+            &this->version_stmt, NULL);
+        if(rc == SQLITE_OK) {
+            rc = sqlite3_prepare_v3(this->db, "PRAGMA schema_version", -1, SQLITE_PREPARE_PERSISTENT,
+                &this->schema_stmt, NULL);
+        }
+        if(rc != SQLITE_OK) {
+            // The destructor does not run for a constructor that throws
+            sqlite3_finalize(this->version_stmt);
+            this->version_stmt = NULL;
+            fail(rc, "Could not prepare change checks");
+            return;
+        }
+        this->schema = pragma(this->schema_stmt);
+        this->data_version = pragma(this->version_stmt);
+        this->changes_seen = sqlite3_total_changes64(this->db);
+        sqlite3_update_hook(this->db, &SqliteResultCache::xUpdate, this);
+        sqlite3_commit_hook(this->db, &SqliteResultCache::xCommit, this);
+        sqlite3_rollback_hook(this->db, &SqliteResultCache::xRollback, this);
+    }
+    ~SqliteResultCache() {
+        sqlite3_update_hook(this->db, NULL, NULL);
+        sqlite3_commit_hook(this->db, NULL, NULL);
+        sqlite3_rollback_hook(this->db, NULL, NULL);
+        finalizeStatements();
+        sqlite3_finalize(this->version_stmt);
+        sqlite3_finalize(this->schema_stmt);
+    }
+    SqliteResultCache(SqliteResultCache const& copy) = delete;
+    SqliteResultCache &operator = (const SqliteResultCache &copy) = delete;
+
+    // Rows of sql with args bound to its parameters in order. Arguments
+    // may be integers, floating point, std::string, const char*,
+    // std::vector<char> for blobs and nullptr for NULL.
+    template<typename... Args>
+    Rows fetch(std::string const& sql, Args const&... args) {
+        std::string params;
+        if(!encodeAll(params, args...)) {
+            fail(SQLITE_TOOBIG, "Argument too big");
+            return Rows();
+        }
+        std::string key = sql;
+        key += '\0';
+        key += params;
+
+        validate();
+        Index::iterator it = this->index.find(key);
+        if(it != this->index.end()) {
+            if(current(*it->second)) {
+                ++this->hit_count;
+                this->lru.splice(this->lru.begin(), this->lru, it->second);
+                return it->second->rows;
+            }
+            drop(it);
+        }
+        ++this->miss_count;
+        return load(sql, key, params);
+    }
+
+    // Drops every result, the budget is unchanged
+    void clear() {
+        this->index.clear();
+        this->lru.clear();
+        this->used = 0;
+    }
+
+    // Memory for the rows in bytes, older results are evicted to stay below it
+    void setBudget(size_t budget) {
+        this->limit = budget;
+        evict(0);
+    }
+
+    size_t budget() const {
+        return this->limit;
+    }
+
+    size_t bytes() const {
+        return this->used;
+    }
+
+    size_t entries() const {
+        return this->lru.size();
+    }
+
+    uint64_t hits() const {
+        return this->hit_count;
+    }
+
+    uint64_t misses() const {
+        return this->miss_count;
+    }
+
+private:
+    // A table read by some query, its version grows with every change
+    struct Table
+    {
+        std::string schema;
+        std::string name;
+        uint64_t version;
+    };
+
+    struct Statement
+    {
+        sqlite3_stmt* stmt;
+        std::vector<Table*> tables;
+        bool cacheable;
+    };
+
+    struct Entry
+    {
+        Rows rows;
+        std::vector<std::pair<Table*, uint64_t>> reads; // Table versions the rows belong to
+        size_t bytes;
+        const std::string* key;                          // Owned by the index
+    };
+
+    typedef std::list<Entry> Lru;
+    typedef std::unordered_map<std::string, Lru::iterator> Index;
+
+    // Cells of the key and of the rows share one encoding
+    static bool encode(std::string& out, std::nullptr_t) {
+        out += static_cast<char>(SQLITE_NULL);
+        return true;
+    }
+    template<typename T>
+    static typename std::enable_if<std::is_integral<T>::value, bool>::type encode(std::string& out, T t) {
+        appendNumber(out, SQLITE_INTEGER, static_cast<sqlite3_int64>(t));
+        return true;
+    }
+    template<typename T>
+    static typename std::enable_if<std::is_floating_point<T>::value, bool>::type encode(std::string& out, T t) {
+        appendNumber(out, SQLITE_FLOAT, static_cast<double>(t));
+        return true;
+    }
+    static bool encode(std::string& out, std::string const& s) {
+        return appendBytes(out, SQLITE_TEXT, s.data(), s.size());
+    }
+    static bool encode(std::string& out, const char* s) {
+        return appendBytes(out, SQLITE_TEXT, s, std::strlen(s));
+    }
+    static bool encode(std::string& out, std::vector<char> const& b) {
+        return appendBytes(out, SQLITE_BLOB, b.data(), b.size());
+    }
+
+    static bool encodeAll(std::string&) { return true; }
+    template<typename T, typename... Rest>
+    static bool encodeAll(std::string& out, T const& t, Rest const&... rest) {
+        return encode(out, t) && encodeAll(out, rest...);
+    }
+
+    template<typename T>
+    static void appendNumber(std::string& out, int type, T t) {
+        char bytes[sizeof(T)];
+        std::memcpy(bytes, &t, sizeof(T));
+        out += static_cast<char>(type);
+        out.append(bytes, sizeof(T));
+    }
+
+    // Lengths are stored in 32 bits and bound as int, longer values are
+    // refused rather than truncated
+    static bool appendBytes(std::string& out, int type, const void* data, size_t size) {
+        if(size > static_cast<size_t>(INT_MAX)) return false;
+        uint32_t n = static_cast<uint32_t>(size);
+        char bytes[sizeof(n)];
+        std::memcpy(bytes, &n, sizeof(n));
+        out += static_cast<char>(type);
+        out.append(bytes, sizeof(n));
+        if(size) out.append(static_cast<const char*>(data), size);
+        return true;
+    }
+
+    // Binds the encoded arguments, text and blobs point into params
+    static int bindAll(sqlite3_stmt* stmt, std::string const& params) {
+        const char* p = params.data();
+        const char* end = p + params.size();
+        for(int i = 1; p < end; ++i) {
+            int type = *p++;
+            int rc;
+            switch(type) {
+                case SQLITE_INTEGER:
+                    rc = sqlite3_bind_int64(stmt, i, SqliteCachedRows::number<sqlite3_int64>(p));
+                    p += 8;
+                    break;
+                case SQLITE_FLOAT:
+                    rc = sqlite3_bind_double(stmt, i, SqliteCachedRows::number<double>(p));
+                    p += 8;
+                    break;
+                case SQLITE_TEXT:
+                case SQLITE_BLOB: {
+                    uint32_t n = SqliteCachedRows::number<uint32_t>(p);
+                    p += 4;
+                    rc = type == SQLITE_TEXT ? sqlite3_bind_text(stmt, i, p, static_cast<int>(n), SQLITE_STATIC)
+                        : sqlite3_bind_blob(stmt, i, p, static_cast<int>(n), SQLITE_STATIC);
+                    p += n;
+                    break;
+                }
+                default:
+                    rc = sqlite3_bind_null(stmt, i);
+            }
+            if(rc != SQLITE_OK) return rc;
+        }
+        return SQLITE_OK;
+    }
+
+    // Catches what the hooks cannot see before a lookup
+    void validate() {
+        bool in_transaction = sqlite3_get_autocommit(this->db) == 0;
+        sqlite3_int64 changes = sqlite3_total_changes64(this->db);
+        // Triggers make the hook count more rows, never fewer
+        if(changes - this->changes_seen > static_cast<sqlite3_int64>(this->hooked_rows - this->hooked_seen)) {
+            clear();
+            // A rollback would undo these changes unseen
+            if(in_transaction) this->txn_dirty = true;
+        }
+        this->changes_seen = changes;
+        this->hooked_seen = this->hooked_rows;
+
+        // Moves only with commits of other connections
+        int version = pragma(this->version_stmt);
+        if(version != this->data_version) {
+            this->data_version = version;
+            clear();
+        }
+        // Schema changes of this connection leave no other trace
+        else if(this->own_commits == 0 && !in_transaction) return;
+        this->own_commits = 0;
+        int schema = pragma(this->schema_stmt);
+        if(schema != this->schema) {
+            this->schema = schema;
+            clear();
+            finalizeStatements();
+            if(in_transaction) this->txn_dirty = true;
+        }
+    }
+
+    bool current(Entry const& e) const {
+        for(size_t i = 0; i < e.reads.size(); ++i) {
+            if(e.reads[i].first->version != e.reads[i].second) return false;
+        }
+        return true;
+    }
+
+    void drop(Index::iterator it) {
+        this->used -= it->second->bytes;
+        this->lru.erase(it->second);
+        this->index.erase(it);
+    }
+
+    // Evicts the least recently used results until extra more bytes fit
+    void evict(size_t extra) {
+        while(!this->lru.empty() && this->used + extra > this->limit) {
+            drop(this->index.find(*this->lru.back().key));
+        }
+    }
+
+    Rows load(std::string const& sql, std::string const& key, std::string const& params) {
+        Statement* s = statement(sql);
+        if(!s) return Rows();
+        int rc = bindAll(s->stmt, params);
+        if(rc != SQLITE_OK) {
+            sqlite3_clear_bindings(s->stmt);
+            fail(rc, "Could not bind arguments");
+            return Rows();
+        }
+        std::shared_ptr<SqliteCachedRows> rows = std::make_shared<SqliteCachedRows>();
+        rows->ncolumns = sqlite3_column_count(s->stmt);
+        while((rc = sqlite3_step(s->stmt)) == SQLITE_ROW) {
+            for(int c = 0; c < rows->ncolumns; ++c) {
+                rows->offsets.push_back(rows->data.size());
+                if(!appendColumn(rows->data, s->stmt, c)) rc = SQLITE_TOOBIG;
+            }
+            if(rc != SQLITE_ROW) break;
+            ++rows->nrows;
+        }
+        sqlite3_reset(s->stmt);
+        // The arguments point into params
+        sqlite3_clear_bindings(s->stmt);
+        if(rc == SQLITE_TOOBIG) {
+            fail(rc, "Result value too big to cache");
+            return Rows();
+        }
+        if(rc != SQLITE_DONE) {
+            fail(rc, "Query failed");
+            return Rows();
+        }
+
+        // Rows read after this transaction wrote may be rolled back to a
+        // savepoint unseen, so they are only returned
+        rows->data.shrink_to_fit();
+        rows->offsets.shrink_to_fit();
+        Entry e;
+        e.rows = rows;
+        e.bytes = rows->bytes() + key.size() + sizeof(Entry);
+        if(!s->cacheable || this->txn_dirty || e.bytes > this->limit) return rows;
+        for(size_t i = 0; i < s->tables.size(); ++i) {
+            e.reads.push_back(std::make_pair(s->tables[i], s->tables[i]->version));
+        }
+        e.bytes += e.reads.size() * sizeof(e.reads[0]);
+        evict(e.bytes);
+        this->lru.push_front(e);
+        std::pair<Index::iterator, bool> added = this->index.insert(std::make_pair(key, this->lru.begin()));
+        this->lru.front().key = &added.first->first;
+        this->used += e.bytes;
+        return rows;
+    }
+
+    static bool appendColumn(std::string& out, sqlite3_stmt* stmt, int c) {
+        switch(sqlite3_column_type(stmt, c)) {
+            case SQLITE_INTEGER:
+                appendNumber(out, SQLITE_INTEGER, sqlite3_column_int64(stmt, c));
+                return true;
+            case SQLITE_FLOAT:
+                appendNumber(out, SQLITE_FLOAT, sqlite3_column_double(stmt, c));
+                return true;
+            case SQLITE_TEXT: {
+                const unsigned char* text = sqlite3_column_text(stmt, c);
+                return appendBytes(out, SQLITE_TEXT, text, static_cast<size_t>(sqlite3_column_bytes(stmt, c)));
+            }
+            case SQLITE_BLOB: {
+                const void* blob = sqlite3_column_blob(stmt, c);
+                return appendBytes(out, SQLITE_BLOB, blob, static_cast<size_t>(sqlite3_column_bytes(stmt, c)));
+            }
+            default:
+                out += static_cast<char>(SQLITE_NULL);
+                return true;
+        }
+    }
+
+    // Prepared statement of sql and the tables it reads, kept until the
+    // schema changes
+    Statement* statement(std::string const& sql) {
+        std::unordered_map<std::string, Statement>::iterator it = this->statements.find(sql);
+        if(it != this->statements.end()) return &it->second;
+
+        Statement s;
+        s.stmt = NULL;
+        s.cacheable = true;
+        this->preparing = &s;
+        sqlite3_set_authorizer(this->db, &SqliteResultCache::xAuthorize, this);
+        int rc = sqlite3_prepare_v3(this->db, sql.c_str(), static_cast<int>(sql.size()) + 1,
+            SQLITE_PREPARE_PERSISTENT, &s.stmt, NULL);
+        sqlite3_set_authorizer(this->db, NULL, NULL);
+        this->preparing = NULL;
+        if(rc != SQLITE_OK) {
+            fail(rc, "Could not prepare query");
+            return NULL;
+        }
+        if(!s.stmt) {
+            fail(SQLITE_MISUSE, "Query is empty");
+            return NULL;
+        }
+        s.cacheable = s.cacheable && sqlite3_stmt_readonly(s.stmt);
+        return &this->statements.insert(std::make_pair(sql, s)).first->second;
+    }
+
+    void finalizeStatements() {
+        for(std::unordered_map<std::string, Statement>::iterator it = this->statements.begin();
+            it != this->statements.end(); ++it) {
+            sqlite3_finalize(it->second.stmt);
+        }
+        this->statements.clear();
+    }
+
+    Table* findTable(const char* schema, const char* name) {
+        for(size_t i = 0; i < this->tables.size(); ++i) {
+            Table& t = *this->tables[i];
+            if(std::strcmp(t.name.c_str(), name) == 0 && std::strcmp(t.schema.c_str(), schema) == 0) return &t;
+        }
+        return NULL;
+    }
+
+    static int pragma(sqlite3_stmt* stmt) {
+        int value = 0;
+        if(sqlite3_step(stmt) == SQLITE_ROW) value = sqlite3_column_int(stmt, 0);
+        sqlite3_reset(stmt);
+        return value;
+    }
+
+    // Records the tables a statement reads while it is prepared. Anything
+    // but reading tables and calling functions keeps it out of the cache.
+    static int xAuthorize(void* data, int action, const char* table, const char*, const char* schema, const char*) {
+        SqliteResultCache* self = static_cast<SqliteResultCache*>(data);
+        Statement* s = self->preparing;
+        if(action == SQLITE_SELECT || action == SQLITE_FUNCTION || action == SQLITE_RECURSIVE) return SQLITE_OK;
+        if(action != SQLITE_READ || !table || !schema) {
+            s->cacheable = false;
+            return SQLITE_OK;
+        }
+        Table* t = self->findTable(schema, table);
+        if(!t) {
+            std::unique_ptr<Table> added(new Table());
+            added->schema = schema;
+            added->name = table;
+            added->version = 0;
+            t = added.get();
+            self->tables.push_back(std::move(added));
+        }
+        if(std::find(s->tables.begin(), s->tables.end(), t) == s->tables.end()) s->tables.push_back(t);
+        return SQLITE_OK;
+    }
+
+    // Tables no query reads have no results to drop
+    static void xUpdate(void* data, int, const char* schema, const char* table, sqlite3_int64) {
+        SqliteResultCache* self = static_cast<SqliteResultCache*>(data);
+        ++self->hooked_rows;
+        if(!sqlite3_get_autocommit(self->db)) self->txn_dirty = true;
+        Table* t = self->findTable(schema, table);
+        if(t) ++t->version;
+    }
+
+    static int xCommit(void* data) {
+        SqliteResultCache* self = static_cast<SqliteResultCache*>(data);
+        ++self->own_commits;
+        self->txn_dirty = false;
+        return 0;
+    }
+
+    static void xRollback(void* data) {
+        static_cast<SqliteResultCache*>(data)->txn_dirty = false;
+    }
+
+    void fail(int rc, std::string const& msg) {
+        SqliteException e(rc, msg + ": " + std::string(sqlite3_errmsg(this->db)));
+        SQLITE3CPP_THROW(e);
+    }
+
+    sqlite3* db;
+    size_t limit;
+    size_t used;
+    uint64_t hit_count;
+    uint64_t miss_count;
+    Lru lru;
+    Index index;
+    std::unordered_map<std::string, Statement> statements;
+    std::vector<std::unique_ptr<Table>> tables;
+    // Change tracking
+    sqlite3_stmt* version_stmt;
+    sqlite3_stmt* schema_stmt;
+    int schema;
+    int data_version;
+    unsigned own_commits;
+    uint64_t hooked_rows;
+    uint64_t hooked_seen;
+    sqlite3_int64 changes_seen;
+    bool txn_dirty;
+    Statement* preparing;
+};
+
+#endif //SQLITE3CPP_CACHE_H
@@ -0,0 +1,523 @@
+#ifndef SQLITE3CPP_CSV_H
+#define SQLITE3CPP_CSV_H
+// C++ includes
+#include <cerrno>
+#include <clocale>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+// Library includes
+#include "sqlite3cpp.h"
+
+
+struct CsvImportOptions
+{
+    char delimiter = ',';
+    bool header = true;               // First line holds the column names
+    unsigned threads = 0;             // Parser threads, 0 picks the core count
+    size_t chunk_size = 4 << 20;      // Bytes of input per parser work item
+    size_t batch_rows = 100000;       // Rows per transaction
+    bool bulk_pragmas = true;         // Relax durability while loading
+    bool defer_indexes = true;        // Drop the table's non-unique indexes and rebuild them at the end
+};
+
+
+// Loads a CSV file into a table. The file is mapped and cut into line
+// aligned chunks which parser threads split and type-convert in parallel.
+// The calling thread is the only writer; it inserts the parsed chunks in
+// file order through one prepared statement in large transactions.
+//
+// Fields are stored as INTEGER or REAL when they parse completely as one,
+// empty unquoted fields as NULL, everything else as TEXT. Numbers with a
+// leading zero such as zip codes stay TEXT. Chunks are cut at newlines, so
+// quoted fields must not contain line breaks.
+class CsvImporter
+{
+public:
+    CsvImporter(Sqlite& db, std::string const& table, CsvImportOptions const& options = CsvImportOptions())
+        :db{db.getHandle()}, table{table}, options{options} {}
+
+    // Returns the number of rows inserted
+    size_t importFile(std::string const& path) {
+        Input input;
+        if(!input.open(path)) {
+            SqliteException e(SQLITE_CANTOPEN, "Can't open '" + path + "'");
+            SQLITE3CPP_THROW(e);
+            return 0;
+        }
+        return importBuffer(input.data, input.size);
+    }
+
+    size_t importBuffer(const char* data, size_t size) {
+        const char* end = data + size;
+        const char* body = data;
+        std::vector<std::string> names;
+        if(size == 0) return 0;
+
+        // The first line decides the column count
+        Chunk first;
+        const char* line_end = nextLine(data, end);
+        parse(data, line_end, first);
+        if(first.error.size()) fail(-1, first.error);
+        size_t columns = first.fields.size();
+        if(this->options.header) {
+            for(size_t i = 0; i < columns; ++i) names.push_back(first.text(first.fields[i]));
+            body = line_end;
+        }
+
+        std::vector<Range> chunks = split(body, end);
+        Restore restore{*this};
+        prepareTable(names, columns);
+        size_t rows = run(chunks, columns);
+        finishTable();
+        return rows;
+    }
+
+private:
+    // Undoes prepareTable() on every way out of an import
+    struct Restore {
+        CsvImporter& importer;
+        ~Restore() { importer.restorePragmas(); }
+    };
+
+    enum FieldType { Null, Integer, Real, Text };
+
+    struct Field {
+        FieldType type;
+        sqlite3_int64 i;
+        double d;
+        const char* p;   // Text straight from the input
+        size_t offset;   // or, when p is NULL, unescaped text in the arena
+        size_t length;
+    };
+
+    struct Chunk {
+        std::vector<Field> fields;
+        std::string arena;
+        std::string error;
+        bool ready = false;
+
+        std::string text(Field const& f) const {
+            return f.p ? std::string(f.p, f.length) : this->arena.substr(f.offset, f.length);
+        }
+    };
+
+    struct Range {
+        const char* begin;
+        const char* end;
+    };
+
+    // Mapped (or read) input file
+    struct Input {
+        const char* data = NULL;
+        size_t size = 0;
+        std::string copy;
+#ifdef SQLITE3CPP_POSIX
+        void* map = NULL;
+
+        ~Input() {
+            if(this->map) munmap(this->map, this->size);
+        }
+#endif
+        bool open(std::string const& path) {
+#ifdef SQLITE3CPP_POSIX
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if(fd < 0) return false;
+            struct stat st;
+            if(fstat(fd, &st) == 0 && st.st_size > 0) {
+                void* m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if(m != MAP_FAILED) {
+                    madvise(m, st.st_size, MADV_SEQUENTIAL);
+                    this->map = m;
+                    this->data = static_cast<const char*>(m);
+                    this->size = st.st_size;
+                }
+            }
+            ::close(fd);
+            if(this->map) return true;
+#endif
+            std::ifstream in(path.c_str(), std::ios::binary);
+            if(!in) return false;
+            this->copy.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            this->data = this->copy.data();
+            this->size = this->copy.size();
+            return true;
+        }
+    };
+
+    static const char* nextLine(const char* p, const char* end) {
+        const char* nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        return nl ? nl + 1 : end;
+    }
+
+    std::vector<Range> split(const char* begin, const char* end) {
+        std::vector<Range> chunks;
+        while(begin < end) {
+            const char* stop = begin + this->options.chunk_size < end ? begin + this->options.chunk_size : end;
+            stop = stop < end ? nextLine(stop, end) : end;
+            Range r = { begin, stop };
+            chunks.push_back(r);
+            begin = stop;
+        }
+        return chunks;
+    }
+
+    static bool parseInteger(const char* p, size_t n, sqlite3_int64& out) {
+        size_t i = 0;
+        bool negative = false;
+        if(n && (p[0] == '-' || p[0] == '+')) { negative = p[0] == '-'; i = 1; }
+        // 19 digits fit in 64 bits unsigned, the sign decides the limit below
+        if(i == n || n - i > 19) return false;
+        uint64_t v = 0;
+        for(; i < n; ++i) {
+            if(p[i] < '0' || p[i] > '9') return false;
+            v = v * 10 + static_cast<uint64_t>(p[i] - '0');
+        }
+        const uint64_t max = static_cast<uint64_t>(INT64_MAX);
+        if(v > max + (negative ? 1 : 0)) return false;
+        out = negative ? static_cast<sqlite3_int64>(0 - v) : static_cast<sqlite3_int64>(v);
+        return true;
+    }
+
+    // "0123" and "-007.5", but not "0" or "0.5"
+    static bool leadingZero(const char* p, size_t n) {
+        size_t i = n && (p[0] == '-' || p[0] == '+') ? 1 : 0;
+        return i + 1 < n && p[i] == '0' && p[i + 1] >= '0' && p[i + 1] <= '9';
+    }
+
+    static size_t digits(const char* p, size_t i, size_t n) {
+        size_t start = i;
+        while(i < n && p[i] >= '0' && p[i] <= '9') ++i;
+        return i - start;
+    }
+
+    // Only [+-]digits[.digits][(e|E)[+-]digits], strtod() alone also takes
+    // hex, inf and nan. Values out of range stay text.
+    static bool parseReal(const char* p, size_t n, double& out) {
+        size_t i = n && (p[0] == '-' || p[0] == '+') ? 1 : 0;
+        size_t d = digits(p, i, n);
+        if(d == 0) return false;
+        i += d;
+        size_t point = n;
+        if(i < n && p[i] == '.') {
+            point = i;
+            d = digits(p, i + 1, n);
+            if(d == 0) return false;
+            i += d + 1;
+        }
+        if(i < n && (p[i] == 'e' || p[i] == 'E')) {
+            ++i;
+            if(i < n && (p[i] == '-' || p[i] == '+')) ++i;
+            d = digits(p, i, n);
+            if(d == 0) return false;
+            i += d;
+        }
+        if(i != n) return false;
+
+        // strtod() reads the decimal point of the current locale
+        char buffer[80];
+        const char* locale_point = std::localeconv()->decimal_point;
+        size_t point_size = std::strlen(locale_point);
+        if(n + point_size >= sizeof(buffer)) return false;
+        size_t size = 0;
+        for(i = 0; i < n; ++i) {
+            if(i == point) {
+                std::memcpy(buffer + size, locale_point, point_size);
+                size += point_size;
+            }
+            else {
+                buffer[size++] = p[i];
+            }
+        }
+        buffer[size] = '\0';
+        char* stop = NULL;
+        errno = 0;
+        out = std::strtod(buffer, &stop);
+        return stop == buffer + size && errno != ERANGE;
+    }
+
+    static void classify(Field& f, const char* p, size_t n) {
+        f.p = p;
+        f.offset = 0;
+        f.length = n;
+        if(n == 0) f.type = Null;
+        else if(leadingZero(p, n)) f.type = Text;
+        else if(parseInteger(p, n, f.i)) f.type = Integer;
+        else if(parseReal(p, n, f.d)) f.type = Real;
+        else f.type = Text;
+    }
+
+    // Splits [p, end) into fields, stopping at the chunk end
+    void parse(const char* p, const char* end, Chunk& chunk) {
+        const char delim = this->options.delimiter;
+        while(p < end) {
+            Field f;
+            if(*p == '"') {
+                // Quoted field, "" is an escaped quote
+                f.type = Text;
+                f.p = NULL;
+                f.offset = chunk.arena.size();
+                ++p;
+                while(p < end) {
+                    const char* q = static_cast<const char*>(std::memchr(p, '"', end - p));
+                    if(!q) { chunk.error = "Unterminated quoted CSV field"; return; }
+                    chunk.arena.append(p, q - p);
+                    p = q + 1;
+                    if(p < end && *p == '"') { chunk.arena.push_back('"'); ++p; }
+                    else break;
+                }
+                f.length = chunk.arena.size() - f.offset;
+            } else {
+                const char* start = p;
+                while(p < end && *p != delim && *p != '\n' && *p != '\r') ++p;
+                classify(f, start, p - start);
+            }
+            chunk.fields.push_back(f);
+            if(p < end && *p == delim) {
+                ++p;
+                // A trailing delimiter ends the line with an empty field
+                if(p == end || *p == '\n' || *p == '\r') {
+                    Field empty;
+                    classify(empty, p, 0);
+                    chunk.fields.push_back(empty);
+                }
+            }
+            if(p < end && *p == '\r') ++p;
+            if(p < end && *p == '\n') ++p;
+        }
+    }
+
+    // Parses each chunk on its own line by line, checking the column count
+    void parseChunk(Range const& range, size_t columns, Chunk& chunk) {
+        const char* p = range.begin;
+        while(p < range.end) {
+            const char* line_end = nextLine(p, range.end);
+            // Skip blank lines, a last line without newline is never blank
+            bool blank = (line_end - p == 1 && *p == '\n') || (line_end - p == 2 && p[0] == '\r' && p[1] == '\n');
+            if(!blank) {
+                size_t before = chunk.fields.size();
+                parse(p, line_end, chunk);
+                if(chunk.error.size()) return;
+                if(chunk.fields.size() - before != columns) {
+                    chunk.error = "CSV line has " + std::to_string(chunk.fields.size() - before)
+                        + " fields, expected " + std::to_string(columns);
+                    return;
+                }
+            }
+            p = line_end;
+        }
+    }
+
+    size_t run(std::vector<Range> const& ranges, size_t columns) {
+        unsigned threads = this->options.threads ? this->options.threads : std::thread::hardware_concurrency();
+        if(threads == 0) threads = 1;
+        // Bounds memory: parsers stay at most this many chunks ahead of the writer
+        const size_t window = threads * 2;
+
+        // Everything that can fail before the parsers start
+        sqlite3_stmt* insert = prepareInsert(columns);
+        int rc = sqlite3_exec(this->db, "BEGIN", 0, 0, 0);
+        if(rc != SQLITE_OK) {
+            sqlite3_finalize(insert);
+            fail(rc, "Sqlite had an error: " + std::string(sqlite3_errmsg(this->db)));
+            return 0;
+        }
+
+        std::vector<Chunk> chunks(ranges.size());
+        std::mutex lock;
+        std::condition_variable changed;
+        size_t next = 0, written = 0;
+        bool stop = false;
+
+        std::vector<std::thread> parsers;
+        for(unsigned t = 0; t < threads && t < ranges.size(); ++t) {
+            parsers.push_back(std::thread([&]() {
+                for(;;) {
+                    size_t index;
+                    {
+                        std::unique_lock<std::mutex> guard(lock);
+                        changed.wait(guard, [&]() { return stop || next >= ranges.size() || next < written + window; });
+                        if(stop || next >= ranges.size()) return;
+                        index = next++;
+                    }
+                    parseChunk(ranges[index], columns, chunks[index]);
+                    {
+                        std::lock_guard<std::mutex> guard(lock);
+                        chunks[index].ready = true;
+                    }
+                    changed.notify_all();
+                }
+            }));
+        }
+
+        size_t rows = 0, in_transaction = 0;
+        std::string error;
+        for(size_t c = 0; c < chunks.size() && rc == SQLITE_OK && error.empty(); ++c) {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                changed.wait(guard, [&]() { return chunks[c].ready; });
+            }
+            Chunk& chunk = chunks[c];
+            if(chunk.error.size()) {
+                error = chunk.error;
+                break;
+            }
+            for(size_t f = 0; f < chunk.fields.size() && rc == SQLITE_OK; f += columns) {
+                for(size_t col = 0; col < columns; ++col) bindField(insert, col + 1, chunk, chunk.fields[f + col]);
+                rc = sqlite3_step(insert);
+                rc = rc == SQLITE_DONE ? sqlite3_reset(insert) : rc;
+                ++rows;
+                if(++in_transaction == this->options.batch_rows && rc == SQLITE_OK) {
+                    rc = sqlite3_exec(this->db, "COMMIT", 0, 0, 0);
+                    if(rc == SQLITE_OK) rc = sqlite3_exec(this->db, "BEGIN", 0, 0, 0);
+                    in_transaction = 0;
+                }
+            }
+            // Release the parsed chunk and let the parsers move on
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                std::vector<Field>().swap(chunk.fields);
+                std::string().swap(chunk.arena);
+                written = c + 1;
+            }
+            changed.notify_all();
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stop = true;
+        }
+        changed.notify_all();
+        for(size_t t = 0; t < parsers.size(); ++t) parsers[t].join();
+
+        std::string message = rc != SQLITE_OK ? std::string(sqlite3_errmsg(this->db)) : error;
+        sqlite3_finalize(insert);
+        if(rc == SQLITE_OK && error.empty()) rc = sqlite3_exec(this->db, "COMMIT", 0, 0, 0);
+        if(rc != SQLITE_OK || error.size()) {
+            if(message.empty()) message = sqlite3_errmsg(this->db);
+            sqlite3_exec(this->db, "ROLLBACK", 0, 0, 0);
+            fail(rc != SQLITE_OK ? rc : -1, "CSV import failed: " + message);
+            return 0;
+        }
+        return rows;
+    }
+
+    void bindField(sqlite3_stmt* insert, int index, Chunk const& chunk, Field const& f) {
+        switch(f.type) {
+            case Null: sqlite3_bind_null(insert, index); break;
+            case Integer: sqlite3_bind_int64(insert, index, f.i); break;
+            case Real: sqlite3_bind_double(insert, index, f.d); break;
+            case Text: {
+                const char* text = f.p ? f.p : chunk.arena.data() + f.offset;
+                sqlite3_bind_text(insert, index, text, static_cast<int>(f.length), SQLITE_STATIC);
+                break;
+            }
+        }
+    }
+
+    std::string quoted(std::string const& name) {
+        std::string q = "\"";
+        for(size_t i = 0; i < name.size(); ++i) {
+            if(name[i] == '"') q += '"';
+            q += name[i];
+        }
+        return q + "\"";
+    }
+
+    sqlite3_stmt* prepareInsert(size_t columns) {
+        std::string sql = "INSERT INTO " + quoted(this->table) + " VALUES(";
+        for(size_t i = 0; i < columns; ++i) sql += i ? ",?" : "?";
+        sql += ")";
+        sqlite3_stmt* insert = NULL;
+        int rc = sqlite3_prepare_v2(this->db, sql.c_str(), -1, &insert, NULL);
+        if(rc != SQLITE_OK) fail(rc, "Could not prepare query: " + std::string(sqlite3_errmsg(this->db)));
+        return insert;
+    }
+
+    // Creates a missing table from the header, applies the bulk pragmas and
+    // drops the table's indexes until the load is done. Unique indexes stay,
+    // they have to reject duplicates while the rows go in.
+    void prepareTable(std::vector<std::string> const& names, size_t columns) {
+        if(!names.empty() && columns == names.size()) {
+            std::string sql = "CREATE TABLE IF NOT EXISTS " + quoted(this->table) + "(";
+            for(size_t i = 0; i < names.size(); ++i) sql += (i ? ", " : "") + quoted(names[i]);
+            execute(sql + ")");
+        }
+        this->saved_pragmas.clear();
+        if(this->options.bulk_pragmas) {
+            const char* pragmas[] = { "synchronous", "journal_mode", "cache_size", "temp_store" };
+            const char* values[] = { "OFF", "MEMORY", "-262144", "MEMORY" };
+            for(int i = 0; i < 4; ++i) {
+                this->saved_pragmas.push_back(std::make_pair(std::string(pragmas[i]), queryText(std::string("PRAGMA ") + pragmas[i])));
+                execute(std::string("PRAGMA ") + pragmas[i] + " = " + values[i]);
+            }
+        }
+        this->indexes.clear();
+        if(this->options.defer_indexes) {
+            sqlite3_stmt* s = NULL;
+            sqlite3_prepare_v2(this->db, "SELECT name, sql FROM sqlite_master AS m WHERE type = 'index' "
+                "AND tbl_name = ? AND sql IS NOT NULL AND NOT EXISTS (SELECT 1 FROM pragma_index_list(m.tbl_name) "
+                "AS l WHERE l.name = m.name AND l.\"unique\")", -1, &s, NULL);
+            sqlite3_bind_text(s, 1, this->table.c_str(), -1, SQLITE_TRANSIENT);
+            std::vector<std::string> names_to_drop;
+            while(sqlite3_step(s) == SQLITE_ROW) {
+                names_to_drop.push_back(reinterpret_cast<const char*>(sqlite3_column_text(s, 0)));
+                this->indexes.push_back(reinterpret_cast<const char*>(sqlite3_column_text(s, 1)));
+            }
+            sqlite3_finalize(s);
+            for(size_t i = 0; i < names_to_drop.size(); ++i) execute("DROP INDEX " + quoted(names_to_drop[i]));
+        }
+    }
+
+    // An index that fails to build stays listed, Restore tries it once more
+    void finishTable() {
+        while(!this->indexes.empty()) {
+            execute(this->indexes.back());
+            this->indexes.pop_back();
+        }
+    }
+
+    void restorePragmas() {
+        for(size_t i = 0; i < this->saved_pragmas.size(); ++i) {
+            sqlite3_exec(this->db, ("PRAGMA " + this->saved_pragmas[i].first + " = "
+                + this->saved_pragmas[i].second).c_str(), 0, 0, 0);
+        }
+        this->saved_pragmas.clear();
+        // Indexes dropped for the load come back even when it failed
+        for(size_t i = 0; i < this->indexes.size(); ++i) sqlite3_exec(this->db, this->indexes[i].c_str(), 0, 0, 0);
+        this->indexes.clear();
+    }
+
+    std::string queryText(std::string const& sql) {
+        sqlite3_stmt* s = NULL;
+        std::string value;
+        if(sqlite3_prepare_v2(this->db, sql.c_str(), -1, &s, NULL) == SQLITE_OK && sqlite3_step(s) == SQLITE_ROW) {
+            value = reinterpret_cast<const char*>(sqlite3_column_text(s, 0));
+        }
+        sqlite3_finalize(s);
+        return value;
+    }
+
+    void execute(std::string const& sql) {
+        int rc = sqlite3_exec(this->db, sql.c_str(), 0, 0, 0);
+        if(rc != SQLITE_OK) fail(rc, "Sqlite had an error: " + std::string(sqlite3_errmsg(this->db)));
+    }
+
+    void fail(int rc, std::string const& msg) {
+        SqliteException e(rc, msg);
+        SQLITE3CPP_THROW(e);
+    }
+
+    sqlite3* db;
+    std::string table;
+    CsvImportOptions options;
+    std::vector<std::pair<std::string, std::string> > saved_pragmas;
+    std::vector<std::string> indexes;
+};
+
+#endif //SQLITE3CPP_CSV_H
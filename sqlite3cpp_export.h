@@ -0,0 +1,347 @@
+#ifndef SQLITE3CPP_EXPORT_H
+#define SQLITE3CPP_EXPORT_H
+// C++ includes
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <vector>
+// Library includes
+#include "sqlite3cpp.h"
+
+
+enum class ExportFormat { Csv, JsonLines, Binary };
+
+struct ExportOptions
+{
+    char delimiter = ',';           // CSV only
+    bool header = true;             // CSV column names line
+    size_t buffer_size = 1 << 20;   // Bytes collected before each write
+};
+
+
+// Streams the rows of a query straight from sqlite3_column_* into one
+// reusable buffer which is written out in large blocks. No memory is
+// allocated per row or cell.
+//
+// Csv:       RFC 4180, NULL is an empty field, blobs are hex.
+// JsonLines: one object per row keyed by column name, blobs are hex strings.
+// Binary:    "SQ3B", u32 column count, then per column u32 length + name.
+//            Each row is the byte 1 followed by its cells, the stream ends
+//            with the byte 0. A cell is a type byte (0 NULL, 1 INTEGER,
+//            2 REAL, 3 TEXT, 4 BLOB) and then 8 bytes for numbers or a u32
+//            length + bytes for text and blobs. All integers little-endian.
+class ResultExporter
+{
+public:
+    ResultExporter(Sqlite& db, ExportFormat format, ExportOptions const& options = ExportOptions())
+        :db{db.getHandle()}, format{format}, options{options}, out{NULL}
+    {
+        this->buffer.reserve(options.buffer_size > 64 ? options.buffer_size : 64);
+    }
+
+    // Returns the number of rows written
+    size_t exportQuery(std::string const& sql, std::ostream& stream) {
+        sqlite3_stmt* stmt = NULL;
+        int rc = sqlite3_prepare_v2(this->db, sql.c_str(), -1, &stmt, NULL);
+        if(rc != SQLITE_OK) {
+            fail(rc, "Could not prepare query: " + std::string(sqlite3_errmsg(this->db)));
+            return 0;
+        }
+        this->out = &stream;
+        this->buffer.clear();
+        int columns = sqlite3_column_count(stmt);
+        begin(stmt, columns);
+        size_t rows = 0;
+        while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+            row(stmt, columns);
+            ++rows;
+        }
+        if(this->format == ExportFormat::Binary) put('\0');
+        flush();
+        this->out = NULL;
+        if(rc != SQLITE_DONE) {
+            std::string msg = sqlite3_errmsg(this->db);
+            sqlite3_finalize(stmt);
+            fail(rc, "Sqlite had an error: " + msg);
+            return rows;
+        }
+        sqlite3_finalize(stmt);
+        if(!stream) fail(SQLITE_IOERR, "Could not write export");
+        return rows;
+    }
+
+    size_t exportToFile(std::string const& sql, std::string const& path) {
+        std::ofstream file;
+        // The exporter already writes in large blocks
+        file.rdbuf()->pubsetbuf(NULL, 0);
+        file.open(path.c_str(), std::ios::binary | std::ios::trunc);
+        if(!file) {
+            fail(SQLITE_CANTOPEN, "Can't open '" + path + "'");
+            return 0;
+        }
+        return exportQuery(sql, file);
+    }
+
+private:
+    void begin(sqlite3_stmt* stmt, int columns) {
+        // JSON keys are escaped once per export, not per row
+        this->keys.clear();
+        switch(this->format) {
+            case ExportFormat::Csv: {
+                if(!this->options.header) break;
+                for(int c = 0; c < columns; ++c) {
+                    if(c) put(this->options.delimiter);
+                    const char* name = sqlite3_column_name(stmt, c);
+                    csvText(name, std::strlen(name));
+                }
+                put('\n');
+                break;
+            }
+            case ExportFormat::JsonLines: {
+                for(int c = 0; c < columns; ++c) {
+                    std::string key = c ? ",\"" : "{\"";
+                    for(const char* name = sqlite3_column_name(stmt, c); *name; ++name) {
+                        unsigned char ch = static_cast<unsigned char>(*name);
+                        if(ch == '"' || ch == '\\') key += '\\';
+                        if(ch < 0x20) key += ' ';
+                        else key += *name;
+                    }
+                    this->keys.push_back(key + "\":");
+                }
+                break;
+            }
+            case ExportFormat::Binary: {
+                append("SQ3B", 4);
+                putU32(columns);
+                for(int c = 0; c < columns; ++c) {
+                    const char* name = sqlite3_column_name(stmt, c);
+                    putU32(static_cast<uint32_t>(std::strlen(name)));
+                    append(name, std::strlen(name));
+                }
+                break;
+            }
+        }
+    }
+
+    void row(sqlite3_stmt* stmt, int columns) {
+        if(this->format == ExportFormat::Binary) put('\1');
+        for(int c = 0; c < columns; ++c) {
+            switch(this->format) {
+                case ExportFormat::Csv:
+                    if(c) put(this->options.delimiter);
+                    csvCell(stmt, c);
+                    break;
+                case ExportFormat::JsonLines:
+                    append(this->keys[c].data(), this->keys[c].size());
+                    jsonCell(stmt, c);
+                    break;
+                case ExportFormat::Binary:
+                    binaryCell(stmt, c);
+                    break;
+            }
+        }
+        if(this->format == ExportFormat::Csv) put('\n');
+        if(this->format == ExportFormat::JsonLines) append(columns ? "}\n" : "{}\n", columns ? 2 : 3);
+        if(this->buffer.size() >= this->options.buffer_size) flush();
+    }
+
+    void csvCell(sqlite3_stmt* stmt, int c) {
+        switch(sqlite3_column_type(stmt, c)) {
+            case SQLITE_NULL: break;
+            case SQLITE_INTEGER: putInteger(sqlite3_column_int64(stmt, c)); break;
+            case SQLITE_FLOAT: putReal(sqlite3_column_double(stmt, c)); break;
+            case SQLITE_BLOB: {
+                const void* blob = sqlite3_column_blob(stmt, c);
+                putHex(blob, sqlite3_column_bytes(stmt, c));
+                break;
+            }
+            default: {
+                const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, c));
+                csvText(text, sqlite3_column_bytes(stmt, c));
+            }
+        }
+    }
+
+    void csvText(const char* text, size_t n) {
+        bool quote = false;
+        for(size_t i = 0; i < n && !quote; ++i) {
+            char ch = text[i];
+            quote = ch == this->options.delimiter || ch == '"' || ch == '\n' || ch == '\r';
+        }
+        if(!quote) {
+            append(text, n);
+            return;
+        }
+        put('"');
+        const char* p = text;
+        const char* end = text + n;
+        while(p < end) {
+            const char* q = static_cast<const char*>(std::memchr(p, '"', end - p));
+            if(!q) { append(p, end - p); break; }
+            append(p, q - p + 1);
+            put('"');
+            p = q + 1;
+        }
+        put('"');
+    }
+
+    void jsonCell(sqlite3_stmt* stmt, int c) {
+        switch(sqlite3_column_type(stmt, c)) {
+            case SQLITE_NULL: append("null", 4); break;
+            case SQLITE_INTEGER: putInteger(sqlite3_column_int64(stmt, c)); break;
+            case SQLITE_FLOAT: {
+                double d = sqlite3_column_double(stmt, c);
+                if(std::isfinite(d)) putReal(d);
+                else append("null", 4);
+                break;
+            }
+            case SQLITE_BLOB: {
+                const void* blob = sqlite3_column_blob(stmt, c);
+                put('"');
+                putHex(blob, sqlite3_column_bytes(stmt, c));
+                put('"');
+                break;
+            }
+            default: {
+                const char* text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, c));
+                put('"');
+                jsonEscape(text, sqlite3_column_bytes(stmt, c));
+                put('"');
+            }
+        }
+    }
+
+    void jsonEscape(const char* text, size_t n) {
+        static const char hex[] = "0123456789abcdef";
+        size_t run = 0;
+        for(size_t i = 0; i < n; ++i) {
+            unsigned char ch = static_cast<unsigned char>(text[i]);
+            if(ch >= 0x20 && ch != '"' && ch != '\\') continue;
+            append(text + run, i - run);
+            run = i + 1;
+            switch(ch) {
+                case '"': append("\\\"", 2); break;
+                case '\\': append("\\\\", 2); break;
+                case '\n': append("\\n", 2); break;
+                case '\r': append("\\r", 2); break;
+                case '\t': append("\\t", 2); break;
+                default: {
+                    char esc[6] = { '\\', 'u', '0', '0', hex[ch >> 4], hex[ch & 15] };
+                    append(esc, 6);
+                }
+            }
+        }
+        append(text + run, n - run);
+    }
+
+    void binaryCell(sqlite3_stmt* stmt, int c) {
+        int type = sqlite3_column_type(stmt, c);
+        switch(type) {
+            case SQLITE_NULL: put('\0'); break;
+            case SQLITE_INTEGER: {
+                put('\1');
+                putU64(static_cast<uint64_t>(sqlite3_column_int64(stmt, c)));
+                break;
+            }
+            case SQLITE_FLOAT: {
+                double d = sqlite3_column_double(stmt, c);
+                uint64_t bits;
+                std::memcpy(&bits, &d, sizeof(bits));
+                put('\2');
+                putU64(bits);
+                break;
+            }
+            default: {
+                const void* data = type == SQLITE_BLOB ? sqlite3_column_blob(stmt, c) : sqlite3_column_text(stmt, c);
+                uint32_t n = static_cast<uint32_t>(sqlite3_column_bytes(stmt, c));
+                put(type == SQLITE_BLOB ? '\4' : '\3');
+                putU32(n);
+                append(static_cast<const char*>(data), n);
+            }
+        }
+    }
+
+    void putInteger(sqlite3_int64 v) {
+        char digits[24];
+        char* p = digits + sizeof(digits);
+        uint64_t u = v < 0 ? 0 - static_cast<uint64_t>(v) : static_cast<uint64_t>(v);
+        do {
+            *--p = static_cast<char>('0' + u % 10);
+            u /= 10;
+        } while(u);
+        if(v < 0) *--p = '-';
+        append(p, digits + sizeof(digits) - p);
+    }
+
+    // Shortest of 15 or 17 significant digits that reads back exactly,
+    // whole numbers keep a ".0" so they still read as REAL
+    void putReal(double d) {
+        char text[32];
+        int n = std::snprintf(text, sizeof(text), "%.15g", d);
+        if(std::strtod(text, NULL) != d) n = std::snprintf(text, sizeof(text), "%.17g", d);
+        if(!std::strpbrk(text, ".eEn")) {
+            text[n++] = '.';
+            text[n++] = '0';
+        }
+        append(text, n);
+    }
+
+    void putHex(const void* data, size_t n) {
+        static const char hex[] = "0123456789abcdef";
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        for(size_t i = 0; i < n; ++i) {
+            char pair[2] = { hex[p[i] >> 4], hex[p[i] & 15] };
+            append(pair, 2);
+        }
+    }
+
+    void putU32(uint32_t v) {
+        char b[4] = { char(v), char(v >> 8), char(v >> 16), char(v >> 24) };
+        append(b, 4);
+    }
+
+    void putU64(uint64_t v) {
+        putU32(static_cast<uint32_t>(v));
+        putU32(static_cast<uint32_t>(v >> 32));
+    }
+
+    void put(char ch) {
+        if(this->buffer.size() == this->buffer.capacity()) flush();
+        this->buffer.push_back(ch);
+    }
+
+    void append(const char* data, size_t n) {
+        if(this->buffer.size() + n > this->buffer.capacity()) {
+            flush();
+            // Cells bigger than the buffer bypass it
+            if(n > this->buffer.capacity() && this->out) {
+                this->out->write(data, n);
+                return;
+            }
+        }
+        this->buffer.insert(this->buffer.end(), data, data + n);
+    }
+
+    void flush() {
+        if(this->out && !this->buffer.empty()) this->out->write(this->buffer.data(), this->buffer.size());
+        this->buffer.clear();
+    }
+
+    void fail(int rc, std::string const& msg) {
+        SqliteException e(rc, msg);
+        SQLITE3CPP_THROW(e);
+    }
+
+    sqlite3* db;
+    ExportFormat format;
+    ExportOptions options;
+    std::ostream* out;
+    std::vector<char> buffer;
+    std::vector<std::string> keys;
+};
+
+#endif //SQLITE3CPP_EXPORT_H
@@ -0,0 +1,137 @@
+#ifndef SQLITE3CPP_LOOKUP_H
+#define SQLITE3CPP_LOOKUP_H
+// C++ includes
+#include <algorithm>
+#include <string>
+#include <tuple>
+#include <vector>
+// Library includes
+#include "sqlite3cpp.h"
+
+
+// Answers a burst of point lookups with one query per batch instead of one
+// step/reset cycle per key. The query returns the key in its first column
+// and takes the keys through carray(?), for example
+//
+//   SqliteLookup<int64_t, std::string, double> people(db,
+//       "SELECT id, name, score FROM people WHERE id IN carray(?)");
+//   std::vector<SqliteLookup<int64_t, std::string, double>::Result> r = people.multi_get(ids);
+//
+// The remaining columns are read as Columns (see SqliteValue). Results come
+// back in the order of the keys, a key without a row has found == false.
+// The statement is prepared once and owned by the lookup, so it does not
+// disturb the query of the connection.
+template<typename Key, typename... Columns>
+class SqliteLookup
+{
+public:
+    typedef std::tuple<Columns...> Row;
+
+    struct Result
+    {
+        bool found;
+        Row row;
+    };
+
+    // Lists longer than max_batch keys are split over several queries
+    SqliteLookup(Sqlite& db, std::string const& query, size_t max_batch = 256)
+        :db{db.getHandle()}, stmt{NULL}, max_batch{max_batch ? max_batch : 1}
+    {
+        int rc = sqlite3_prepare_v3(this->db, query.c_str(), -1, SQLITE_PREPARE_PERSISTENT, &this->stmt, NULL);
+        if(rc != SQLITE_OK) {
+            fail(rc, "Could not prepare lookup");
+            return;
+        }
+        if(sqlite3_column_count(this->stmt) < static_cast<int>(sizeof...(Columns)) + 1) {
+            // The destructor does not run for a constructor that throws
+            sqlite3_finalize(this->stmt);
+            this->stmt = NULL;
+            SqliteException e(SQLITE_RANGE, "Lookup query returns fewer columns than the key and the row");
+            SQLITE3CPP_THROW(e);
+        }
+    }
+    ~SqliteLookup() {
+        sqlite3_finalize(this->stmt);
+    }
+    SqliteLookup(SqliteLookup const& copy) = delete;
+    SqliteLookup &operator = (const SqliteLookup &copy) = delete;
+
+    void setMaxBatch(size_t max_batch) {
+        this->max_batch = max_batch ? max_batch : 1;
+    }
+
+    size_t maxBatch() const {
+        return this->max_batch;
+    }
+
+    std::vector<Result> multi_get(std::vector<Key> const& keys) {
+        std::vector<Result> results;
+        multi_get(keys.data(), keys.size(), results);
+        return results;
+    }
+
+    // Fills results, whose storage is reused between calls
+    void multi_get(const Key* keys, size_t count, std::vector<Result>& results) {
+        results.assign(count, Result());
+        for(size_t begin = 0; begin < count; begin += this->max_batch) {
+            batch(keys + begin, std::min(this->max_batch, count - begin), &results[begin]);
+        }
+    }
+
+private:
+    // Orders positions by the key they hold, and finds them by key
+    struct ByKey
+    {
+        const Key* keys;
+        bool operator()(size_t a, size_t b) const { return this->keys[a] < this->keys[b]; }
+        bool operator()(size_t a, Key const& k) const { return this->keys[a] < k; }
+        bool operator()(Key const& k, size_t b) const { return k < this->keys[b]; }
+    };
+
+    // Rows come back in any order, so each one finds the positions of its
+    // key, all of them for a repeated key, by binary search
+    void batch(const Key* keys, size_t count, Result* results) {
+        ByKey by_key{keys};
+        this->order.resize(count);
+        for(size_t i = 0; i < count; ++i) this->order[i] = i;
+        std::sort(this->order.begin(), this->order.end(), by_key);
+
+        int rc = SqliteArray::bind(this->stmt, 1, keys, count);
+        if(rc != SQLITE_OK) {
+            fail(rc, "Could not bind lookup keys");
+            return;
+        }
+        while((rc = sqlite3_step(this->stmt)) == SQLITE_ROW) {
+            Key key = SqliteValue<Key>::get(sqlite3_column_value(this->stmt, 0));
+            std::pair<std::vector<size_t>::iterator, std::vector<size_t>::iterator> match =
+                std::equal_range(this->order.begin(), this->order.end(), key, by_key);
+            if(match.first == match.second) continue;
+            Row row = read(typename SqliteMakeIndices<sizeof...(Columns)>::type());
+            for(std::vector<size_t>::iterator i = match.first; i != match.second; ++i) {
+                results[*i].found = true;
+                results[*i].row = row;
+            }
+        }
+        sqlite3_reset(this->stmt);
+        // Frees the copy of the keys now rather than at the next batch
+        sqlite3_clear_bindings(this->stmt);
+        if(rc != SQLITE_DONE) fail(rc, "Lookup failed");
+    }
+
+    template<size_t... I>
+    Row read(SqliteIndices<I...>) {
+        return Row(SqliteValue<Columns>::get(sqlite3_column_value(this->stmt, static_cast<int>(I) + 1))...);
+    }
+
+    void fail(int rc, std::string const& msg) {
+        SqliteException e(rc, msg + ": " + std::string(sqlite3_errmsg(this->db)));
+        SQLITE3CPP_THROW(e);
+    }
+
+    sqlite3* db;
+    sqlite3_stmt* stmt;
+    size_t max_batch;
+    std::vector<size_t> order;
+};
+
+#endif //SQLITE3CPP_LOOKUP_H
@@ -0,0 +1,402 @@
+#ifndef SQLITE3CPP_MEMORY_H
+#define SQLITE3CPP_MEMORY_H
+// C++ includes
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+// Library includes
+#include "sqlite3cpp.h"
+
+
+struct SqliteAllocatorStats
+{
+    uint64_t allocations;             // Calls to xMalloc and growing xRealloc
+    uint64_t pool_hits;               // Served from a size-class free list
+    uint64_t pool_refills;            // Free list was empty and a new slab was carved
+    uint64_t large_allocations;       // Too big for any size class, went to malloc
+    sqlite3_int64 pagecache_used;     // Pages in use from the SQLITE_CONFIG_PAGECACHE buffer
+    sqlite3_int64 pagecache_overflow; // Bytes of page cache that did not fit in the buffer
+
+    double hitRate() const {
+        return this->allocations ? static_cast<double>(this->pool_hits) / this->allocations : 0.0;
+    }
+};
+
+
+// Process wide SQLite memory configuration. All use*() functions have to be
+// called before the first Sqlite is constructed, SQLite refuses to change its
+// allocator once initialized.
+class SqliteMemory
+{
+public:
+    // Routes SQLite allocations through size-class pools (32 bytes up to
+    // 16 KiB) which are carved from slabs of slab_size bytes. Freed blocks go
+    // back to their pool instead of the system allocator, which keeps long
+    // running processes from fragmenting the heap.
+    static void usePoolAllocator(size_t slab_size = 64 * 1024) {
+        Pools& p = pools();
+        p.slab_size = slab_size;
+        saveDefault();
+        sqlite3_mem_methods methods = {
+            &SqliteMemory::xMalloc, &SqliteMemory::xFree, &SqliteMemory::xRealloc,
+            &SqliteMemory::xSize, &SqliteMemory::xRoundup, &SqliteMemory::xInit,
+            &SqliteMemory::xShutdown, NULL
+        };
+        check(sqlite3_config(SQLITE_CONFIG_MALLOC, &methods), "Could not install pool allocator");
+    }
+
+    // Restores the allocator SQLite had before usePoolAllocator()
+    static void useDefaultAllocator() {
+        saveDefault();
+        check(sqlite3_config(SQLITE_CONFIG_MALLOC, &defaultMethods()), "Could not restore default allocator");
+    }
+
+    // Gives the page cache a preallocated buffer of pages pages. page_size is
+    // the database page size, the per page header is added here.
+    static void usePageCache(int page_size, int pages) {
+        int header = 0;
+        check(sqlite3_config(SQLITE_CONFIG_PCACHE_HDRSZ, &header), "Could not query page cache header size");
+        int slot = page_size + header;
+        std::unique_ptr<char[]>& buffer = pageCacheBuffer();
+        std::unique_ptr<char[]> fresh(new char[static_cast<size_t>(slot) * pages]);
+        check(sqlite3_config(SQLITE_CONFIG_PAGECACHE, fresh.get(), slot, pages), "Could not configure page cache");
+        buffer.swap(fresh);
+    }
+
+    // Takes the page cache back to the heap and frees the buffer of
+    // usePageCache(). Call sqlite3_shutdown() first.
+    static void useDefaultPageCache() {
+        check(sqlite3_config(SQLITE_CONFIG_PAGECACHE, NULL, 0, 0), "Could not reset page cache");
+        pageCacheBuffer().reset();
+    }
+
+    // Hands SQLite a single preallocated heap of bytes bytes. Requires a
+    // SQLite built with SQLITE_ENABLE_MEMSYS5, otherwise this throws.
+    static void useHeap(size_t bytes, int min_alloc) {
+        std::unique_ptr<char[]>& buffer = heapBuffer();
+        std::unique_ptr<char[]> fresh(new char[bytes]);
+        check(sqlite3_config(SQLITE_CONFIG_HEAP, fresh.get(), static_cast<int>(bytes), min_alloc),
+            "Could not configure heap");
+        buffer.swap(fresh);
+    }
+
+    static SqliteAllocatorStats stats() {
+        Pools& p = pools();
+        SqliteAllocatorStats s;
+        s.allocations = p.allocations.load();
+        s.pool_hits = p.pool_hits.load();
+        s.pool_refills = p.pool_refills.load();
+        s.large_allocations = p.large_allocations.load();
+        sqlite3_int64 high = 0;
+        sqlite3_status64(SQLITE_STATUS_PAGECACHE_USED, &s.pagecache_used, &high, 0);
+        sqlite3_status64(SQLITE_STATUS_PAGECACHE_OVERFLOW, &s.pagecache_overflow, &high, 0);
+        return s;
+    }
+
+private:
+    static const int min_shift = 5;   // 32 bytes
+    static const int class_count = 10; // up to 16 KiB
+    static const size_t header = 16;  // Keeps blocks 16 byte aligned
+
+    struct FreeBlock { FreeBlock* next; };
+
+    struct Pool {
+        std::mutex lock;
+        FreeBlock* free = NULL;
+    };
+
+    struct Pools {
+        Pool classes[class_count];
+        std::mutex slab_lock;
+        std::vector<void*> slabs;
+        size_t slab_size = 64 * 1024;
+        std::atomic<uint64_t> allocations{0};
+        std::atomic<uint64_t> pool_hits{0};
+        std::atomic<uint64_t> pool_refills{0};
+        std::atomic<uint64_t> large_allocations{0};
+    };
+
+    static Pools& pools() {
+        static Pools p;
+        return p;
+    }
+
+    static sqlite3_mem_methods& defaultMethods() {
+        static sqlite3_mem_methods m;
+        return m;
+    }
+
+    static void saveDefault() {
+        static bool saved = false;
+        if(saved) return;
+        check(sqlite3_config(SQLITE_CONFIG_GETMALLOC, &defaultMethods()), "Could not read default allocator");
+        saved = true;
+    }
+
+    static std::unique_ptr<char[]>& pageCacheBuffer() {
+        static std::unique_ptr<char[]> buffer;
+        return buffer;
+    }
+
+    static std::unique_ptr<char[]>& heapBuffer() {
+        static std::unique_ptr<char[]> buffer;
+        return buffer;
+    }
+
+    static void check(int rc, const char* context) {
+        if(rc == SQLITE_OK) return;
+        SqliteException e(rc, std::string(context) + ": " + sqlite3_errstr(rc));
+        SQLITE3CPP_THROW(e);
+    }
+
+    // Size class of n bytes, or -1 when n is served by malloc directly
+    static int sizeClass(size_t n) {
+        size_t size = size_t(1) << min_shift;
+        for(int c = 0; c < class_count; ++c, size <<= 1) {
+            if(n <= size) return c;
+        }
+        return -1;
+    }
+
+    static size_t classSize(int c) {
+        return size_t(1) << (c + min_shift);
+    }
+
+    // Every block starts with a header holding its usable size
+    static void* toUser(void* block, size_t size) {
+        *static_cast<size_t*>(block) = size;
+        return static_cast<char*>(block) + header;
+    }
+
+    static void* toBlock(void* p) {
+        return static_cast<char*>(p) - header;
+    }
+
+    static void* xMalloc(int n) {
+        Pools& p = pools();
+        p.allocations++;
+        int c = sizeClass(n);
+        if(c < 0) {
+            p.large_allocations++;
+            void* block = std::malloc(header + n);
+            return block ? toUser(block, n) : NULL;
+        }
+        Pool& pool = p.classes[c];
+        {
+            std::lock_guard<std::mutex> guard(pool.lock);
+            if(pool.free) {
+                FreeBlock* block = pool.free;
+                pool.free = block->next;
+                p.pool_hits++;
+                return toUser(block, classSize(c));
+            }
+        }
+        return refill(c);
+    }
+
+    // Carves a new slab into blocks of class c and returns the first one
+    static void* refill(int c) {
+        Pools& p = pools();
+        p.pool_refills++;
+        size_t stride = header + classSize(c);
+        size_t count = p.slab_size / stride;
+        if(count < 1) count = 1;
+        char* slab = static_cast<char*>(std::malloc(stride * count));
+        if(!slab) return NULL;
+        {
+            std::lock_guard<std::mutex> guard(p.slab_lock);
+            p.slabs.push_back(slab);
+        }
+        Pool& pool = p.classes[c];
+        std::lock_guard<std::mutex> guard(pool.lock);
+        for(size_t i = 1; i < count; ++i) {
+            FreeBlock* block = reinterpret_cast<FreeBlock*>(slab + i * stride);
+            block->next = pool.free;
+            pool.free = block;
+        }
+        return toUser(slab, classSize(c));
+    }
+
+    static void xFree(void* ptr) {
+        if(!ptr) return;
+        void* block = toBlock(ptr);
+        int c = sizeClass(*static_cast<size_t*>(block));
+        if(c < 0 || classSize(c) != *static_cast<size_t*>(block)) {
+            std::free(block);
+            return;
+        }
+        Pool& pool = pools().classes[c];
+        std::lock_guard<std::mutex> guard(pool.lock);
+        FreeBlock* fb = static_cast<FreeBlock*>(block);
+        fb->next = pool.free;
+        pool.free = fb;
+    }
+
+    static void* xRealloc(void* ptr, int n) {
+        int old_size = xSize(ptr);
+        if(n <= old_size && sizeClass(old_size) >= 0) return ptr;
+        void* fresh = xMalloc(n);
+        if(!fresh) return NULL;
+        std::memcpy(fresh, ptr, old_size < n ? old_size : n);
+        xFree(ptr);
+        return fresh;
+    }
+
+    static int xSize(void* ptr) {
+        return ptr ? static_cast<int>(*static_cast<size_t*>(toBlock(ptr))) : 0;
+    }
+
+    static int xRoundup(int n) {
+        int c = sizeClass(n);
+        return c < 0 ? (n + 7) & ~7 : static_cast<int>(classSize(c));
+    }
+
+    static int xInit(void*) {
+        return SQLITE_OK;
+    }
+
+    // SQLite has released every allocation by now, so the slabs can go
+    static void xShutdown(void*) {
+        Pools& p = pools();
+        for(int c = 0; c < class_count; ++c) {
+            std::lock_guard<std::mutex> guard(p.classes[c].lock);
+            p.classes[c].free = NULL;
+        }
+        std::lock_guard<std::mutex> guard(p.slab_lock);
+        for(size_t i = 0; i < p.slabs.size(); ++i) std::free(p.slabs[i]);
+        p.slabs.clear();
+    }
+};
+
+
+// Keeps SQLite inside a memory budget. The soft and hard heap limits are set
+// for the lifetime of the governor and restored afterwards. relieve() is meant
+// to be called periodically; when memory is under pressure it makes the idle
+// tracked connections drop their caches and reports what was reclaimed.
+class SqliteMemoryGovernor
+{
+public:
+    SqliteMemoryGovernor(sqlite3_int64 soft_limit, sqlite3_int64 hard_limit)
+        :soft_limit{soft_limit}, reclaimed{0}, relief_runs{0}
+    {
+        this->old_soft = sqlite3_soft_heap_limit64(soft_limit);
+        this->old_hard = sqlite3_hard_heap_limit64(hard_limit);
+    }
+    ~SqliteMemoryGovernor() {
+        sqlite3_soft_heap_limit64(this->old_soft);
+        sqlite3_hard_heap_limit64(this->old_hard);
+    }
+    SqliteMemoryGovernor(SqliteMemoryGovernor const& copy) = delete;
+    SqliteMemoryGovernor &operator = (const SqliteMemoryGovernor &copy) = delete;
+
+    void track(Sqlite* db) {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->connections.push_back(db);
+    }
+
+    void untrack(Sqlite* db) {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->connections.erase(std::remove(this->connections.begin(), this->connections.end(), db),
+            this->connections.end());
+    }
+
+    // Also treat the cgroup as under pressure when memory.current passes
+    // usage_fraction of memory.max, or when the "some" avg10 of
+    // memory.pressure passes psi_avg10 percent. A negative value disables
+    // that signal. Missing files are ignored.
+    void useCgroup(std::string const& path, double usage_fraction, double psi_avg10) {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->cgroup = path;
+        this->cgroup_fraction = usage_fraction;
+        this->psi_threshold = psi_avg10;
+    }
+
+    bool underPressure() {
+        if(sqlite3_memory_used() >= this->soft_limit) return true;
+        std::string path;
+        double fraction, psi;
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            path = this->cgroup;
+            fraction = this->cgroup_fraction;
+            psi = this->psi_threshold;
+        }
+        if(path.empty()) return false;
+        if(fraction >= 0) {
+            sqlite3_int64 current = readNumber(path + "/memory.current");
+            sqlite3_int64 max = readNumber(path + "/memory.max");
+            if(current > 0 && max > 0 && current >= fraction * max) return true;
+        }
+        if(psi >= 0 && readPressure(path + "/memory.pressure") >= psi) return true;
+        return false;
+    }
+
+    // Releases memory on idle connections when under pressure. Returns the
+    // number of bytes SQLite gave back.
+    sqlite3_int64 relieve() {
+        if(!underPressure()) return 0;
+        sqlite3_int64 before = sqlite3_memory_used();
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            for(size_t i = 0; i < this->connections.size(); ++i) {
+                if(this->connections[i]->isIdle()) this->connections[i]->releaseMemory();
+            }
+        }
+        sqlite3_int64 freed = before - sqlite3_memory_used();
+        if(freed < 0) freed = 0;
+        this->reclaimed += freed;
+        this->relief_runs++;
+        return freed;
+    }
+
+    sqlite3_int64 reclaimedBytes() {
+        return this->reclaimed.load();
+    }
+
+    uint64_t reliefCount() {
+        return this->relief_runs.load();
+    }
+
+private:
+    // Value of a single number file, or -1 for "max" and unreadable files
+    static sqlite3_int64 readNumber(std::string const& file) {
+        std::ifstream in(file.c_str());
+        sqlite3_int64 value = -1;
+        if(!(in >> value)) return -1;
+        return value;
+    }
+
+    // The avg10 of the "some" line of a PSI file, or -1
+    static double readPressure(std::string const& file) {
+        std::ifstream in(file.c_str());
+        std::string kind, field;
+        while(in >> kind) {
+            if(kind != "some") {
+                std::getline(in, field);
+                continue;
+            }
+            in >> field;
+            if(field.compare(0, 6, "avg10=") == 0) return std::atof(field.c_str() + 6);
+            return -1;
+        }
+        return -1;
+    }
+
+    std::mutex lock;
+    std::vector<Sqlite*> connections;
+    sqlite3_int64 soft_limit;
+    sqlite3_int64 old_soft, old_hard;
+    std::string cgroup;
+    double cgroup_fraction = -1;
+    double psi_threshold = -1;
+    std::atomic<sqlite3_int64> reclaimed;
+    std::atomic<uint64_t> relief_runs;
+};
+
+#endif //SQLITE3CPP_MEMORY_H
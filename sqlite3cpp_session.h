@@ -0,0 +1,244 @@
+#ifndef SQLITE3CPP_SESSION_H
+#define SQLITE3CPP_SESSION_H
+// The session functions are only declared by sqlite3.h with these macros.
+// Define them for the whole build, or include this header before any other
+// header that includes sqlite3.h.
+#ifndef SQLITE_ENABLE_SESSION
+#define SQLITE_ENABLE_SESSION
+#endif
+#ifndef SQLITE_ENABLE_PREUPDATE_HOOK
+#define SQLITE_ENABLE_PREUPDATE_HOOK
+#endif
+// C++ includes
+#include <exception>
+#include <functional>
+#include <string>
+#include <vector>
+// Library includes
+#include "sqlite3cpp.h"
+#ifndef __SQLITESESSION_H_
+#error "sqlite3.h was included without SQLITE_ENABLE_SESSION, include sqlite3cpp_session.h first"
+#endif
+
+
+enum class ChangeConflictType
+{
+    Data,       // The row exists but its old values differ from the change
+    NotFound,   // The row to update or delete is gone
+    Conflict,   // An inserted primary key already exists
+    Constraint, // The change breaks a constraint
+    ForeignKey  // The applied changeset leaves foreign keys broken
+};
+
+enum class ChangeConflictAction
+{
+    Omit,    // Skip this change
+    Replace, // Overwrite the row, only for Data and Conflict, Omit otherwise
+    Abort    // Roll back the whole changeset
+};
+
+struct ChangeConflict
+{
+    ChangeConflictType type;
+    std::string table;
+    int operation; // SQLITE_INSERT, SQLITE_UPDATE or SQLITE_DELETE
+};
+
+
+// Records the changes made through one connection to the attached tables,
+// using the session extension. A changeset holds every changed row once, in
+// the state before and after the change; a patchset leaves out the old
+// values that are not part of the primary key and is smaller. Only tables
+// with a primary key are recorded.
+//
+// take() returns the changes since the last take(), so a replica can be kept
+// current by applying the deltas in order with apply().
+class ChangeTracker
+{
+public:
+    typedef std::function<ChangeConflictAction(ChangeConflict const&)> ConflictHandler;
+
+    ChangeTracker(Sqlite& db, std::string const& schema = "main")
+        :db{db.getHandle()}, schema{schema}, session{NULL}, enabled{true}
+    {
+        open();
+    }
+    ~ChangeTracker() {
+        if(this->session) sqlite3session_delete(this->session);
+    }
+    ChangeTracker(ChangeTracker const& copy) = delete;
+    ChangeTracker &operator = (const ChangeTracker &copy) = delete;
+
+    // Starts recording table, or every table of the schema when empty
+    void attach(std::string const& table) {
+        int rc = sqlite3session_attach(this->session, table.empty() ? NULL : table.c_str());
+        if(rc != SQLITE_OK) fail(rc, "Could not attach '" + table + "'");
+        this->tables.push_back(table);
+    }
+
+    // Pauses and resumes recording
+    void setEnabled(bool enabled) {
+        sqlite3session_enable(this->session, enabled ? 1 : 0);
+        this->enabled = enabled;
+    }
+
+    bool isEmpty() {
+        return sqlite3session_isempty(this->session) != 0;
+    }
+
+    std::string changeset() {
+        int size = 0;
+        void* data = NULL;
+        int rc = sqlite3session_changeset(this->session, &size, &data);
+        return collect(rc, data, size, "Could not create changeset");
+    }
+
+    std::string patchset() {
+        int size = 0;
+        void* data = NULL;
+        int rc = sqlite3session_patchset(this->session, &size, &data);
+        return collect(rc, data, size, "Could not create patchset");
+    }
+
+    // Changeset (or patchset) of everything since the last take() and
+    // starts recording afresh, paused if it was paused before. The new
+    // session is complete before it replaces the old one, so on failure the
+    // tracker keeps recording into the old one and nothing is lost.
+    std::string take(bool as_patchset = false) {
+        std::string changes = as_patchset ? patchset() : changeset();
+        sqlite3_session* fresh = NULL;
+        int rc = sqlite3session_create(this->db, this->schema.c_str(), &fresh);
+        if(rc != SQLITE_OK) {
+            fail(rc, "Could not create session");
+            return std::string();
+        }
+        if(!this->enabled) sqlite3session_enable(fresh, 0);
+        for(size_t i = 0; i < this->tables.size(); ++i) {
+            std::string const& table = this->tables[i];
+            rc = sqlite3session_attach(fresh, table.empty() ? NULL : table.c_str());
+            if(rc != SQLITE_OK) {
+                sqlite3session_delete(fresh);
+                fail(rc, "Could not attach '" + table + "'");
+                return std::string();
+            }
+        }
+        sqlite3session_delete(this->session);
+        this->session = fresh;
+        return changes;
+    }
+
+    // Applies a changeset or patchset to target in one transaction. Conflicts
+    // are settled by handler, or by policy without one. Returns the number
+    // of conflicts met; with Abort the first one throws instead. An
+    // exception thrown by handler aborts the changeset and is rethrown.
+    static size_t apply(Sqlite& target, std::string const& changes,
+        ChangeConflictAction policy = ChangeConflictAction::Abort, ConflictHandler handler = ConflictHandler()) {
+        Apply context{policy, handler, 0, std::exception_ptr()};
+        int rc = sqlite3changeset_apply(target.getHandle(), static_cast<int>(changes.size()),
+            const_cast<char*>(changes.data()), NULL, &ChangeTracker::xConflict, &context);
+#ifdef SQLITE3CPP_EXCEPTIONS
+        if(context.error) std::rethrow_exception(context.error);
+#endif
+        if(rc != SQLITE_OK) {
+            fail(rc, "Could not apply changeset: " + std::string(sqlite3_errmsg(target.getHandle())));
+        }
+        return context.conflicts;
+    }
+
+    // One changeset with the effect of applying first and then second
+    static std::string combine(std::string const& first, std::string const& second) {
+        int size = 0;
+        void* data = NULL;
+        int rc = sqlite3changeset_concat(static_cast<int>(first.size()), const_cast<char*>(first.data()),
+            static_cast<int>(second.size()), const_cast<char*>(second.data()), &size, &data);
+        return collect(rc, data, size, "Could not combine changesets");
+    }
+
+    // Changeset that undoes changes
+    static std::string invert(std::string const& changes) {
+        int size = 0;
+        void* data = NULL;
+        int rc = sqlite3changeset_invert(static_cast<int>(changes.size()), changes.data(), &size, &data);
+        return collect(rc, data, size, "Could not invert changeset");
+    }
+
+private:
+    struct Apply
+    {
+        ChangeConflictAction policy;
+        ConflictHandler handler;
+        size_t conflicts;
+        std::exception_ptr error; // Thrown by handler, must not cross SQLite
+    };
+
+    void open() {
+        int rc = sqlite3session_create(this->db, this->schema.c_str(), &this->session);
+        if(rc != SQLITE_OK) fail(rc, "Could not create session");
+    }
+
+    static std::string collect(int rc, void* data, int size, const char* context) {
+        if(rc != SQLITE_OK) {
+            sqlite3_free(data);
+            fail(rc, std::string(context) + ": " + sqlite3_errstr(rc));
+            return std::string();
+        }
+        std::string result(static_cast<const char*>(data), size);
+        sqlite3_free(data);
+        return result;
+    }
+
+    static int xConflict(void* ctx, int type, sqlite3_changeset_iter* iter) {
+        Apply* apply = static_cast<Apply*>(ctx);
+        ++apply->conflicts;
+        ChangeConflict conflict;
+        switch(type) {
+            case SQLITE_CHANGESET_DATA: conflict.type = ChangeConflictType::Data; break;
+            case SQLITE_CHANGESET_NOTFOUND: conflict.type = ChangeConflictType::NotFound; break;
+            case SQLITE_CHANGESET_CONFLICT: conflict.type = ChangeConflictType::Conflict; break;
+            case SQLITE_CHANGESET_CONSTRAINT: conflict.type = ChangeConflictType::Constraint; break;
+            default: conflict.type = ChangeConflictType::ForeignKey;
+        }
+        const char* table = NULL;
+        int columns = 0, indirect = 0;
+        conflict.operation = 0;
+        if(type != SQLITE_CHANGESET_FOREIGN_KEY) {
+            sqlite3changeset_op(iter, &table, &columns, &conflict.operation, &indirect);
+        }
+        ChangeConflictAction action = apply->policy;
+#ifdef SQLITE3CPP_EXCEPTIONS
+        try {
+            conflict.table = table ? table : "";
+            if(apply->handler) action = apply->handler(conflict);
+        }
+        catch(...) {
+            apply->error = std::current_exception();
+            return SQLITE_CHANGESET_ABORT;
+        }
+#else
+        conflict.table = table ? table : "";
+        if(apply->handler) action = apply->handler(conflict);
+#endif
+        switch(action) {
+            case ChangeConflictAction::Replace:
+                if(type == SQLITE_CHANGESET_DATA || type == SQLITE_CHANGESET_CONFLICT) return SQLITE_CHANGESET_REPLACE;
+                return SQLITE_CHANGESET_OMIT;
+            case ChangeConflictAction::Omit:
+                return SQLITE_CHANGESET_OMIT;
+            default:
+                return SQLITE_CHANGESET_ABORT;
+        }
+    }
+
+    static void fail(int rc, std::string const& msg) {
+        SqliteException e(rc, msg);
+        SQLITE3CPP_THROW(e);
+    }
+
+    sqlite3* db;
+    std::string schema;
+    sqlite3_session* session;
+    bool enabled;
+    std::vector<std::string> tables;
+};
+
+#endif //SQLITE3CPP_SESSION_H
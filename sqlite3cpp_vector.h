@@ -0,0 +1,478 @@
+#ifndef SQLITE3CPP_VECTOR_H
+#define SQLITE3CPP_VECTOR_H
+// C++ includes
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+// Library includes
+#include "sqlite3cpp.h"
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SQLITE3CPP_VECTOR_X86
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define SQLITE3CPP_VECTOR_NEON
+#include <arm_neon.h>
+#endif
+
+
+enum class SqliteSimd { Scalar, Avx2, Avx512, Neon };
+
+
+// Vector similarity SQL functions over embeddings stored as BLOBs, either
+// packed little-endian float32 or int8 values:
+//
+//   vec_dot(a, b)       vec_dot_i8(a, b)       dot product
+//   vec_cosine(a, b)    vec_cosine_i8(a, b)    cosine distance, 1 - cos(a, b)
+//   vec_l2(a, b)        vec_l2_i8(a, b)        Euclidean distance
+//
+// The blobs are read in place through sqlite3_value_blob, nothing is copied,
+// so "ORDER BY vec_cosine(embedding, ?) LIMIT k" ranks a table inside the
+// engine. Distances grow with dissimilarity, so nearest rows sort first. A
+// NULL argument gives NULL, vectors of different length are an error and a
+// zero vector has cosine distance 1.
+//
+// The kernels are picked once per process from what the CPU supports:
+// AVX-512 or AVX2 with FMA on x86, NEON on AArch64, plain C++ otherwise.
+class SqliteVector
+{
+public:
+    // Best instruction set of this CPU that has kernels
+    static SqliteSimd detected() {
+#ifdef SQLITE3CPP_VECTOR_X86
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) return SqliteSimd::Avx512;
+        if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return SqliteSimd::Avx2;
+#endif
+#ifdef SQLITE3CPP_VECTOR_NEON
+        return SqliteSimd::Neon;
+#endif
+        return SqliteSimd::Scalar;
+    }
+
+    static bool supported(SqliteSimd simd) {
+        return kernels(simd) != NULL;
+    }
+
+    // Registers the functions on db. simd forces a kernel set, which has to
+    // be supported by the CPU; mostly useful to compare against Scalar.
+    static void registerFunctions(Sqlite& db, SqliteSimd simd = detected()) {
+        Kernels const* k = kernels(simd);
+        if(!k) {
+            SqliteException e(SQLITE_MISUSE, "Vector kernels not available on this CPU");
+            SQLITE3CPP_THROW(e);
+        }
+        create(db, "vec_dot", k, &SqliteVector::floatFunction<Dot>);
+        create(db, "vec_cosine", k, &SqliteVector::floatFunction<Cosine>);
+        create(db, "vec_l2", k, &SqliteVector::floatFunction<L2>);
+        create(db, "vec_dot_i8", k, &SqliteVector::int8Function<Dot>);
+        create(db, "vec_cosine_i8", k, &SqliteVector::int8Function<Cosine>);
+        create(db, "vec_l2_i8", k, &SqliteVector::int8Function<L2>);
+    }
+
+private:
+    // Kernels take raw bytes, blobs carry no alignment guarantee.
+    // f32 sums: dot, |a|^2, |b|^2 or |a - b|^2 depending on the function.
+    struct Kernels
+    {
+        float (*dot)(const char* a, const char* b, size_t n);
+        float (*l2sq)(const char* a, const char* b, size_t n);
+        void (*cosine)(const char* a, const char* b, size_t n, float* ab, float* aa, float* bb);
+        int64_t (*dot_i8)(const int8_t* a, const int8_t* b, size_t n);
+        int64_t (*l2sq_i8)(const int8_t* a, const int8_t* b, size_t n);
+    };
+
+    enum Function { Dot, Cosine, L2 };
+
+    static Kernels const* kernels(SqliteSimd simd) {
+        static const Kernels scalar = { &scalarDot, &scalarL2sq, &scalarCosine, &scalarDotI8, &scalarL2sqI8 };
+        switch(simd) {
+            case SqliteSimd::Scalar: return &scalar;
+#ifdef SQLITE3CPP_VECTOR_X86
+            case SqliteSimd::Avx2: {
+                static const Kernels avx2 = { &avx2Dot, &avx2L2sq, &avx2Cosine, &avx2DotI8, &avx2L2sqI8 };
+                return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") ? &avx2 : NULL;
+            }
+            case SqliteSimd::Avx512: {
+                static const Kernels avx512 = { &avx512Dot, &avx512L2sq, &avx512Cosine, &avx2DotI8, &avx2L2sqI8 };
+                return detected() == SqliteSimd::Avx512 ? &avx512 : NULL;
+            }
+#endif
+#ifdef SQLITE3CPP_VECTOR_NEON
+            case SqliteSimd::Neon: {
+                static const Kernels neon = { &neonDot, &neonL2sq, &neonCosine, &neonDotI8, &neonL2sqI8 };
+                return &neon;
+            }
+#endif
+            default: return NULL;
+        }
+    }
+
+    static void create(Sqlite& db, const char* name, Kernels const* k, void (*f)(sqlite3_context*, int, sqlite3_value**)) {
+        int rc = sqlite3_create_function_v2(db.getHandle(), name, 2,
+            SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS, const_cast<Kernels*>(k), f, NULL, NULL, NULL);
+        if(rc != SQLITE_OK) {
+            SqliteException e(rc, "Could not create function " + std::string(name) + ": "
+                + std::string(sqlite3_errmsg(db.getHandle())));
+            SQLITE3CPP_THROW(e);
+        }
+    }
+
+    // Both blobs with their length in elements, false after reporting an error or NULL
+    static bool operands(sqlite3_context* ctx, sqlite3_value** argv, size_t width,
+        const char** a, const char** b, size_t* n) {
+        if(sqlite3_value_type(argv[0]) == SQLITE_NULL || sqlite3_value_type(argv[1]) == SQLITE_NULL) {
+            sqlite3_result_null(ctx);
+            return false;
+        }
+        *a = static_cast<const char*>(sqlite3_value_blob(argv[0]));
+        int a_size = sqlite3_value_bytes(argv[0]);
+        *b = static_cast<const char*>(sqlite3_value_blob(argv[1]));
+        int b_size = sqlite3_value_bytes(argv[1]);
+        if(a_size != b_size) {
+            sqlite3_result_error(ctx, "vectors have different dimensions", -1);
+            return false;
+        }
+        if(a_size % width != 0) {
+            sqlite3_result_error(ctx, width == sizeof(float) ? "blob is not a float32 vector" : "blob is not an int8 vector", -1);
+            return false;
+        }
+        *n = a_size / width;
+        return true;
+    }
+
+    static double cosineDistance(double ab, double aa, double bb) {
+        if(aa <= 0 || bb <= 0) return 1.0;
+        return 1.0 - ab / (std::sqrt(aa) * std::sqrt(bb));
+    }
+
+    template<Function F>
+    static void floatFunction(sqlite3_context* ctx, int, sqlite3_value** argv) {
+        Kernels const* k = static_cast<Kernels const*>(sqlite3_user_data(ctx));
+        const char* a;
+        const char* b;
+        size_t n;
+        if(!operands(ctx, argv, sizeof(float), &a, &b, &n)) return;
+        switch(F) {
+            case Dot: sqlite3_result_double(ctx, k->dot(a, b, n)); break;
+            case L2: sqlite3_result_double(ctx, std::sqrt(static_cast<double>(k->l2sq(a, b, n)))); break;
+            case Cosine: {
+                float ab, aa, bb;
+                k->cosine(a, b, n, &ab, &aa, &bb);
+                sqlite3_result_double(ctx, cosineDistance(ab, aa, bb));
+                break;
+            }
+        }
+    }
+
+    template<Function F>
+    static void int8Function(sqlite3_context* ctx, int, sqlite3_value** argv) {
+        Kernels const* k = static_cast<Kernels const*>(sqlite3_user_data(ctx));
+        const char* a;
+        const char* b;
+        size_t n;
+        if(!operands(ctx, argv, 1, &a, &b, &n)) return;
+        const int8_t* x = reinterpret_cast<const int8_t*>(a);
+        const int8_t* y = reinterpret_cast<const int8_t*>(b);
+        switch(F) {
+            case Dot: sqlite3_result_int64(ctx, k->dot_i8(x, y, n)); break;
+            case L2: sqlite3_result_double(ctx, std::sqrt(static_cast<double>(k->l2sq_i8(x, y, n)))); break;
+            case Cosine: {
+                double ab = static_cast<double>(k->dot_i8(x, y, n));
+                double aa = static_cast<double>(k->dot_i8(x, x, n));
+                double bb = static_cast<double>(k->dot_i8(y, y, n));
+                sqlite3_result_double(ctx, cosineDistance(ab, aa, bb));
+                break;
+            }
+        }
+    }
+
+    // Scalar kernels
+    static float load(const char* p, size_t i) {
+        float f;
+        std::memcpy(&f, p + i * sizeof(float), sizeof(float));
+        return f;
+    }
+
+    static float scalarDot(const char* a, const char* b, size_t n) {
+        float sum = 0;
+        for(size_t i = 0; i < n; ++i) sum += load(a, i) * load(b, i);
+        return sum;
+    }
+
+    static float scalarL2sq(const char* a, const char* b, size_t n) {
+        float sum = 0;
+        for(size_t i = 0; i < n; ++i) {
+            float d = load(a, i) - load(b, i);
+            sum += d * d;
+        }
+        return sum;
+    }
+
+    static void scalarCosine(const char* a, const char* b, size_t n, float* ab, float* aa, float* bb) {
+        float xy = 0, xx = 0, yy = 0;
+        for(size_t i = 0; i < n; ++i) {
+            float x = load(a, i), y = load(b, i);
+            xy += x * y;
+            xx += x * x;
+            yy += y * y;
+        }
+        *ab = xy;
+        *aa = xx;
+        *bb = yy;
+    }
+
+    static int64_t scalarDotI8(const int8_t* a, const int8_t* b, size_t n) {
+        int64_t sum = 0;
+        for(size_t i = 0; i < n; ++i) sum += static_cast<int32_t>(a[i]) * b[i];
+        return sum;
+    }
+
+    static int64_t scalarL2sqI8(const int8_t* a, const int8_t* b, size_t n) {
+        int64_t sum = 0;
+        for(size_t i = 0; i < n; ++i) {
+            int32_t d = static_cast<int32_t>(a[i]) - b[i];
+            sum += d * d;
+        }
+        return sum;
+    }
+
+#ifdef SQLITE3CPP_VECTOR_X86
+    // AVX2 + FMA, eight floats or sixteen int8 per step, scalar tail
+    __attribute__((target("avx2,fma")))
+    static float hsum256(__m256 v) {
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+        s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+        s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+        return _mm_cvtss_f32(s);
+    }
+
+    __attribute__((target("avx2,fma")))
+    static int64_t hsum256i(__m256i v) {
+        // Widened first, the lanes together can exceed 32 bits
+        __m256i lo = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(v));
+        __m256i hi = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(v, 1));
+        __m256i s = _mm256_add_epi64(lo, hi);
+        __m128i t = _mm_add_epi64(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+        return _mm_cvtsi128_si64(t) + _mm_extract_epi64(t, 1);
+    }
+
+    __attribute__((target("avx2,fma")))
+    static float avx2Dot(const char* a, const char* b, size_t n) {
+        __m256 acc = _mm256_setzero_ps();
+        size_t i = 0;
+        for(; i + 8 <= n; i += 8) {
+            acc = _mm256_fmadd_ps(_mm256_loadu_ps(reinterpret_cast<const float*>(a) + i),
+                _mm256_loadu_ps(reinterpret_cast<const float*>(b) + i), acc);
+        }
+        return hsum256(acc) + scalarDot(a + i * sizeof(float), b + i * sizeof(float), n - i);
+    }
+
+    __attribute__((target("avx2,fma")))
+    static float avx2L2sq(const char* a, const char* b, size_t n) {
+        __m256 acc = _mm256_setzero_ps();
+        size_t i = 0;
+        for(; i + 8 <= n; i += 8) {
+            __m256 d = _mm256_sub_ps(_mm256_loadu_ps(reinterpret_cast<const float*>(a) + i),
+                _mm256_loadu_ps(reinterpret_cast<const float*>(b) + i));
+            acc = _mm256_fmadd_ps(d, d, acc);
+        }
+        return hsum256(acc) + scalarL2sq(a + i * sizeof(float), b + i * sizeof(float), n - i);
+    }
+
+    __attribute__((target("avx2,fma")))
+    static void avx2Cosine(const char* a, const char* b, size_t n, float* ab, float* aa, float* bb) {
+        __m256 xy = _mm256_setzero_ps(), xx = _mm256_setzero_ps(), yy = _mm256_setzero_ps();
+        size_t i = 0;
+        for(; i + 8 <= n; i += 8) {
+            __m256 x = _mm256_loadu_ps(reinterpret_cast<const float*>(a) + i);
+            __m256 y = _mm256_loadu_ps(reinterpret_cast<const float*>(b) + i);
+            xy = _mm256_fmadd_ps(x, y, xy);
+            xx = _mm256_fmadd_ps(x, x, xx);
+            yy = _mm256_fmadd_ps(y, y, yy);
+        }
+        scalarCosine(a + i * sizeof(float), b + i * sizeof(float), n - i, ab, aa, bb);
+        *ab += hsum256(xy);
+        *aa += hsum256(xx);
+        *bb += hsum256(yy);
+    }
+
+    // Products of int8 fit int16, madd sums pairs of them into int32 lanes.
+    // The lanes are flushed to 64 bits before they can overflow.
+    __attribute__((target("avx2,fma")))
+    static int64_t avx2DotI8(const int8_t* a, const int8_t* b, size_t n) {
+        int64_t sum = 0;
+        size_t i = 0;
+        while(i + 16 <= n) {
+            __m256i acc = _mm256_setzero_si256();
+            for(size_t block = 0; block < 32768 && i + 16 <= n; ++block, i += 16) {
+                __m256i x = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+                __m256i y = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+                acc = _mm256_add_epi32(acc, _mm256_madd_epi16(x, y));
+            }
+            sum += hsum256i(acc);
+        }
+        return sum + scalarDotI8(a + i, b + i, n - i);
+    }
+
+    __attribute__((target("avx2,fma")))
+    static int64_t avx2L2sqI8(const int8_t* a, const int8_t* b, size_t n) {
+        int64_t sum = 0;
+        size_t i = 0;
+        while(i + 16 <= n) {
+            __m256i acc = _mm256_setzero_si256();
+            for(size_t block = 0; block < 8192 && i + 16 <= n; ++block, i += 16) {
+                __m256i x = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+                __m256i y = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+                __m256i d = _mm256_sub_epi16(x, y);
+                acc = _mm256_add_epi32(acc, _mm256_madd_epi16(d, d));
+            }
+            sum += hsum256i(acc);
+        }
+        return sum + scalarL2sqI8(a + i, b + i, n - i);
+    }
+
+    // AVX-512, sixteen floats per step with a masked tail
+    __attribute__((target("avx512f")))
+    static float hsum512(__m512 v) {
+        // _mm512_reduce_add_ps() and the plain extract and cast intrinsics
+        // build on an undefined register that trips -Wuninitialized in gcc
+        // 12, the zero-masked extract does not. The halves are added and
+        // reduced like an AVX2 register.
+        __m512d d = _mm512_castps_pd(v);
+        __m256 lo = _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xF, d, 0));
+        __m256 hi = _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd(0xF, d, 1));
+        return hsum256(_mm256_add_ps(lo, hi));
+    }
+
+    __attribute__((target("avx512f")))
+    static float avx512Dot(const char* a, const char* b, size_t n) {
+        const float* x = reinterpret_cast<const float*>(a);
+        const float* y = reinterpret_cast<const float*>(b);
+        __m512 acc = _mm512_setzero_ps();
+        size_t i = 0;
+        for(; i + 16 <= n; i += 16) acc = _mm512_fmadd_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i), acc);
+        if(i < n) {
+            __mmask16 m = static_cast<__mmask16>((1u << (n - i)) - 1);
+            acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, x + i), _mm512_maskz_loadu_ps(m, y + i), acc);
+        }
+        return hsum512(acc);
+    }
+
+    __attribute__((target("avx512f")))
+    static float avx512L2sq(const char* a, const char* b, size_t n) {
+        const float* x = reinterpret_cast<const float*>(a);
+        const float* y = reinterpret_cast<const float*>(b);
+        __m512 acc = _mm512_setzero_ps();
+        size_t i = 0;
+        for(; i + 16 <= n; i += 16) {
+            __m512 d = _mm512_sub_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i));
+            acc = _mm512_fmadd_ps(d, d, acc);
+        }
+        if(i < n) {
+            __mmask16 m = static_cast<__mmask16>((1u << (n - i)) - 1);
+            __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, x + i), _mm512_maskz_loadu_ps(m, y + i));
+            acc = _mm512_fmadd_ps(d, d, acc);
+        }
+        return hsum512(acc);
+    }
+
+    __attribute__((target("avx512f")))
+    static void avx512Cosine(const char* a, const char* b, size_t n, float* ab, float* aa, float* bb) {
+        const float* x = reinterpret_cast<const float*>(a);
+        const float* y = reinterpret_cast<const float*>(b);
+        __m512 xy = _mm512_setzero_ps(), xx = _mm512_setzero_ps(), yy = _mm512_setzero_ps();
+        size_t i = 0;
+        for(;; i += 16) {
+            __m512 u, v;
+            if(i + 16 <= n) {
+                u = _mm512_loadu_ps(x + i);
+                v = _mm512_loadu_ps(y + i);
+            }
+            else if(i < n) {
+                __mmask16 m = static_cast<__mmask16>((1u << (n - i)) - 1);
+                u = _mm512_maskz_loadu_ps(m, x + i);
+                v = _mm512_maskz_loadu_ps(m, y + i);
+            }
+            else break;
+            xy = _mm512_fmadd_ps(u, v, xy);
+            xx = _mm512_fmadd_ps(u, u, xx);
+            yy = _mm512_fmadd_ps(v, v, yy);
+        }
+        *ab = hsum512(xy);
+        *aa = hsum512(xx);
+        *bb = hsum512(yy);
+    }
+#endif
+
+#ifdef SQLITE3CPP_VECTOR_NEON
+    // NEON, four floats or eight int8 per step, scalar tail
+    static float neonDot(const char* a, const char* b, size_t n) {
+        float32x4_t acc = vdupq_n_f32(0);
+        size_t i = 0;
+        for(; i + 4 <= n; i += 4) {
+            acc = vfmaq_f32(acc, vld1q_f32(reinterpret_cast<const float*>(a) + i),
+                vld1q_f32(reinterpret_cast<const float*>(b) + i));
+        }
+        return vaddvq_f32(acc) + scalarDot(a + i * sizeof(float), b + i * sizeof(float), n - i);
+    }
+
+    static float neonL2sq(const char* a, const char* b, size_t n) {
+        float32x4_t acc = vdupq_n_f32(0);
+        size_t i = 0;
+        for(; i + 4 <= n; i += 4) {
+            float32x4_t d = vsubq_f32(vld1q_f32(reinterpret_cast<const float*>(a) + i),
+                vld1q_f32(reinterpret_cast<const float*>(b) + i));
+            acc = vfmaq_f32(acc, d, d);
+        }
+        return vaddvq_f32(acc) + scalarL2sq(a + i * sizeof(float), b + i * sizeof(float), n - i);
+    }
+
+    static void neonCosine(const char* a, const char* b, size_t n, float* ab, float* aa, float* bb) {
+        float32x4_t xy = vdupq_n_f32(0), xx = vdupq_n_f32(0), yy = vdupq_n_f32(0);
+        size_t i = 0;
+        for(; i + 4 <= n; i += 4) {
+            float32x4_t x = vld1q_f32(reinterpret_cast<const float*>(a) + i);
+            float32x4_t y = vld1q_f32(reinterpret_cast<const float*>(b) + i);
+            xy = vfmaq_f32(xy, x, y);
+            xx = vfmaq_f32(xx, x, x);
+            yy = vfmaq_f32(yy, y, y);
+        }
+        scalarCosine(a + i * sizeof(float), b + i * sizeof(float), n - i, ab, aa, bb);
+        *ab += vaddvq_f32(xy);
+        *aa += vaddvq_f32(xx);
+        *bb += vaddvq_f32(yy);
+    }
+
+    static int64_t neonDotI8(const int8_t* a, const int8_t* b, size_t n) {
+        int64_t sum = 0;
+        size_t i = 0;
+        while(i + 8 <= n) {
+            int32x4_t acc = vdupq_n_s32(0);
+            for(size_t block = 0; block < 32768 && i + 8 <= n; ++block, i += 8) {
+                acc = vpadalq_s16(acc, vmull_s8(vld1_s8(a + i), vld1_s8(b + i)));
+            }
+            sum += vaddlvq_s32(acc);
+        }
+        return sum + scalarDotI8(a + i, b + i, n - i);
+    }
+
+    static int64_t neonL2sqI8(const int8_t* a, const int8_t* b, size_t n) {
+        int64_t sum = 0;
+        size_t i = 0;
+        while(i + 8 <= n) {
+            int32x4_t acc = vdupq_n_s32(0);
+            for(size_t block = 0; block < 8192 && i + 8 <= n; ++block, i += 8) {
+                int16x8_t d = vsubl_s8(vld1_s8(a + i), vld1_s8(b + i));
+                acc = vmlal_s16(acc, vget_low_s16(d), vget_low_s16(d));
+                acc = vmlal_s16(acc, vget_high_s16(d), vget_high_s16(d));
+            }
+            sum += vaddlvq_s32(acc);
+        }
+        return sum + scalarL2sqI8(a + i, b + i, n - i);
+    }
+#endif
+};
+
+#endif //SQLITE3CPP_VECTOR_H
@@ -0,0 +1,905 @@
+#ifndef SQLITE3CPP_VFS_H
+#define SQLITE3CPP_VFS_H
+// C++ includes
+#include <cstring>
+#include <mutex>
+#include <string>
+// Library includes
+#include "sqlite3cpp.h"
+// io_uring is used through its system calls, liburing is not needed
+#if defined(__linux__) && !defined(SQLITE3CPP_NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define SQLITE3CPP_IO_URING
+#include <cerrno>
+#include <vector>
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+#endif
+
+
+// Base for VFS shims. Everything that is not about reading and writing files
+// (paths, randomness, time, dlopen) is forwarded to the parent VFS stored in
+// pAppData, a shim only has to supply xOpen and its sqlite3_io_methods.
+class SqliteVfsShim
+{
+protected:
+    typedef int (*OpenFunction)(sqlite3_vfs*, const char*, sqlite3_file*, int, int*);
+
+    // Registers vfs under name on top of the default VFS, once per process.
+    // A shim that wraps the parent's files sets wraps, they are stored right
+    // after its own file_size bytes.
+    static void registerShim(sqlite3_vfs& vfs, const char* name, int file_size, OpenFunction open, bool wraps = false) {
+        static std::mutex lock;
+        std::lock_guard<std::mutex> guard(lock);
+        if(sqlite3_vfs_find(name)) return;
+        sqlite3_vfs* parent = sqlite3_vfs_find(NULL);
+        if(!parent) fail(SQLITE_ERROR, "No default VFS to build on");
+        std::memset(&vfs, 0, sizeof(vfs));
+        vfs.iVersion = 2;
+        if(wraps) vfs.szOsFile = file_size + parent->szOsFile;
+        else vfs.szOsFile = file_size > parent->szOsFile ? file_size : parent->szOsFile;
+        vfs.mxPathname = parent->mxPathname;
+        vfs.zName = name;
+        vfs.pAppData = parent;
+        vfs.xOpen = open;
+        vfs.xDelete = &SqliteVfsShim::xDelete;
+        vfs.xAccess = &SqliteVfsShim::xAccess;
+        vfs.xFullPathname = &SqliteVfsShim::xFullPathname;
+        vfs.xDlOpen = &SqliteVfsShim::xDlOpen;
+        vfs.xDlError = &SqliteVfsShim::xDlError;
+        vfs.xDlSym = &SqliteVfsShim::xDlSym;
+        vfs.xDlClose = &SqliteVfsShim::xDlClose;
+        vfs.xRandomness = &SqliteVfsShim::xRandomness;
+        vfs.xSleep = &SqliteVfsShim::xSleep;
+        vfs.xCurrentTime = &SqliteVfsShim::xCurrentTime;
+        vfs.xGetLastError = &SqliteVfsShim::xGetLastError;
+        vfs.xCurrentTimeInt64 = &SqliteVfsShim::xCurrentTimeInt64;
+        int rc = sqlite3_vfs_register(&vfs, 0);
+        if(rc != SQLITE_OK) fail(rc, "Could not register VFS '" + std::string(name) + "'");
+    }
+
+    static sqlite3_vfs* parent(sqlite3_vfs* vfs) {
+        return static_cast<sqlite3_vfs*>(vfs->pAppData);
+    }
+
+    // "file:" URI for path with the given query, '%', '?' and '#' escaped
+    static std::string fileUri(std::string const& path, std::string const& query) {
+        static const char hex[] = "0123456789ABCDEF";
+        std::string uri = "file:";
+        for(size_t i = 0; i < path.size(); ++i) {
+            unsigned char ch = static_cast<unsigned char>(path[i]);
+            if(ch == '%' || ch == '?' || ch == '#') {
+                uri += '%';
+                uri += hex[ch >> 4];
+                uri += hex[ch & 15];
+            }
+            else uri += path[i];
+        }
+        return uri + "?" + query;
+    }
+
+    static void fail(int rc, std::string const& msg) {
+        SqliteException e(rc, msg);
+        SQLITE3CPP_THROW(e);
+    }
+
+private:
+    static int xDelete(sqlite3_vfs* vfs, const char* name, int sync_dir) {
+        return parent(vfs)->xDelete(parent(vfs), name, sync_dir);
+    }
+    static int xAccess(sqlite3_vfs* vfs, const char* name, int flags, int* out) {
+        return parent(vfs)->xAccess(parent(vfs), name, flags, out);
+    }
+    static int xFullPathname(sqlite3_vfs* vfs, const char* name, int n, char* out) {
+        return parent(vfs)->xFullPathname(parent(vfs), name, n, out);
+    }
+    static void* xDlOpen(sqlite3_vfs* vfs, const char* name) {
+        return parent(vfs)->xDlOpen(parent(vfs), name);
+    }
+    static void xDlError(sqlite3_vfs* vfs, int n, char* out) {
+        parent(vfs)->xDlError(parent(vfs), n, out);
+    }
+    static void (*xDlSym(sqlite3_vfs* vfs, void* handle, const char* symbol))(void) {
+        return parent(vfs)->xDlSym(parent(vfs), handle, symbol);
+    }
+    static void xDlClose(sqlite3_vfs* vfs, void* handle) {
+        parent(vfs)->xDlClose(parent(vfs), handle);
+    }
+    static int xRandomness(sqlite3_vfs* vfs, int n, char* out) {
+        return parent(vfs)->xRandomness(parent(vfs), n, out);
+    }
+    static int xSleep(sqlite3_vfs* vfs, int us) {
+        return parent(vfs)->xSleep(parent(vfs), us);
+    }
+    static int xCurrentTime(sqlite3_vfs* vfs, double* out) {
+        return parent(vfs)->xCurrentTime(parent(vfs), out);
+    }
+    static int xGetLastError(sqlite3_vfs* vfs, int n, char* out) {
+        return parent(vfs)->xGetLastError ? parent(vfs)->xGetLastError(parent(vfs), n, out) : 0;
+    }
+    static int xCurrentTimeInt64(sqlite3_vfs* vfs, sqlite3_int64* out) {
+        sqlite3_vfs* p = parent(vfs);
+        if(p->iVersion >= 2 && p->xCurrentTimeInt64) return p->xCurrentTimeInt64(p, out);
+        double now = 0;
+        int rc = p->xCurrentTime(p, &now);
+        *out = static_cast<sqlite3_int64>(now * 86400000.0);
+        return rc;
+    }
+};
+
+
+#ifdef SQLITE3CPP_POSIX
+// Read-only VFS for databases that never change while they are open. The
+// main database file is mapped once with PROT_READ and every read is served
+// from the mapping: xRead is a memcpy and, with mmap_size set, xFetch hands
+// SQLite pointers straight into the mapping. There is no locking and no
+// journal, so the file must not be written by anyone while it is open.
+// Journals and temp files still go to the default VFS.
+//
+// Opened through open() the connection uses the immutable=1 URI, so SQLite
+// skips change detection too, and all processes mapping the same file share
+// its pages in the OS page cache.
+class SqliteMmapVfs : private SqliteVfsShim
+{
+public:
+    static const char* name() {
+        return "sqlite3cpp-mmap";
+    }
+
+    // Registers the VFS. advice is passed to madvise() for every mapping,
+    // MADV_RANDOM suits b-tree lookups, MADV_SEQUENTIAL or MADV_WILLNEED
+    // suit databases that are mostly scanned.
+    static void install(int advice = MADV_RANDOM) {
+        adviceFlag() = advice;
+        registerShim(vfs(), name(), sizeof(File), &SqliteMmapVfs::xOpen);
+    }
+
+    // URI that opens path read-only and immutable through this VFS
+    static std::string uri(std::string const& path) {
+        return fileUri(path, "immutable=1&vfs=" + std::string(name()));
+    }
+
+    // Installs the VFS if needed and opens path through uri(). mmap_size is
+    // raised to cover the file so pages are used in place rather than copied.
+    static sqlite_ptr open(std::string const& path, bool debug = false) {
+        if(!sqlite3_vfs_find(name())) install();
+        sqlite_ptr db = std::make_shared<Sqlite>(uri(path), debug, SQLITE_OPEN_READONLY | SQLITE_OPEN_URI);
+        struct stat st;
+        if(::stat(path.c_str(), &st) == 0 && st.st_size > 0) {
+            db->exec("PRAGMA mmap_size=" + std::to_string(static_cast<long long>(st.st_size)));
+        }
+        return db;
+    }
+
+private:
+    struct File
+    {
+        sqlite3_file base;
+        const char* data;
+        sqlite3_int64 size;
+    };
+
+    static sqlite3_vfs& vfs() {
+        static sqlite3_vfs v;
+        return v;
+    }
+
+    static int& adviceFlag() {
+        static int advice = MADV_RANDOM;
+        return advice;
+    }
+
+    static const sqlite3_io_methods* methods() {
+        static const sqlite3_io_methods m = {
+            3,
+            &SqliteMmapVfs::xClose, &SqliteMmapVfs::xRead, &SqliteMmapVfs::xWrite,
+            &SqliteMmapVfs::xTruncate, &SqliteMmapVfs::xSync, &SqliteMmapVfs::xFileSize,
+            &SqliteMmapVfs::xLock, &SqliteMmapVfs::xUnlock, &SqliteMmapVfs::xCheckReservedLock,
+            &SqliteMmapVfs::xFileControl, &SqliteMmapVfs::xSectorSize,
+            &SqliteMmapVfs::xDeviceCharacteristics,
+            NULL, NULL, NULL, NULL,
+            &SqliteMmapVfs::xFetch, &SqliteMmapVfs::xUnfetch
+        };
+        return &m;
+    }
+
+    static int xOpen(sqlite3_vfs* vfs, const char* name, sqlite3_file* file, int flags, int* out_flags) {
+        if(!name || !(flags & SQLITE_OPEN_MAIN_DB)) {
+            return parent(vfs)->xOpen(parent(vfs), name, file, flags, out_flags);
+        }
+        File* f = reinterpret_cast<File*>(file);
+        f->base.pMethods = NULL;
+        f->data = NULL;
+        f->size = 0;
+        int fd = ::open(name, O_RDONLY);
+        if(fd < 0) return SQLITE_CANTOPEN;
+        struct stat st;
+        if(fstat(fd, &st) != 0) {
+            ::close(fd);
+            return SQLITE_CANTOPEN;
+        }
+        if(st.st_size > 0) {
+            void* m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if(m == MAP_FAILED) {
+                ::close(fd);
+                return SQLITE_CANTOPEN;
+            }
+            madvise(m, st.st_size, adviceFlag());
+            f->data = static_cast<const char*>(m);
+            f->size = st.st_size;
+        }
+        // The mapping keeps the file alive
+        ::close(fd);
+        f->base.pMethods = methods();
+        if(out_flags) *out_flags = (flags & ~(SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE)) | SQLITE_OPEN_READONLY;
+        return SQLITE_OK;
+    }
+
+    static int xClose(sqlite3_file* file) {
+        File* f = reinterpret_cast<File*>(file);
+        if(f->data) munmap(const_cast<char*>(f->data), f->size);
+        f->data = NULL;
+        return SQLITE_OK;
+    }
+
+    static int xRead(sqlite3_file* file, void* buf, int amount, sqlite3_int64 offset) {
+        File* f = reinterpret_cast<File*>(file);
+        sqlite3_int64 n = offset < f->size ? f->size - offset : 0;
+        if(n > amount) n = amount;
+        if(n > 0) std::memcpy(buf, f->data + offset, n);
+        if(n == amount) return SQLITE_OK;
+        // SQLite expects the missing tail to be zeroed
+        std::memset(static_cast<char*>(buf) + n, 0, amount - n);
+        return SQLITE_IOERR_SHORT_READ;
+    }
+
+    static int xWrite(sqlite3_file*, const void*, int, sqlite3_int64) {
+        return SQLITE_READONLY;
+    }
+
+    static int xTruncate(sqlite3_file*, sqlite3_int64) {
+        return SQLITE_READONLY;
+    }
+
+    static int xSync(sqlite3_file*, int) {
+        return SQLITE_OK;
+    }
+
+    static int xFileSize(sqlite3_file* file, sqlite3_int64* size) {
+        *size = reinterpret_cast<File*>(file)->size;
+        return SQLITE_OK;
+    }
+
+    // Nobody writes an immutable file, so every lock is granted
+    static int xLock(sqlite3_file*, int) {
+        return SQLITE_OK;
+    }
+
+    static int xUnlock(sqlite3_file*, int) {
+        return SQLITE_OK;
+    }
+
+    static int xCheckReservedLock(sqlite3_file*, int* out) {
+        *out = 0;
+        return SQLITE_OK;
+    }
+
+    static int xFileControl(sqlite3_file* file, int op, void* arg) {
+        if(op == SQLITE_FCNTL_MMAP_SIZE) {
+            // A negative value asks for the current limit, the whole file is always mapped
+            sqlite3_int64* limit = static_cast<sqlite3_int64*>(arg);
+            if(*limit < 0) *limit = reinterpret_cast<File*>(file)->size;
+            return SQLITE_OK;
+        }
+        return SQLITE_NOTFOUND;
+    }
+
+    static int xSectorSize(sqlite3_file*) {
+        return 4096;
+    }
+
+    static int xDeviceCharacteristics(sqlite3_file*) {
+        return SQLITE_IOCAP_IMMUTABLE;
+    }
+
+    static int xFetch(sqlite3_file* file, sqlite3_int64 offset, int amount, void** out) {
+        File* f = reinterpret_cast<File*>(file);
+        // SQLite only reads fetched pages, the mapping is PROT_READ
+        *out = offset + amount <= f->size ? const_cast<char*>(f->data + offset) : NULL;
+        return SQLITE_OK;
+    }
+
+    static int xUnfetch(sqlite3_file*, sqlite3_int64, void*) {
+        return SQLITE_OK;
+    }
+};
+#endif
+
+#ifdef SQLITE3CPP_IO_URING
+// Linux VFS that sends the writes and syncs of the main database, its
+// rollback journal and its WAL through io_uring. Locking, shared memory and
+// reads stay with the default unix VFS, which this shim wraps.
+//
+// xWrite only copies the page into a queue. Adjacent writes are merged, and
+// the queue is submitted as one batch when a file is synced, so a commit
+// costs one io_uring_enter() for all its pages plus the fsync instead of a
+// pwrite() per page. Every file has a queue of its own, submitted before a
+// read, truncate or close of that file. The queues of a database and its
+// journal or WAL are also submitted when the database's locks or shared
+// memory locks change, so other connections never see stale data. A write
+// that fails is returned by the call that submitted it and again by the next
+// xSync of its file. A single read gains nothing from a ring and still uses
+// pread().
+//
+// The ring writes through descriptors the shim opens itself, one per inode,
+// kept open until the last file of that inode opened through the shim is
+// closed. Closing a descriptor drops the process's POSIX locks on the file,
+// so a database should not be open through this VFS and another one in the
+// same process at the same time.
+//
+// When the kernel has no io_uring (or it is blocked, as in many containers)
+// every file is handed straight to the unix VFS, so the name can always be
+// used.
+class SqliteUringVfs : private SqliteVfsShim
+{
+public:
+    static const char* name() {
+        return "sqlite3cpp-uring";
+    }
+
+    // Registers the VFS, the ring itself is set up on the first open
+    static void install() {
+        registerShim(vfs(), name(), sizeof(File), &SqliteUringVfs::xOpen, true);
+    }
+
+    // Whether files are really served by io_uring rather than the fallback
+    static bool active() {
+        return ring().valid();
+    }
+
+private:
+    struct Write
+    {
+        sqlite3_int64 offset;
+        std::vector<char> data;
+    };
+
+    // Writes of one file waiting for the ring. Only the connection that owns
+    // the file touches it, so it needs no lock of its own.
+    struct Queue
+    {
+        std::vector<Write> pending;
+        size_t bytes = 0;
+        int error = SQLITE_OK;  // First failed write, kept until an xSync returns it
+    };
+
+    struct File
+    {
+        sqlite3_file base;
+        sqlite3_file* real;  // The unix VFS file, stored right after this struct
+        int fd;              // Descriptor opened by the shim or -1 to forward every write
+        bool synced;         // The first sync goes to the unix VFS for its directory sync
+        Queue* queue;        // Writes not submitted yet, NULL while fd is -1
+        File* main;          // Database of a journal or WAL
+        File* journal;       // Open rollback journal or WAL of a database
+    };
+
+    // One ring per process, used under the mutex. Each flush submits the
+    // queue of one file in batches of at most the ring size, every batch is
+    // reaped completely before the next one so the ring can never overflow.
+    class Ring
+    {
+    public:
+        static const unsigned entries = 256;
+        static const size_t max_write = 1 << 20;
+        static const size_t max_pending = 8 << 20;
+
+        Ring() {
+            io_uring_params p;
+            std::memset(&p, 0, sizeof(p));
+            this->fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+            if(this->fd < 0) return;
+            this->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+            this->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+            if(p.features & IORING_FEAT_SINGLE_MMAP) {
+                this->sq_size = this->cq_size = std::max(this->sq_size, this->cq_size);
+            }
+            this->sq_ring = mmap(NULL, this->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_SQ_RING);
+            this->cq_ring = (p.features & IORING_FEAT_SINGLE_MMAP) ? this->sq_ring
+                : mmap(NULL, this->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_CQ_RING);
+            void* s = mmap(NULL, p.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->fd, IORING_OFF_SQES);
+            if(this->sq_ring == MAP_FAILED || this->cq_ring == MAP_FAILED || s == MAP_FAILED) {
+                ::close(this->fd);
+                this->fd = -1;
+                return;
+            }
+            char* sq = static_cast<char*>(this->sq_ring);
+            char* cq = static_cast<char*>(this->cq_ring);
+            this->sq_tail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+            this->sq_mask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+            this->sq_array = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+            this->sqes = static_cast<io_uring_sqe*>(s);
+            this->cq_head = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+            this->cq_tail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+            this->cq_mask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+            this->cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+            this->slots = p.sq_entries < entries ? p.sq_entries : static_cast<unsigned>(entries);
+            this->iov.resize(this->slots);
+        }
+
+        bool valid() const {
+            return this->fd >= 0;
+        }
+
+        int queue(Queue& q, int fd, const void* buf, int amount, sqlite3_int64 offset) {
+            const char* data = static_cast<const char*>(buf);
+            sqlite3_int64 end = offset + amount;
+            // Queued writes must never overlap, the ring gives no ordering
+            // between them
+            for(size_t i = 0; i < q.pending.size(); ++i) {
+                Write& w = q.pending[i];
+                sqlite3_int64 w_end = w.offset + static_cast<sqlite3_int64>(w.data.size());
+                if(end <= w.offset || offset >= w_end) continue;
+                if(offset >= w.offset && end <= w_end) {
+                    std::memcpy(w.data.data() + (offset - w.offset), data, amount);
+                    return SQLITE_OK;
+                }
+                int rc = flush(q, fd, false);
+                if(rc != SQLITE_OK) return rc;
+                break;
+            }
+            if(!q.pending.empty()) {
+                Write& last = q.pending.back();
+                if(last.offset + static_cast<sqlite3_int64>(last.data.size()) == offset
+                    && last.data.size() + amount <= max_write) {
+                    last.data.insert(last.data.end(), data, data + amount);
+                    q.bytes += amount;
+                    return SQLITE_OK;
+                }
+            }
+            Write w;
+            w.offset = offset;
+            w.data.assign(data, data + amount);
+            q.pending.push_back(std::move(w));
+            q.bytes += amount;
+            if(q.pending.size() >= this->slots || q.bytes >= max_pending) return flush(q, fd, false);
+            return SQLITE_OK;
+        }
+
+        // Submits the writes queued in q, followed by an fdatasync of fd if
+        // sync is set, and waits for all of them. A failed write is returned
+        // by the flush that submitted it and kept in q.error until a sync
+        // returns it again.
+        int flush(Queue& q, int fd, bool sync) {
+            int rc = SQLITE_OK;
+            if(!q.pending.empty() || sync) {
+                std::lock_guard<std::mutex> guard(this->lock);
+                rc = submit(q, fd, sync);
+            }
+            if(q.error == SQLITE_OK && !sync) q.error = rc;
+            if(sync && q.error != SQLITE_OK) {
+                rc = q.error;
+                q.error = SQLITE_OK;
+            }
+            return rc;
+        }
+
+    private:
+        int submit(Queue& q, int fd, bool sync) {
+            int rc = SQLITE_OK;
+            size_t next = 0;
+            while(next < q.pending.size() || sync) {
+                unsigned count = 0;
+                unsigned tail = *this->sq_tail;
+                while(next + count < q.pending.size() && count < this->slots) {
+                    Write& w = q.pending[next + count];
+                    this->iov[count].iov_base = w.data.data();
+                    this->iov[count].iov_len = w.data.size();
+                    io_uring_sqe* sqe = prepare(tail++);
+                    sqe->opcode = IORING_OP_WRITEV;
+                    sqe->fd = fd;
+                    sqe->off = static_cast<__u64>(w.offset);
+                    sqe->addr = reinterpret_cast<__u64>(&this->iov[count]);
+                    sqe->len = 1;
+                    sqe->user_data = next + count;
+                    ++count;
+                }
+                bool with_sync = sync && next + count == q.pending.size() && count < this->slots;
+                if(with_sync) {
+                    // Drain makes the sync wait for every write before it
+                    io_uring_sqe* sqe = prepare(tail++);
+                    sqe->opcode = IORING_OP_FSYNC;
+                    sqe->flags = IOSQE_IO_DRAIN;
+                    sqe->fd = fd;
+                    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+                    sqe->user_data = ~static_cast<__u64>(0);
+                    ++count;
+                    sync = false;
+                }
+                __atomic_store_n(this->sq_tail, tail, __ATOMIC_RELEASE);
+                int result = complete(q, fd, count);
+                if(rc == SQLITE_OK) rc = result;
+                next += with_sync ? count - 1 : count;
+            }
+            q.pending.clear();
+            q.bytes = 0;
+            return rc;
+        }
+
+        io_uring_sqe* prepare(unsigned tail) {
+            unsigned index = tail & this->sq_mask;
+            io_uring_sqe* sqe = &this->sqes[index];
+            std::memset(sqe, 0, sizeof(*sqe));
+            this->sq_array[index] = index;
+            return sqe;
+        }
+
+        // Enters the ring until count entries are submitted and reaped. When
+        // the kernel refuses the ring, the entries it never took are taken
+        // back and finished with pwrite() and fdatasync() after the ones it
+        // did take have completed, their buffers have to outlive them.
+        int complete(Queue const& q, int fd, unsigned count) {
+            int rc = SQLITE_OK;
+            unsigned submitted = 0, reaped = 0;
+            bool broken = false;
+            std::vector<__u64> taken_back;
+            while(reaped < count) {
+                if(!broken) {
+                    int n = static_cast<int>(syscall(__NR_io_uring_enter, this->fd, count - submitted,
+                        count - reaped, IORING_ENTER_GETEVENTS, NULL, 0));
+                    if(n > 0) submitted += n;
+                    if(n < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                        broken = true;
+                        unsigned tail = *this->sq_tail;
+                        for(unsigned k = submitted; k < count; ++k) {
+                            taken_back.push_back(this->sqes[(tail - count + k) & this->sq_mask].user_data);
+                        }
+                        __atomic_store_n(this->sq_tail, tail - (count - submitted), __ATOMIC_RELEASE);
+                        count = submitted;
+                    }
+                }
+                else {
+                    usleep(100);
+                }
+                unsigned head = *this->cq_head;
+                while(head != __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE)) {
+                    io_uring_cqe* cqe = &this->cqes[head & this->cq_mask];
+                    int result = finish(q, fd, cqe->user_data, cqe->res);
+                    if(rc == SQLITE_OK) rc = result;
+                    ++head;
+                    ++reaped;
+                }
+                __atomic_store_n(this->cq_head, head, __ATOMIC_RELEASE);
+            }
+            // In ring order, so a sync still comes after the writes before it
+            for(size_t i = 0; i < taken_back.size(); ++i) {
+                int result = finish(q, fd, taken_back[i], -EINVAL);
+                if(rc == SQLITE_OK) rc = result;
+            }
+            return rc;
+        }
+
+        static int finish(Queue const& q, int fd, __u64 user_data, int res) {
+            if(user_data == ~static_cast<__u64>(0)) return finishSync(fd, res);
+            return finishWrite(q.pending[user_data], fd, res);
+        }
+
+        // Short writes and opcodes the kernel does not know finish with pwrite()
+        static int finishWrite(Write const& w, int fd, int res) {
+            size_t done = res > 0 ? static_cast<size_t>(res) : 0;
+            if(res < 0 && res != -EINVAL && res != -EOPNOTSUPP && res != -EAGAIN && res != -EINTR) {
+                return res == -ENOSPC ? SQLITE_FULL : SQLITE_IOERR_WRITE;
+            }
+            while(done < w.data.size()) {
+                ssize_t n = pwrite(fd, w.data.data() + done, w.data.size() - done, w.offset + done);
+                if(n < 0 && errno == EINTR) continue;
+                if(n <= 0) return errno == ENOSPC ? SQLITE_FULL : SQLITE_IOERR_WRITE;
+                done += n;
+            }
+            return SQLITE_OK;
+        }
+
+        static int finishSync(int fd, int res) {
+            if(res == -EINVAL || res == -EOPNOTSUPP) res = fdatasync(fd) == 0 ? 0 : -errno;
+            return res < 0 ? SQLITE_IOERR_FSYNC : SQLITE_OK;
+        }
+
+        int fd = -1;
+        size_t sq_size = 0, cq_size = 0;
+        void* sq_ring = MAP_FAILED;
+        void* cq_ring = MAP_FAILED;
+        unsigned* sq_tail = NULL;
+        unsigned sq_mask = 0;
+        unsigned* sq_array = NULL;
+        io_uring_sqe* sqes = NULL;
+        unsigned* cq_head = NULL;
+        unsigned* cq_tail = NULL;
+        unsigned cq_mask = 0;
+        io_uring_cqe* cqes = NULL;
+        unsigned slots = 0;
+        std::vector<iovec> iov;
+        std::mutex lock;
+    };
+
+    // The descriptors the ring writes to, one per inode. Closing any
+    // descriptor of a file drops every POSIX lock the process holds on it, so
+    // one is only closed with the last file of its inode opened here.
+    class Descriptors
+    {
+    public:
+        int acquire(const char* name) {
+            std::lock_guard<std::mutex> guard(this->lock);
+            struct stat st;
+            if(::stat(name, &st) == 0) {
+                for(size_t i = 0; i < this->open.size(); ++i) {
+                    if(this->open[i].dev == st.st_dev && this->open[i].ino == st.st_ino) {
+                        ++this->open[i].users;
+                        return this->open[i].fd;
+                    }
+                }
+            }
+            int fd = ::open(name, O_RDWR | O_CLOEXEC);
+            if(fd < 0) return -1;
+            if(fstat(fd, &st) != 0) {
+                ::close(fd);
+                return -1;
+            }
+            for(size_t i = 0; i < this->open.size(); ++i) {
+                // The file was replaced by one already open, fd must stay
+                // open as long as that one
+                if(this->open[i].dev == st.st_dev && this->open[i].ino == st.st_ino) {
+                    this->open[i].spare.push_back(fd);
+                    ++this->open[i].users;
+                    return this->open[i].fd;
+                }
+            }
+            Entry e;
+            e.dev = st.st_dev;
+            e.ino = st.st_ino;
+            e.fd = fd;
+            e.users = 1;
+            this->open.push_back(std::move(e));
+            return fd;
+        }
+
+        void release(int fd) {
+            std::lock_guard<std::mutex> guard(this->lock);
+            for(size_t i = 0; i < this->open.size(); ++i) {
+                Entry& e = this->open[i];
+                if(e.fd != fd) continue;
+                if(--e.users == 0) {
+                    ::close(e.fd);
+                    for(size_t s = 0; s < e.spare.size(); ++s) ::close(e.spare[s]);
+                    this->open.erase(this->open.begin() + i);
+                }
+                return;
+            }
+        }
+
+    private:
+        struct Entry
+        {
+            dev_t dev;
+            ino_t ino;
+            int fd;
+            int users;
+            std::vector<int> spare;
+        };
+
+        std::mutex lock;
+        std::vector<Entry> open;
+    };
+
+    static sqlite3_vfs& vfs() {
+        static sqlite3_vfs v;
+        return v;
+    }
+
+    // Never destroyed, files may still be closed during static destruction
+    static Ring& ring() {
+        static Ring* r = new Ring();
+        return *r;
+    }
+
+    static Descriptors& descriptors() {
+        static Descriptors* d = new Descriptors();
+        return *d;
+    }
+
+    static const sqlite3_io_methods* methods() {
+        static const sqlite3_io_methods m = {
+            3,
+            &SqliteUringVfs::xClose, &SqliteUringVfs::xRead, &SqliteUringVfs::xWrite,
+            &SqliteUringVfs::xTruncate, &SqliteUringVfs::xSync, &SqliteUringVfs::xFileSize,
+            &SqliteUringVfs::xLock, &SqliteUringVfs::xUnlock, &SqliteUringVfs::xCheckReservedLock,
+            &SqliteUringVfs::xFileControl, &SqliteUringVfs::xSectorSize,
+            &SqliteUringVfs::xDeviceCharacteristics,
+            &SqliteUringVfs::xShmMap, &SqliteUringVfs::xShmLock,
+            &SqliteUringVfs::xShmBarrier, &SqliteUringVfs::xShmUnmap,
+            &SqliteUringVfs::xFetch, &SqliteUringVfs::xUnfetch
+        };
+        return &m;
+    }
+
+    static int xOpen(sqlite3_vfs* vfs, const char* name, sqlite3_file* file, int flags, int* out_flags) {
+        sqlite3_vfs* p = parent(vfs);
+        const int routed = SQLITE_OPEN_MAIN_DB | SQLITE_OPEN_MAIN_JOURNAL | SQLITE_OPEN_WAL;
+        if(!name || !(flags & routed) || !ring().valid()) {
+            return p->xOpen(p, name, file, flags, out_flags);
+        }
+        File* f = reinterpret_cast<File*>(file);
+        f->base.pMethods = NULL;
+        f->real = reinterpret_cast<sqlite3_file*>(f + 1);
+        f->real->pMethods = NULL;
+        int opened = 0;
+        int rc = p->xOpen(p, name, f->real, flags, &opened);
+        if(out_flags) *out_flags = opened;
+        if(rc != SQLITE_OK) {
+            if(f->real->pMethods) f->real->pMethods->xClose(f->real);
+            return rc;
+        }
+        f->fd = -1;
+        f->synced = false;
+        f->queue = NULL;
+        f->main = NULL;
+        f->journal = NULL;
+        // Writes through a descriptor of its own only reach what the parent
+        // reads if the parent is a unix VFS working on the same file
+        if(std::strncmp(p->zName, "unix", 4) == 0 && !(opened & SQLITE_OPEN_READONLY)) {
+            f->queue = new(std::nothrow) Queue();
+            if(f->queue) f->fd = descriptors().acquire(name);
+            if(f->fd < 0) {
+                delete f->queue;
+                f->queue = NULL;
+            }
+        }
+        // A journal or WAL is submitted with its database whenever the
+        // database's locks change
+        if(flags & (SQLITE_OPEN_MAIN_JOURNAL | SQLITE_OPEN_WAL)) {
+            sqlite3_file* db = sqlite3_database_file_object(name);
+            if(db && db->pMethods == methods()) {
+                f->main = reinterpret_cast<File*>(db);
+                f->main->journal = f;
+            }
+        }
+        f->base.pMethods = methods();
+        return SQLITE_OK;
+    }
+
+    static sqlite3_file* real(sqlite3_file* file) {
+        return reinterpret_cast<File*>(file)->real;
+    }
+
+    // Submits the queued writes of file and, if with_journal is set, those of
+    // its journal or WAL. A write that failed is returned here and again by
+    // the next xSync of the file it belongs to.
+    static int flush(sqlite3_file* file, bool with_journal = false) {
+        File* f = reinterpret_cast<File*>(file);
+        int rc = f->fd >= 0 ? ring().flush(*f->queue, f->fd, false) : SQLITE_OK;
+        File* j = with_journal ? f->journal : NULL;
+        if(j && j->fd >= 0) {
+            int journal_rc = ring().flush(*j->queue, j->fd, false);
+            if(rc == SQLITE_OK) rc = journal_rc;
+        }
+        return rc;
+    }
+
+    // Submits queued writes, on error returns before the call is forwarded
+#define SQLITE3CPP_URING_FLUSH(with_journal) do { int flush_rc = flush(file, with_journal); if(flush_rc != SQLITE_OK) return flush_rc; } while(0)
+
+    static int xClose(sqlite3_file* file) {
+        File* f = reinterpret_cast<File*>(file);
+        int rc = flush(file);
+        if(f->main) f->main->journal = NULL;
+        if(f->journal) f->journal->main = NULL;
+        int close_rc = f->real->pMethods->xClose(f->real);
+        if(f->fd >= 0) descriptors().release(f->fd);
+        delete f->queue;
+        return rc != SQLITE_OK ? rc : close_rc;
+    }
+
+    static int xRead(sqlite3_file* file, void* buf, int amount, sqlite3_int64 offset) {
+        SQLITE3CPP_URING_FLUSH(false);
+        return real(file)->pMethods->xRead(real(file), buf, amount, offset);
+    }
+
+    static int xWrite(sqlite3_file* file, const void* buf, int amount, sqlite3_int64 offset) {
+        File* f = reinterpret_cast<File*>(file);
+        if(f->fd < 0) return f->real->pMethods->xWrite(f->real, buf, amount, offset);
+        return ring().queue(*f->queue, f->fd, buf, amount, offset);
+    }
+
+    static int xTruncate(sqlite3_file* file, sqlite3_int64 size) {
+        SQLITE3CPP_URING_FLUSH(false);
+        return real(file)->pMethods->xTruncate(real(file), size);
+    }
+
+    // Returns the first write of the file that failed since the last sync,
+    // so a commit never succeeds over pages that did not reach the disk
+    static int xSync(sqlite3_file* file, int flags) {
+        File* f = reinterpret_cast<File*>(file);
+        if(f->fd >= 0 && f->synced) return ring().flush(*f->queue, f->fd, true);
+        if(f->fd >= 0) {
+            int rc = ring().flush(*f->queue, f->fd, false);
+            if(rc == SQLITE_OK) rc = f->queue->error;
+            f->queue->error = SQLITE_OK;
+            if(rc != SQLITE_OK) return rc;
+        }
+        f->synced = true;
+        return f->real->pMethods->xSync(f->real, flags);
+    }
+
+    static int xFileSize(sqlite3_file* file, sqlite3_int64* size) {
+        SQLITE3CPP_URING_FLUSH(false);
+        return real(file)->pMethods->xFileSize(real(file), size);
+    }
+
+    static int xLock(sqlite3_file* file, int level) {
+        SQLITE3CPP_URING_FLUSH(true);
+        return real(file)->pMethods->xLock(real(file), level);
+    }
+
+    static int xUnlock(sqlite3_file* file, int level) {
+        SQLITE3CPP_URING_FLUSH(true);
+        return real(file)->pMethods->xUnlock(real(file), level);
+    }
+
+    static int xCheckReservedLock(sqlite3_file* file, int* out) {
+        return real(file)->pMethods->xCheckReservedLock(real(file), out);
+    }
+
+    static int xFileControl(sqlite3_file* file, int op, void* arg) {
+        SQLITE3CPP_URING_FLUSH(false);
+        return real(file)->pMethods->xFileControl(real(file), op, arg);
+    }
+
+    static int xSectorSize(sqlite3_file* file) {
+        return real(file)->pMethods->xSectorSize(real(file));
+    }
+
+    static int xDeviceCharacteristics(sqlite3_file* file) {
+        return real(file)->pMethods->xDeviceCharacteristics(real(file));
+    }
+
+    static int xShmMap(sqlite3_file* file, int region, int size, int extend, void volatile** out) {
+        const sqlite3_io_methods* m = real(file)->pMethods;
+        return m->iVersion >= 2 ? m->xShmMap(real(file), region, size, extend, out) : SQLITE_IOERR_SHMMAP;
+    }
+
+    // WAL frames must be on disk before the wal-index lock that publishes them is released
+    static int xShmLock(sqlite3_file* file, int offset, int n, int flags) {
+        SQLITE3CPP_URING_FLUSH(true);
+        const sqlite3_io_methods* m = real(file)->pMethods;
+        return m->iVersion >= 2 ? m->xShmLock(real(file), offset, n, flags) : SQLITE_IOERR_SHMLOCK;
+    }
+
+    // Has no result, a failed write is still returned by the next xSync of its file
+    static void xShmBarrier(sqlite3_file* file) {
+        flush(file, true);
+        const sqlite3_io_methods* m = real(file)->pMethods;
+        if(m->iVersion >= 2) m->xShmBarrier(real(file));
+    }
+
+    static int xShmUnmap(sqlite3_file* file, int remove) {
+        const sqlite3_io_methods* m = real(file)->pMethods;
+        return m->iVersion >= 2 ? m->xShmUnmap(real(file), remove) : SQLITE_OK;
+    }
+
+    static int xFetch(sqlite3_file* file, sqlite3_int64 offset, int amount, void** out) {
+        *out = NULL;
+        SQLITE3CPP_URING_FLUSH(false);
+        const sqlite3_io_methods* m = real(file)->pMethods;
+        return m->iVersion >= 3 ? m->xFetch(real(file), offset, amount, out) : SQLITE_OK;
+    }
+
+    static int xUnfetch(sqlite3_file* file, sqlite3_int64 offset, void* page) {
+        const sqlite3_io_methods* m = real(file)->pMethods;
+        return m->iVersion >= 3 ? m->xUnfetch(real(file), offset, page) : SQLITE_OK;
+    }
+#undef SQLITE3CPP_URING_FLUSH
+};
+#endif
+
+#endif //SQLITE3CPP_VFS_H
@@ -0,0 +1,338 @@
+#ifndef SQLITE3CPP_VTAB_H
+#define SQLITE3CPP_VTAB_H
+// C++ includes
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <vector>
+// Library includes
+#include "sqlite3cpp.h"
+
+
+// SQL column type for the declared type of a field
+template<typename F, typename Enable = void>
+struct SqliteColumnType
+{
+    static const char* name() { return ""; }
+};
+
+template<typename F>
+struct SqliteColumnType<F, typename std::enable_if<std::is_integral<F>::value>::type>
+{
+    static const char* name() { return "INTEGER"; }
+};
+
+template<typename F>
+struct SqliteColumnType<F, typename std::enable_if<std::is_floating_point<F>::value>::type>
+{
+    static const char* name() { return "REAL"; }
+};
+
+template<>
+struct SqliteColumnType<std::string>
+{
+    static const char* name() { return "TEXT"; }
+};
+
+template<>
+struct SqliteColumnType<std::vector<char>>
+{
+    static const char* name() { return "BLOB"; }
+};
+
+
+// Exposes a std::vector<T>, or any other random-access range, to SQL as a
+// read-only table. Columns are mapped to fields of T with column(); the
+// position of an element is its rowid. Cells are produced straight from the
+// container when a statement reads them, text and blobs are handed to SQLite
+// without a copy. The container may change between statements, not while
+// one is reading it.
+//
+//   std::vector<Person> people;
+//   SqliteContainerTable<std::vector<Person>> table(people);
+//   table.column("name", &Person::name).column("age", &Person::age);
+//   table.attach(db, "people");
+//   db.exec("SELECT ... FROM orders JOIN people ON people.name = orders.name");
+//
+// Lookups by rowid go straight to the element. An equality constraint on a
+// column is evaluated while scanning, so only matching rows reach SQLite,
+// unless it uses a collation other than BINARY.
+// The table object has to outlive every connection it is attached to.
+template<typename Range>
+class SqliteContainerTable
+{
+public:
+    typedef typename std::decay<decltype(*std::begin(std::declval<Range&>()))>::type value_type;
+
+    explicit SqliteContainerTable(Range& range)
+        :range{&range} {}
+    SqliteContainerTable(SqliteContainerTable const& copy) = delete;
+    SqliteContainerTable &operator = (const SqliteContainerTable &copy) = delete;
+
+    // Maps a column to a field of value_type. The field type has to be one
+    // SqliteValue can convert.
+    template<typename F>
+    SqliteContainerTable& column(std::string const& name, F value_type::* field) {
+        Column c;
+        c.name = name;
+        c.type = SqliteColumnType<F>::name();
+        c.result = [field](sqlite3_context* ctx, value_type const& v) { emit(ctx, v.*field); };
+        c.equals = [field](value_type const& v, sqlite3_value* key) { return equal(v.*field, key); };
+        this->columns.push_back(c);
+        return *this;
+    }
+
+    // Makes the table available on db as name. It is an eponymous virtual
+    // table, so it needs no CREATE VIRTUAL TABLE and nothing is stored.
+    void attach(Sqlite& db, std::string const& name) {
+        int rc = sqlite3_create_module_v2(db.getHandle(), name.c_str(), module(), this, NULL);
+        if(rc != SQLITE_OK) {
+            SqliteException e(rc, "Could not attach table '" + name + "': " + std::string(sqlite3_errmsg(db.getHandle())));
+            SQLITE3CPP_THROW(e);
+        }
+    }
+
+    size_t size() const {
+        return static_cast<size_t>(std::end(*this->range) - std::begin(*this->range));
+    }
+
+private:
+    struct Column
+    {
+        std::string name;
+        const char* type;
+        std::function<void(sqlite3_context*, value_type const&)> result;
+        std::function<bool(value_type const&, sqlite3_value*)> equals;
+    };
+
+    struct Table
+    {
+        sqlite3_vtab base;
+        SqliteContainerTable* owner;
+    };
+
+    struct Cursor
+    {
+        sqlite3_vtab_cursor base;
+        size_t pos;
+        size_t end;
+        int column;          // Column of the equality filter, -1 for none
+        sqlite3_value* key;  // Its value
+    };
+
+    // idxNum values; an equality filter on column c is column_filter + c
+    enum Plan { full_scan = 0, rowid_lookup = 1, column_filter = 2 };
+
+    value_type const& at(size_t i) const {
+        return std::begin(*this->range)[i];
+    }
+
+    // Text and blobs point into the container, it outlives the statement step
+    static void emit(sqlite3_context* ctx, std::string const& s) {
+        sqlite3_result_text(ctx, s.data(), static_cast<int>(s.size()), SQLITE_STATIC);
+    }
+    static void emit(sqlite3_context* ctx, std::vector<char> const& b) {
+        sqlite3_result_blob(ctx, b.data(), static_cast<int>(b.size()), SQLITE_STATIC);
+    }
+    template<typename F>
+    static void emit(sqlite3_context* ctx, F const& f) {
+        SqliteValue<F>::result(ctx, f);
+    }
+
+    // Never stricter than SQL equality, SQLite checks the rows again
+    static bool equal(std::string const& s, sqlite3_value* key) {
+        const unsigned char* text = sqlite3_value_text(key);
+        size_t n = static_cast<size_t>(sqlite3_value_bytes(key));
+        return text && n == s.size() && std::memcmp(text, s.data(), n) == 0;
+    }
+    static bool equal(std::vector<char> const& b, sqlite3_value* key) {
+        const void* blob = sqlite3_value_blob(key);
+        size_t n = static_cast<size_t>(sqlite3_value_bytes(key));
+        return n == b.size() && (n == 0 || std::memcmp(blob, b.data(), n) == 0);
+    }
+    template<typename F>
+    static typename std::enable_if<std::is_floating_point<F>::value, bool>::type equal(F const& f, sqlite3_value* key) {
+        return static_cast<double>(f) == sqlite3_value_double(key);
+    }
+    template<typename F>
+    static typename std::enable_if<std::is_integral<F>::value, bool>::type equal(F const& f, sqlite3_value* key) {
+        if(sqlite3_value_numeric_type(key) == SQLITE_FLOAT) return static_cast<double>(f) == sqlite3_value_double(key);
+        return static_cast<sqlite3_int64>(f) == sqlite3_value_int64(key);
+    }
+
+    // Zeroed first, the module has more members than one SQLite version knows
+    static sqlite3_module* module() {
+        static sqlite3_module m = []() {
+            sqlite3_module methods;
+            std::memset(&methods, 0, sizeof(methods));
+            // No xCreate makes the table eponymous-only
+            methods.xConnect = &SqliteContainerTable::xConnect;
+            methods.xBestIndex = &SqliteContainerTable::xBestIndex;
+            methods.xDisconnect = &SqliteContainerTable::xDisconnect;
+            methods.xOpen = &SqliteContainerTable::xOpen;
+            methods.xClose = &SqliteContainerTable::xClose;
+            methods.xFilter = &SqliteContainerTable::xFilter;
+            methods.xNext = &SqliteContainerTable::xNext;
+            methods.xEof = &SqliteContainerTable::xEof;
+            methods.xColumn = &SqliteContainerTable::xColumn;
+            methods.xRowid = &SqliteContainerTable::xRowid;
+            return methods;
+        }();
+        return &m;
+    }
+
+    static SqliteContainerTable& owner(sqlite3_vtab_cursor* cursor) {
+        return *reinterpret_cast<Table*>(cursor->pVtab)->owner;
+    }
+
+    static int xConnect(sqlite3* db, void* aux, int, const char* const*, sqlite3_vtab** out, char** err) {
+        SqliteContainerTable* self = static_cast<SqliteContainerTable*>(aux);
+        std::string sql = "CREATE TABLE x(";
+        for(size_t i = 0; i < self->columns.size(); ++i) {
+            if(i) sql += ", ";
+            sql += "\"";
+            for(size_t j = 0; j < self->columns[i].name.size(); ++j) {
+                if(self->columns[i].name[j] == '"') sql += '"';
+                sql += self->columns[i].name[j];
+            }
+            sql += "\" ";
+            sql += self->columns[i].type;
+        }
+        sql += ")";
+        int rc = sqlite3_declare_vtab(db, sql.c_str());
+        if(rc != SQLITE_OK) {
+            *err = sqlite3_mprintf("%s", sqlite3_errmsg(db));
+            return rc;
+        }
+        sqlite3_vtab_config(db, SQLITE_VTAB_INNOCUOUS);
+        Table* table = static_cast<Table*>(sqlite3_malloc(sizeof(Table)));
+        if(!table) return SQLITE_NOMEM;
+        std::memset(table, 0, sizeof(Table));
+        table->owner = self;
+        *out = &table->base;
+        return SQLITE_OK;
+    }
+
+    static int xDisconnect(sqlite3_vtab* vtab) {
+        sqlite3_free(vtab);
+        return SQLITE_OK;
+    }
+
+    static int xBestIndex(sqlite3_vtab* vtab, sqlite3_index_info* info) {
+        double rows = static_cast<double>(reinterpret_cast<Table*>(vtab)->owner->size());
+        int rowid = -1, column = -1;
+        for(int i = 0; i < info->nConstraint; ++i) {
+            sqlite3_index_info::sqlite3_index_constraint const& c = info->aConstraint[i];
+            if(!c.usable || c.op != SQLITE_INDEX_CONSTRAINT_EQ) continue;
+            if(c.iColumn < 0) rowid = i;
+            else if(column < 0 && binary(info, i)) column = i;
+        }
+        info->idxNum = full_scan;
+        info->estimatedCost = rows + 1;
+        info->estimatedRows = static_cast<sqlite3_int64>(rows);
+        if(rowid >= 0) {
+            info->idxNum = rowid_lookup;
+            info->aConstraintUsage[rowid].argvIndex = 1;
+            info->aConstraintUsage[rowid].omit = 1;
+            info->estimatedCost = 1;
+            info->estimatedRows = 1;
+            info->idxFlags = SQLITE_INDEX_SCAN_UNIQUE;
+        }
+        else if(column >= 0) {
+            // Still a scan, but only matching rows come out of it
+            info->idxNum = column_filter + info->aConstraint[column].iColumn;
+            info->aConstraintUsage[column].argvIndex = 1;
+            info->estimatedCost = rows * 0.5 + 1;
+            info->estimatedRows = static_cast<sqlite3_int64>(rows / 10) + 1;
+        }
+        return SQLITE_OK;
+    }
+
+    // The column filter compares bytes, a constraint with another collation
+    // (name = 'BOB' COLLATE NOCASE) has to see every row
+    static bool binary(sqlite3_index_info* info, int constraint) {
+        const char* collation = sqlite3_vtab_collation(info, constraint);
+        return !collation || sqlite3_stricmp(collation, "BINARY") == 0;
+    }
+
+    static int xOpen(sqlite3_vtab*, sqlite3_vtab_cursor** out) {
+        Cursor* cursor = static_cast<Cursor*>(sqlite3_malloc(sizeof(Cursor)));
+        if(!cursor) return SQLITE_NOMEM;
+        std::memset(cursor, 0, sizeof(Cursor));
+        cursor->column = -1;
+        *out = &cursor->base;
+        return SQLITE_OK;
+    }
+
+    static int xClose(sqlite3_vtab_cursor* base) {
+        Cursor* cursor = reinterpret_cast<Cursor*>(base);
+        sqlite3_value_free(cursor->key);
+        sqlite3_free(cursor);
+        return SQLITE_OK;
+    }
+
+    static int xFilter(sqlite3_vtab_cursor* base, int plan, const char*, int argc, sqlite3_value** argv) {
+        Cursor* cursor = reinterpret_cast<Cursor*>(base);
+        SqliteContainerTable& self = owner(base);
+        sqlite3_value_free(cursor->key);
+        cursor->key = NULL;
+        cursor->column = -1;
+        cursor->pos = 0;
+        cursor->end = self.size();
+        if(plan == rowid_lookup && argc == 1) {
+            sqlite3_int64 rowid = sqlite3_value_int64(argv[0]);
+            int type = sqlite3_value_numeric_type(argv[0]);
+            bool exact = type == SQLITE_INTEGER
+                || (type == SQLITE_FLOAT && sqlite3_value_double(argv[0]) == static_cast<double>(rowid));
+            if(exact && rowid >= 0 && static_cast<size_t>(rowid) < cursor->end) {
+                cursor->pos = static_cast<size_t>(rowid);
+                cursor->end = cursor->pos + 1;
+            }
+            else cursor->pos = cursor->end;
+        }
+        else if(plan >= column_filter && argc == 1) {
+            cursor->column = plan - column_filter;
+            cursor->key = sqlite3_value_dup(argv[0]);
+            if(!cursor->key) return SQLITE_NOMEM;
+            skip(cursor, self);
+        }
+        return SQLITE_OK;
+    }
+
+    // Moves to the next row matching the equality filter
+    static void skip(Cursor* cursor, SqliteContainerTable& self) {
+        if(cursor->column < 0) return;
+        Column const& c = self.columns[cursor->column];
+        while(cursor->pos < cursor->end && !c.equals(self.at(cursor->pos), cursor->key)) ++cursor->pos;
+    }
+
+    static int xNext(sqlite3_vtab_cursor* base) {
+        Cursor* cursor = reinterpret_cast<Cursor*>(base);
+        ++cursor->pos;
+        skip(cursor, owner(base));
+        return SQLITE_OK;
+    }
+
+    static int xEof(sqlite3_vtab_cursor* base) {
+        Cursor* cursor = reinterpret_cast<Cursor*>(base);
+        return cursor->pos >= cursor->end;
+    }
+
+    static int xColumn(sqlite3_vtab_cursor* base, sqlite3_context* ctx, int column) {
+        Cursor* cursor = reinterpret_cast<Cursor*>(base);
+        SqliteContainerTable& self = owner(base);
+        self.columns[column].result(ctx, self.at(cursor->pos));
+        return SQLITE_OK;
+    }
+
+    static int xRowid(sqlite3_vtab_cursor* base, sqlite3_int64* rowid) {
+        *rowid = static_cast<sqlite3_int64>(reinterpret_cast<Cursor*>(base)->pos);
+        return SQLITE_OK;
+    }
+
+    Range* range;
+    std::vector<Column> columns;
+};
+
+#endif //SQLITE3CPP_VTAB_H